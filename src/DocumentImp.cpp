@@ -296,6 +296,14 @@ unsigned DocumentImp::decrementLoadEventDelayCount(const std::u16string& href) {
     return count;
 }
 
+void DocumentImp::observeResourceTiming(const HttpRequestPtr& request, const std::u16string& initiatorType)
+{
+    if (!defaultView)
+        return;
+    if (WindowPtr window = defaultView->getWindowPtr())
+        window->getPerformanceImp()->observe(request, initiatorType, URL(getDocumentURI()));
+}
+
 // Document
 
 DOMImplementation DocumentImp::getImplementation()
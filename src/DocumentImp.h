@@ -229,6 +229,10 @@ public:
     unsigned incrementLoadEventDelayCount(const std::u16string& href = u"");
     unsigned decrementLoadEventDelayCount(const std::u16string& href = u"");
 
+    // Records the Resource Timing of request in the Performance object of
+    // the window once the request completes.
+    void observeResourceTiming(const HttpRequestPtr& request, const std::u16string& initiatorType);
+
     bool isBindingDocumentWindow(const WindowProxyPtr& window) const;
 
     // Node - override
@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <cstdlib>
+#include <cstring>
 #include <thread>
+#include <vector>
 #include <GL/freeglut.h>
 
 #include "DOMImplementationImp.h"
@@ -35,12 +38,101 @@ using namespace org::w3c::dom;
 
 extern html::Window window;
 
+namespace {
+
+// --cache-size=megabytes
+void initCacheSize(int* argc, char* argv[])
+{
+    for (int i = 1; i < *argc; ++i) {
+        if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            HttpCacheManager::getInstance().setSizeLimit(strtoull(argv[i] + 13, 0, 10) * 1024 * 1024);
+            for (; i < *argc; ++i)
+                argv[i] = argv[i + 1];
+            --*argc;
+            break;
+        }
+    }
+}
+
+// --http-threads=count
+void initHttpThreads(int* argc, char* argv[])
+{
+    for (int i = 1; i < *argc; ++i) {
+        if (strncmp(argv[i], "--http-threads=", 15) == 0) {
+            HttpConnectionManager::getInstance().setThreadCount(strtoul(argv[i] + 15, 0, 10));
+            for (; i < *argc; ++i)
+                argv[i] = argv[i + 1];
+            --*argc;
+            break;
+        }
+    }
+}
+
+// --http2=0 disables HTTP/2
+void initHttp2(int* argc, char* argv[])
+{
+    for (int i = 1; i < *argc; ++i) {
+        if (strncmp(argv[i], "--http2=", 8) == 0) {
+            HttpConnectionManager::getInstance().setHttp2Enabled(strtoul(argv[i] + 8, 0, 10) != 0);
+            for (; i < *argc; ++i)
+                argv[i] = argv[i + 1];
+            --*argc;
+            break;
+        }
+    }
+}
+
+// --parse-slice=milliseconds[,tokens], where zero means no limit
+void initParseSlice(int* argc, char* argv[])
+{
+    for (int i = 1; i < *argc; ++i) {
+        if (strncmp(argv[i], "--parse-slice=", 14) == 0) {
+            char* end;
+            unsigned milliseconds = strtoul(argv[i] + 14, &end, 10);
+            unsigned tokens = (*end == ',') ? strtoul(end + 1, 0, 10) : 0;
+            WindowProxy::setParseSlice(milliseconds, tokens);
+            for (; i < *argc; ++i)
+                argv[i] = argv[i + 1];
+            --*argc;
+            break;
+        }
+    }
+}
+
+// --stale-while-revalidate=origin=seconds, which can be repeated
+void initStaleWhileRevalidate(int* argc, char* argv[])
+{
+    for (int i = 1; i < *argc;) {
+        if (strncmp(argv[i], "--stale-while-revalidate=", 25) == 0) {
+            std::string value(argv[i] + 25);
+            size_t pos = value.rfind('=');
+            if (pos != std::string::npos) {
+                URL origin(utfconv(value.substr(0, pos)));
+                if (!origin.isEmpty())
+                    HttpCacheManager::getInstance().setStaleWhileRevalidate(origin, strtoul(value.c_str() + pos + 1, 0, 10));
+            }
+            for (int j = i; j < *argc; ++j)
+                argv[j] = argv[j + 1];
+            --*argc;
+        } else
+            ++i;
+    }
+}
+
+}
+
 int main(int argc, char* argv[])
 {
 #ifdef USE_V8
     v8::HandleScope handleScope;
 #endif  // USE_V8
 
+    initCacheSize(&argc, argv);
+    initHttpThreads(&argc, argv);
+    initHttp2(&argc, argv);
+    initStaleWhileRevalidate(&argc, argv);
+    initParseSlice(&argc, argv);
+
     if (argc < 3) {
         std::cout << "usage: " << argv[0] << " navigator_directory profile_directory\n";
         return EXIT_FAILURE;
@@ -72,6 +164,7 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
     HttpRequest::setCachePath(profile.createPath("cache"));
+    HttpCacheManager::getInstance().open(profile.createPath("cache"));
 
     init(&argc, argv);
     initLogLevel(&argc, argv, 0);
@@ -96,7 +189,9 @@ int main(int argc, char* argv[])
         getDOMImplementation()->setUserStyleSheet(loadStyleSheet(userSheet.c_str()));
 
     HttpRequest::setAboutPath(argv[1]);
-    std::thread httpService(std::ref(HttpConnectionManager::getInstance()));
+    std::vector<std::thread> httpServices;
+    for (unsigned i = 0; i < HttpConnectionManager::getInstance().getThreadCount(); ++i)
+        httpServices.emplace_back(std::ref(HttpConnectionManager::getInstance()));
 
     std::string navigatorPath = profile.getProfilePath() + "/escudo.html";
     if (!profile.hasFile(navigatorPath))
@@ -114,5 +209,6 @@ int main(int argc, char* argv[])
     ECMAScriptContext::shutDown();
 
     HttpConnectionManager::getInstance().stop();
-    httpService.join();
+    for (auto i = httpServices.begin(); i != httpServices.end(); ++i)
+        i->join();
 }
@@ -16,14 +16,19 @@
 
 #include "html/HTMLInputStream.h"
 #include "html/HTMLTokenizer.h"
+#include "html/HTMLTokenizerThread.h"
 
 #include <fstream>
+#include <map>
 #include <sstream>
+#include <thread>
 
 #include "utf.h"
 
 #include "picojson.h"
 
+using namespace org::w3c::dom::bootstrap;
+
 static const char* separator;
 
 bool emit(const Token& token, std::ostream& output)
@@ -78,7 +83,10 @@ bool emit(const Token& token, std::ostream& output)
         break;
     case Token::Type::Character:
         characterMode = true;
-        characters += token.getChar();
+        if (token.getCharacters().empty())
+            characters += token.getChar();
+        else
+            characters += token.getCharacters();
         break;
     case Token::Type::EndOfFile:
         eof = true;
@@ -92,32 +100,113 @@ bool emit(const Token& token, std::ostream& output)
     return !eof;
 }
 
-int test(const std::string& description, const std::string& input, const std::string& output)
+typedef std::map<size_t, std::u16string> Writes;
+
+// Tokenizes the input, inserting the text in writes after the tokens at the
+// specified counts have been read as document.write() does.
+std::string tokenize(HTMLTokenizer& tokenizer, const Writes& writes = Writes())
 {
     std::ostringstream result;
-    std::istringstream stream(input);
-    HTMLInputStream htmlInputStream(stream, "utf-8");
-    HTMLTokenizer tokenizer(&htmlInputStream);
     separator = "";
     result << '[';
-    for (;;) {
+    for (size_t count = 1;; ++count) {
         Token token = tokenizer.getToken();
         if (!emit(token, result))
             break;
+        auto i = writes.find(count);
+        if (i != writes.end())
+            tokenizer.insertString(i->second);
     }
     result << ']';
+    return result.str();
+}
+
+int test(const std::string& description, const std::string& input, const std::string& output)
+{
+    std::istringstream stream(input);
+    HTMLInputStream htmlInputStream(stream, "utf-8");
+    HTMLTokenizer tokenizer(&htmlInputStream);
+    std::string result = tokenize(tokenizer);
+
+    // Tokenize the input again on a worker thread.
+    HTMLTokenizerThread tokenizerThread(HttpContentSource(std::make_shared<const std::string>(input)), "utf-8");
+    tokenizerThread.feed(input.length(), true);
+    HTMLTokenizer threadedTokenizer(&tokenizerThread);
+    std::string threadedResult = tokenize(threadedTokenizer);
+
     std::cout << "description: " << description << '\n';
     std::cout << "input: " << input << '\n';
     std::cout << "expected: " << output << '\n';
-    std::cout << "output: " << result.str() << '\n';
-    if (result.str() == output) {
+    std::cout << "output: " << result << '\n';
+    if (result == output && threadedResult == output) {
         std::cout << "PASS\n";
         return EXIT_SUCCESS;
     }
-    std::cout << "FAIL: " << result.str() << '\n';
+    if (result != output)
+        std::cout << "FAIL: " << result << '\n';
+    else
+        std::cout << "FAIL (threaded): " << threadedResult << '\n';
     return EXIT_FAILURE;
 }
 
+int testWrite(const std::string& description, const std::string& input, const Writes& writes, const std::string& output)
+{
+    std::istringstream stream(input);
+    HTMLInputStream htmlInputStream(stream, "utf-8");
+    HTMLTokenizer tokenizer(&htmlInputStream);
+    std::string result = tokenize(tokenizer, writes);
+
+    HTMLTokenizerThread tokenizerThread(HttpContentSource(std::make_shared<const std::string>(input)), "utf-8");
+    tokenizerThread.feed(input.length(), true);
+    HTMLTokenizer threadedTokenizer(&tokenizerThread);
+    std::string threadedResult = tokenize(threadedTokenizer, writes);
+
+    std::cout << "description: " << description << '\n';
+    std::cout << "input: " << input << '\n';
+    std::cout << "expected: " << output << '\n';
+    std::cout << "output: " << result << '\n';
+    if (result == output && threadedResult == output) {
+        std::cout << "PASS\n";
+        return EXIT_SUCCESS;
+    }
+    if (result != output)
+        std::cout << "FAIL: " << result << '\n';
+    else
+        std::cout << "FAIL (threaded): " << threadedResult << '\n';
+    return EXIT_FAILURE;
+}
+
+// Writes text after the tokens that are not checkpoints of the worker
+// thread.
+int testWrites()
+{
+    int rc = EXIT_SUCCESS;
+    rc |= testWrite("Write after a character run", "<p>abc</p>def",
+                    Writes{{2, u"<b>x</b>"}},
+                    "[[\"StartTag\",\"p\",{}],[\"Character\",\"abc\"],[\"StartTag\",\"b\",{}],[\"Character\",\"x\"],[\"EndTag\",\"b\"],[\"EndTag\",\"p\"],[\"Character\",\"def\"]]");
+    rc |= testWrite("Write twice before a script", "<p>abc</p>def<script>x</script>ghi",
+                    Writes{{2, u"<i>"}, {4, u"jkl"}},
+                    "[[\"StartTag\",\"p\",{}],[\"Character\",\"abc\"],[\"StartTag\",\"i\",{}],[\"EndTag\",\"p\"],[\"Character\",\"jkldef\"],[\"StartTag\",\"script\",{}],[\"Character\",\"x\"],[\"EndTag\",\"script\"],[\"Character\",\"ghi\"]]");
+    return rc;
+}
+
+// Destroys the tokenizer thread while it is waiting for the rest of the
+// document to arrive.
+int testUnfinished()
+{
+    HttpRequestPtr request(std::make_shared<HttpRequest>());
+    std::ostream& content = request->getContent();
+    content << "<p>" << std::string(8192, 'a');
+    content.flush();
+    {
+        HTMLTokenizerThread tokenizerThread(request->getProgressiveContentSource(), "utf-8");
+        tokenizerThread.feed(1024 * 1024, false);    // more than has arrived
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::cout << "description: Destroy while loading\nPASS\n";
+    return EXIT_SUCCESS;
+}
+
 int load(const char* filename)
 {
     int rc = EXIT_SUCCESS;
@@ -149,7 +238,8 @@ int main(int argc, char* argv[])
         std::cout << "usage: " << argv[0] << " [tokenizer.test]...\n";
         exit(EXIT_FAILURE);
     }
-    int rc = EXIT_SUCCESS;
+    int rc = testWrites();
+    rc |= testUnfinished();
     for (int i = 1; i < argc; ++i)
         rc |= load(argv[i]);
     return rc;
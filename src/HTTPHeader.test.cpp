@@ -14,12 +14,15 @@
  * limitations under the License.
  */
 
+#include "http/HTTPContentDecoder.h"
 #include "http/HTTPHeader.h"
+#include "http/HTTPHpack.h"
 #include "http/HTTPResponseMessage.h"
 #include "http/HTTPRequestMessage.h"
 
 #include <string.h>
 #include <iostream>
+#include <sstream>
 
 using namespace org::w3c::dom::bootstrap;
 
@@ -76,6 +79,18 @@ const char* response5 =
     "Cache-Control: no-store, no-cache\r\n"
     "\r\n";
 
+const char* response6 =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Wed, 15 Nov 2011    06:25:24 GMT\r\n"
+    "Content-Length: 1024\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Encoding: gzip\r\n"
+    "\r\n";
+
+const char* response7 =
+    "HTTP/1.1 204 No Content\r\n"
+    "\r\n";
+
 int testHttpHeaderList()
 {
     HttpHeaderList list;
@@ -89,6 +104,8 @@ int testHttpHeaderList()
     std::string value;
     if (list.get("Connection", value))
         std::cout << "'" << value << "'\n";
+    if (const std::string* connection = list.get(HttpHeader::Connection))
+        std::cout << "'" << *connection << "'\n";
 
     list.set("Allow", "GET");
     std::cout << list.toString().c_str() << '\n';
@@ -106,7 +123,21 @@ int testHttpResponseMessage(const char* response)
     res.parse(response, response + strlen(response));
     std::cout << res.toString() << ' ' << res.getContentLength() << ' ' << res.getDateValue() << ' ' <<
                  res.isNoCache() << ' ' << res.isNoStore() << ' ' <<
-                 res.getContentType() << ' ' << res.getContentCharset() << "\n\n";
+                 res.getContentType() << ' ' << res.getContentCharset() << ' ' <<
+                 res.getContentEncoding() << "\n\n";
+    return 0;
+}
+
+int testContentRange(const char* response)
+{
+    HttpResponseMessage res;
+    res.parse(response, response + strlen(response));
+    unsigned long long first, last, length;
+    if (res.getContentRangeValue(first, last, length))
+        std::cout << first << '-' << last << '/' << length << ' ';
+    std::cout << "'" << res.getIfRangeValue() << "'\n";
+    res.clearContentRange(47022);
+    std::cout << res.toString() << '\n';
     return 0;
 }
 
@@ -129,6 +160,191 @@ int testHttpRequestMessage()
     return 0;
 }
 
+// cf. RFC 7541 Appendix C
+const char* hpackRequests[] = {
+    // C.3 without Huffman coding
+    "828684410f7777772e6578616d706c652e636f6d",
+    "828684be58086e6f2d6361636865",
+    "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+    0,
+    // C.4 with Huffman coding
+    "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+    "828684be5886a8eb10649cbf",
+    "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+    0
+};
+
+const char* hpackResponses[] = {
+    // C.6 with Huffman coding and the maximum table size of 256
+    "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff"
+    "6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+    "4883640effc1c0bf",
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94"
+    "e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c0"
+    "03ed4ee5b1063d5007",
+    0
+};
+
+std::string fromHex(const char* hex)
+{
+    std::string s;
+    for (; hex[0] && hex[1]; hex += 2)
+        s += static_cast<char>(std::stoi(std::string(hex, 2), 0, 16));
+    return s;
+}
+
+int decodeHpack(HttpHpackDecoder& decoder, const char** blocks)
+{
+    int result = 0;
+    for (; *blocks; ++blocks) {
+        std::string block(fromHex(*blocks));
+        HttpHpackFieldList fields;
+        if (!decoder.decode(block.data(), block.data() + block.length(), fields)) {
+            std::cout << "decode error\n";
+            ++result;
+            continue;
+        }
+        for (auto i = fields.begin(); i != fields.end(); ++i)
+            std::cout << i->first << ": " << i->second << '\n';
+        std::cout << "table size: " << decoder.getTable().getSize() << "\n\n";
+    }
+    return result;
+}
+
+int testHpack()
+{
+    int result = 0;
+
+    HttpHpackDecoder plain;
+    result += decodeHpack(plain, hpackRequests);
+    HttpHpackDecoder huffman;
+    result += decodeHpack(huffman, hpackRequests + 4);
+    HttpHpackDecoder responses;
+    responses.setMaxSize(256);
+    result += decodeHpack(responses, hpackResponses);
+
+    // The encoder uses Huffman coding whenever it is shorter, which is the
+    // case for all the strings in C.4.
+    const char* fields[][2] = {
+        { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" }, { 0, 0 },
+        { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" }, { "cache-control", "no-cache" }, { 0, 0 },
+        { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" }, { "custom-key", "custom-value" }, { 0, 0 },
+    };
+    HttpHpackEncoder encoder;
+    std::string block;
+    encoder.begin(block);
+    for (size_t i = 0, n = 4; i < sizeof fields / sizeof fields[0]; ++i) {
+        if (fields[i][0]) {
+            encoder.encode(block, fields[i][0], fields[i][1]);
+            continue;
+        }
+        bool matched = block == fromHex(hpackRequests[n++]);
+        std::cout << "encode " << (matched ? "ok" : "ng") << '\n';
+        if (!matched)
+            ++result;
+        block.clear();
+        encoder.begin(block);
+    }
+
+    // A malformed block must be rejected.
+    const char* errors[] = {
+        "80",                   // index zero
+        "be",                   // index beyond the table
+        "8220",                 // size update after a field
+        "3fe21f",               // size update beyond the limit
+        "418cf1e3c2e5f23a6ba0ab90f4",   // truncated string
+        "41821fff",             // padding longer than 7 bits
+        "4184ffffffff",         // EOS in a string
+        "ffffffffffffffffffffff0f",     // integer overflow
+        0
+    };
+    for (const char** i = errors; *i; ++i) {
+        HttpHpackDecoder decoder;
+        std::string block(fromHex(*i));
+        HttpHpackFieldList list;
+        bool failed = !decoder.decode(block.data(), block.data() + block.length(), list);
+        std::cout << *i << ": " << (failed ? "ok" : "ng") << '\n';
+        if (!failed)
+            ++result;
+    }
+    return result;
+}
+
+// Compresses data with zlib; windowBits selects the zlib, gzip, or raw
+// deflate format as in deflateInit2().
+std::string compress(const std::string& data, int windowBits)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof stream);
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::string compressed(deflateBound(&stream, data.length()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.length();
+    stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_out = compressed.length();
+    deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return compressed;
+}
+
+// Decodes encoded in chunks of the specified size; zero feeds it at once.
+bool decodeContent(int encoding, const std::string& encoded, size_t chunk, std::string& decoded)
+{
+    HttpContentDecoder decoder;
+    if (!decoder.start(encoding))
+        return false;
+    std::ostringstream content;
+    if (!chunk)
+        chunk = encoded.length();
+    for (size_t i = 0; i < encoded.length(); i += chunk) {
+        if (!decoder.write(content, encoded.data() + i, std::min(chunk, encoded.length() - i)))
+            return false;
+    }
+    decoded = content.str();
+    return decoded.length() == decoder.getDecodedLength();
+}
+
+int testContentDecoder()
+{
+    int result = 0;
+
+    std::string large;
+    for (int i = 0; large.length() < 100000; ++i)
+        large += std::to_string(i) + ' ';
+    struct {
+        const char* name;
+        int encoding;
+        std::string encoded;
+        std::string expected;
+    } tests[] = {
+        { "gzip", HttpResponseMessage::Gzip, compress("abcdef", MAX_WBITS + 16), "abcdef" },
+        { "deflate", HttpResponseMessage::Deflate, compress("abcdef", MAX_WBITS), "abcdef" },
+        { "raw deflate", HttpResponseMessage::Deflate, compress("abcdef", -MAX_WBITS), "abcdef" },
+        { "multi-member gzip", HttpResponseMessage::Gzip, compress("abc", MAX_WBITS + 16) + compress("def", MAX_WBITS + 16), "abcdef" },
+        { "large gzip", HttpResponseMessage::Gzip, compress(large, MAX_WBITS + 16), large },
+        { "large raw deflate", HttpResponseMessage::Deflate, compress(large, -MAX_WBITS), large },
+    };
+    const size_t chunks[] = { 0, 7, 1 };
+    for (auto& test : tests) {
+        for (size_t chunk : chunks) {
+            std::string decoded;
+            bool matched = decodeContent(test.encoding, test.encoded, chunk, decoded) && decoded == test.expected;
+            std::cout << test.name << " by " << chunk << ": " << (matched ? "ok" : "ng") << '\n';
+            if (!matched)
+                ++result;
+        }
+    }
+
+    // A corrupted stream must be rejected.
+    std::string decoded;
+    bool failed = !decodeContent(HttpResponseMessage::Gzip, "not gzip data", 0, decoded);
+    std::cout << "corrupted gzip: " << (failed ? "ok" : "ng") << '\n';
+    if (!failed)
+        ++result;
+    return result;
+}
+
 int main(int argc, char* argv[])
 {
     testHttpHeaderList();
@@ -138,4 +354,9 @@ int main(int argc, char* argv[])
     testHttpResponseMessage(response3);
     testHttpResponseMessage(response4);
     testHttpResponseMessage(response5);
+    testHttpResponseMessage(response6);
+    testHttpResponseMessage(response7);
+    testContentRange(response1);
+    testContentRange(response6);
+    return testHpack() + testContentDecoder();
 }
\ No newline at end of file
@@ -0,0 +1,431 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// HTTPRequest.bench measures the HTTP stack against an embedded loopback
+// server, both in plain HTTP/1.1 and over TLS with a self-signed certificate
+// generated at startup. Usage:
+//
+//   HTTPRequest.bench [--v=level] [--http-threads=count] [scale]
+//
+// The CPU time reported includes the embedded server, which runs in the same
+// process.
+
+#include "http/HTTPConnection.h"
+#include "http/HTTPCache.h"
+#include "http/HTTPSecureContext.h"
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "Test.util.h"
+#include "utf.h"
+
+using namespace org::w3c::dom::bootstrap;
+using namespace org::w3c::dom;
+
+namespace {
+
+const size_t SmallLength = 1024;
+const size_t LargeLength = 8 * 1024 * 1024;
+const size_t ChunkedLength = 256 * 1024;
+const size_t ChunkLength = 4096;
+const size_t ValidatedLength = 16 * 1024;
+const size_t FreshLength = 16 * 1024;
+
+std::string smallBody;
+std::string largeBody;
+std::string chunkedBody;    // already in the chunked transfer-coding
+std::string validatedBody;
+std::string freshBody;
+
+void initBodies()
+{
+    smallBody.assign(SmallLength, 's');
+    largeBody.resize(LargeLength);
+    for (size_t i = 0; i < LargeLength; ++i)
+        largeBody[i] = 'a' + i % 26;
+    std::string chunk(ChunkLength, 'c');
+    char size[16];
+    sprintf(size, "%zx\r\n", ChunkLength);
+    for (size_t i = 0; i < ChunkedLength / ChunkLength; ++i)
+        chunkedBody += size + chunk + "\r\n";
+    chunkedBody += "0\r\n\r\n";
+    validatedBody.assign(ValidatedLength, 'v');
+    freshBody.assign(FreshLength, 'f');
+}
+
+//
+// Embedded server
+//
+
+// Serves requests on stream until the client closes the connection. The
+// response is chosen by the first segment of the request path:
+//   /small/*      1KB, not stored
+//   /large/*      8MB, not stored
+//   /chunked/*    256KB in 4KB chunks, not stored
+//   /validated/*  16KB with an ETag that has to be revalidated every time
+//   /fresh/*      16KB that stays fresh for an hour
+//   /stale/*      16KB that is stale at once but can be served while revalidated
+template <class Stream>
+void serve(Stream& stream)
+{
+    boost::asio::streambuf buffer;
+    boost::system::error_code ec;
+    for (;;) {
+        size_t length = boost::asio::read_until(stream, buffer, "\r\n\r\n", ec);
+        if (ec)
+            return;
+        std::string head(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_begin(buffer.data()) + length);
+        buffer.consume(length);
+
+        size_t start = head.find(' ');
+        size_t end = head.find(' ', start + 1);
+        std::string path = (start != std::string::npos && end != std::string::npos) ? head.substr(start + 1, end - start - 1) : "";
+        bool matched = head.find("\r\nIf-None-Match: \"v1\"") != std::string::npos;
+
+        std::string header;
+        const std::string* body = 0;
+        if (path.compare(0, 7, "/small/") == 0) {
+            header = "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\n";
+            body = &smallBody;
+        } else if (path.compare(0, 7, "/large/") == 0) {
+            header = "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\n";
+            body = &largeBody;
+        } else if (path.compare(0, 9, "/chunked/") == 0) {
+            header = "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\nTransfer-Encoding: chunked\r\n";
+            body = &chunkedBody;
+        } else if (path.compare(0, 11, "/validated/") == 0) {
+            if (matched)
+                header = "HTTP/1.1 304 Not Modified\r\nCache-Control: no-cache\r\nETag: \"v1\"\r\n";
+            else {
+                header = "HTTP/1.1 200 OK\r\nCache-Control: no-cache\r\nETag: \"v1\"\r\n";
+                body = &validatedBody;
+            }
+        } else if (path.compare(0, 7, "/stale/") == 0) {
+            if (matched)
+                header = "HTTP/1.1 304 Not Modified\r\nCache-Control: max-age=0, stale-while-revalidate=3600\r\nETag: \"v1\"\r\n";
+            else {
+                header = "HTTP/1.1 200 OK\r\nCache-Control: max-age=0, stale-while-revalidate=3600\r\nETag: \"v1\"\r\n";
+                body = &validatedBody;
+            }
+        } else if (path.compare(0, 7, "/fresh/") == 0) {
+            header = "HTTP/1.1 200 OK\r\nCache-Control: max-age=3600\r\n";
+            body = &freshBody;
+        } else
+            header = "HTTP/1.1 404 Not Found\r\n";
+        header += "Content-Type: application/octet-stream\r\n";
+        if (body != &chunkedBody)
+            header += "Content-Length: " + boost::lexical_cast<std::string>(body ? body->length() : 0) + "\r\n";
+        header += "\r\n";
+
+        std::vector<boost::asio::const_buffer> buffers;
+        buffers.push_back(boost::asio::buffer(header));
+        if (body)
+            buffers.push_back(boost::asio::buffer(*body));
+        boost::asio::write(stream, buffers, ec);
+        if (ec)
+            return;
+    }
+}
+
+class LoopbackServer
+{
+    // Kept alive until the process exits since the connection threads are
+    // never joined.
+    boost::asio::io_service* ioService;
+    boost::asio::ip::tcp::acceptor* acceptor;
+    boost::asio::ssl::context* context;
+
+    void run() {
+        for (;;) {
+            if (context) {
+                auto stream = std::make_shared<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(*ioService, *context);
+                acceptor->accept(stream->lowest_layer());
+                std::thread([stream]() {
+                    boost::system::error_code ec;
+                    stream->handshake(boost::asio::ssl::stream_base::server, ec);
+                    if (!ec)
+                        serve(*stream);
+                }).detach();
+            } else {
+                auto socket = std::make_shared<boost::asio::ip::tcp::socket>(*ioService);
+                acceptor->accept(*socket);
+                std::thread([socket]() {
+                    serve(*socket);
+                }).detach();
+            }
+        }
+    }
+
+public:
+    explicit LoopbackServer(boost::asio::ssl::context* context = 0) :
+        ioService(new boost::asio::io_service),
+        acceptor(new boost::asio::ip::tcp::acceptor(*ioService, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))),
+        context(context)
+    {
+        std::thread(&LoopbackServer::run, this).detach();
+    }
+
+    unsigned short getPort() const {
+        return acceptor->local_endpoint().port();
+    }
+};
+
+// Generates a self-signed certificate for 127.0.0.1, which is installed in
+// the server context and trusted by HttpSecureContext.
+boost::asio::ssl::context* createSecureContext()
+{
+    EVP_PKEY* key = 0;
+    EVP_PKEY_CTX* keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, 0);
+    if (!keyContext ||
+        EVP_PKEY_keygen_init(keyContext) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(keyContext, &key) <= 0) {
+        EVP_PKEY_CTX_free(keyContext);
+        return 0;
+    }
+    EVP_PKEY_CTX_free(keyContext);
+
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("127.0.0.1"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    X509V3_CTX v3;
+    X509V3_set_ctx_nodb(&v3);
+    X509V3_set_ctx(&v3, cert, cert, 0, 0, 0);
+    const std::pair<int, const char*> extensions[] = {
+        { NID_basic_constraints, "critical,CA:TRUE" },
+        { NID_subject_alt_name, "IP:127.0.0.1" },
+    };
+    for (auto i = std::begin(extensions); i != std::end(extensions); ++i) {
+        if (X509_EXTENSION* ext = X509V3_EXT_conf_nid(0, &v3, i->first, const_cast<char*>(i->second))) {
+            X509_add_ext(cert, ext, -1);
+            X509_EXTENSION_free(ext);
+        }
+    }
+    if (!X509_sign(cert, key, EVP_sha256())) {
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        return 0;
+    }
+
+    boost::asio::ssl::context* context = new boost::asio::ssl::context(boost::asio::ssl::context::sslv23);
+    SSL_CTX_use_certificate(context->native_handle(), cert);
+    SSL_CTX_use_PrivateKey(context->native_handle(), key);
+    X509_STORE_add_cert(SSL_CTX_get_cert_store(HttpSecureContext::getInstance().getContext().native_handle()), cert);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return context;
+}
+
+//
+// Client
+//
+
+typedef std::chrono::steady_clock Clock;
+
+double getCPUTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+struct Scenario
+{
+    const char* name;
+    const char* path;       // followed by the request number modulo urlCount
+    unsigned urlCount;
+    size_t bodyLength;
+    unsigned count;
+    unsigned concurrency;
+    bool warm;              // fetch every URL once before measuring
+};
+
+class Run
+{
+    std::u16string origin;
+    const Scenario& scenario;
+
+    unsigned sent;
+    unsigned received;
+    unsigned errors;
+    std::vector<Clock::time_point> started;
+    std::vector<double> latencies;  // in milliseconds
+    std::vector<HttpRequestPtr> finished;
+
+    std::u16string getURL(unsigned i) const {
+        return origin + utfconv(scenario.path) + utfconv(boost::lexical_cast<std::string>(i % scenario.urlCount));
+    }
+
+    void handle(HttpRequest* request, unsigned i) {
+        latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - started[i]).count());
+        if (request->getError() || request->getStatus() != 200)
+            ++errors;
+        ++received;
+    }
+
+    void start(unsigned i, std::vector<HttpRequestPtr>& active) {
+        HttpRequestPtr request(std::make_shared<HttpRequest>());
+        request->open(u"get", getURL(i));
+        request->setHandler(boost::bind(&Run::handle, this, request.get(), i));
+        active.push_back(request);
+        started[i] = Clock::now();
+        request->send();
+    }
+
+    void fetch(unsigned count) {
+        sent = received = errors = 0;
+        started.assign(count, Clock::time_point());
+        latencies.clear();
+        latencies.reserve(count);
+
+        HttpConnectionManager& manager(HttpConnectionManager::getInstance());
+        std::vector<HttpRequestPtr> active;
+        while (received < count) {
+            while (sent < count && sent - received < scenario.concurrency)
+                start(sent++, active);
+            unsigned before = received;
+            manager.poll();
+            if (before == received)
+                usleep(20);
+            for (auto i = active.begin(); i != active.end();) {
+                if ((*i)->getReadyState() == HttpRequest::DONE)
+                    i = active.erase(i);
+                else
+                    ++i;
+            }
+        }
+    }
+
+public:
+    Run(const std::u16string& origin, const Scenario& scenario) :
+        origin(origin),
+        scenario(scenario),
+        sent(0),
+        received(0),
+        errors(0)
+    {
+    }
+
+    void operator()() {
+        if (scenario.warm)
+            fetch(scenario.urlCount);
+
+        double cpu = getCPUTime();
+        Clock::time_point begin = Clock::now();
+        fetch(scenario.count);
+        double wall = std::chrono::duration<double>(Clock::now() - begin).count();
+        cpu = getCPUTime() - cpu;
+
+        std::sort(latencies.begin(), latencies.end());
+        double p50 = latencies[latencies.size() / 2];
+        double p99 = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+        double mb = static_cast<double>(scenario.bodyLength) * scenario.count / (1024 * 1024);
+        printf("%-8s %-10s %7u %10.1f %9.3f %9.3f %9.1f %10.3f %6u\n",
+               (origin.compare(0, 6, u"https:") == 0) ? "https" : "http",
+               scenario.name, scenario.count, scenario.count / wall, p50, p99, mb, cpu * 1000 / mb, errors);
+    }
+};
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    initLogLevel(&argc, argv, 0);
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--http-threads=", 15) == 0) {
+            HttpConnectionManager::getInstance().setThreadCount(strtoul(argv[i] + 15, 0, 10));
+            for (; i < argc; ++i)
+                argv[i] = argv[i + 1];
+            --argc;
+            break;
+        }
+    }
+    unsigned scale = (2 <= argc) ? std::max(1ul, strtoul(argv[1], 0, 10)) : 1;
+
+    initBodies();
+
+    std::vector<std::thread> httpServices;
+    for (unsigned i = 0; i < HttpConnectionManager::getInstance().getThreadCount(); ++i)
+        httpServices.emplace_back(std::ref(HttpConnectionManager::getInstance()));
+
+    const Scenario scenarios[] = {
+        { "small", "/small/", 1000000, SmallLength, 5000 * scale, 6, false },
+        { "large", "/large/", 1000000, LargeLength, 20 * scale, 2, false },
+        { "chunked", "/chunked/", 1000000, ChunkedLength, 200 * scale, 6, false },
+        { "keepalive", "/small/", 1000000, SmallLength, 2000 * scale, 1, false },
+        { "304", "/validated/", 64, ValidatedLength, 2000 * scale, 6, true },
+        { "hit", "/fresh/", 64, FreshLength, 20000 * scale, 6, true },
+        { "swr", "/stale/", 64, ValidatedLength, 2000 * scale, 6, true },
+    };
+
+    LoopbackServer plain;
+    LoopbackServer* secure = 0;
+    if (boost::asio::ssl::context* context = createSecureContext())
+        secure = new LoopbackServer(context);
+    else
+        std::cerr << "could not create a self-signed certificate; skipping TLS.\n";
+
+    printf("%-8s %-10s %7s %10s %9s %9s %9s %10s %6s\n",
+           "protocol", "scenario", "count", "req/s", "p50(ms)", "p99(ms)", "MB", "CPU(ms)/MB", "errors");
+    for (int s = 0; s < 2; ++s) {
+        if (s == 1 && !secure)
+            break;
+        std::string origin = (s == 0 ? "http://127.0.0.1:" : "https://127.0.0.1:") +
+                             boost::lexical_cast<std::string>(s == 0 ? plain.getPort() : secure->getPort());
+        for (auto i = std::begin(scenarios); i != std::end(scenarios); ++i) {
+            Run run(utfconv(origin), *i);
+            run();
+        }
+    }
+    if (1 <= getLogLevel()) {
+        HttpCacheManager::getInstance().dump();
+        HttpConnectionManager::dump();
+    }
+
+    HttpConnectionManager::getInstance().stop();
+    for (auto i = httpServices.begin(); i != httpServices.end(); ++i)
+        i->join();
+    return 0;
+}
@@ -51,7 +51,7 @@ int test(std::u16string urlString)
 
     std::cerr << request->getResponseMessage().toString() << "----\n";
     std::cerr << request->getResponseMessage().getContentCharset() << "----\n";
-    boost::iostreams::stream<boost::iostreams::file_descriptor_source> stream(request->getContentDescriptor(), boost::iostreams::close_handle);
+    HttpContentStream stream(request->getContentSource());
     while (stream) {
         char c = stream.get();
         if (stream.good())
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEENTRYIMP_H_INCLUDED
+#define ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEENTRYIMP_H_INCLUDED
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <org/w3c/dom/PerformanceEntry.h>
+
+namespace org
+{
+namespace w3c
+{
+namespace dom
+{
+namespace bootstrap
+{
+class PerformanceEntryImp : public ObjectMixin<PerformanceEntryImp>
+{
+protected:
+    std::u16string name;
+    std::u16string entryType;
+    double startTime;
+    double duration;
+
+public:
+    PerformanceEntryImp(const std::u16string& name, const std::u16string& entryType, double startTime, double duration) :
+        name(name),
+        entryType(entryType),
+        startTime(startTime),
+        duration(duration)
+    {
+    }
+
+    // PerformanceEntry
+    std::u16string getName();
+    std::u16string getEntryType();
+    double getStartTime();
+    double getDuration();
+    // Object
+    virtual Any message_(uint32_t selector, const char* id, int argc, Any* argv)
+    {
+        return PerformanceEntry::dispatch(this, selector, id, argc, argv);
+    }
+    static const char* const getMetaData()
+    {
+        return PerformanceEntry::getMetaData();
+    }
+};
+
+}
+}
+}
+}
+
+#endif  // ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEENTRYIMP_H_INCLUDED
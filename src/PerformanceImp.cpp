@@ -0,0 +1,128 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PerformanceImp.h"
+
+#include <boost/bind.hpp>
+
+#include "PerformanceEntryListImp.h"
+#include "utf.h"
+
+namespace org
+{
+namespace w3c
+{
+namespace dom
+{
+namespace bootstrap
+{
+
+namespace {
+
+std::u16string getOrigin(const URL& url)
+{
+    return url.getProtocol() + u"//" + url.getHost();
+}
+
+}
+
+PerformanceImp::PerformanceImp() :
+    timeOrigin(HttpTiming::now()),
+    bufferSize(DefaultBufferSize)
+{
+}
+
+void PerformanceImp::observe(const HttpRequestPtr& request, const std::u16string& initiatorType, const URL& origin)
+{
+    // The request is alive while its callbacks are being called.
+    request->addCallback(boost::bind(&PerformanceImp::addResourceTiming, std::static_pointer_cast<PerformanceImp>(self()), request.get(), initiatorType, getOrigin(origin)));
+}
+
+void PerformanceImp::addResourceTiming(HttpRequest* request, const std::u16string& initiatorType, const std::u16string& origin)
+{
+    const HttpTiming& timing(request->getTiming());
+    if (request->isCanceled() || request->getError() || !timing.fetchStart || timing.startTime < timeOrigin)
+        return;
+    if (bufferSize <= entries.size())
+        return;
+
+    // A cross-origin server has to allow the detailed timing to be exposed.
+    bool detailed = true;
+    if (getOrigin(request->getURL()) != origin) {
+        std::u16string allowed = utfconv(request->getResponseMessage().getResponseHeader("Timing-Allow-Origin"));
+        detailed = (allowed == u"*" || allowed.find(origin) != std::u16string::npos);
+    }
+    entries.push_back(std::make_shared<PerformanceResourceTimingImp>(request->getURL(), initiatorType, timing, timeOrigin, detailed));
+}
+
+double PerformanceImp::now()
+{
+    return HttpTiming::now() - timeOrigin;
+}
+
+PerformanceEntryList PerformanceImp::getEntries()
+{
+    auto list = std::make_shared<PerformanceEntryListImp>();
+    for (auto i = entries.begin(); i != entries.end(); ++i)
+        list->addItem(*i);
+    return list;
+}
+
+PerformanceEntryList PerformanceImp::getEntriesByType(const std::u16string& entryType)
+{
+    auto list = std::make_shared<PerformanceEntryListImp>();
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+        if ((*i)->getEntryType() == entryType)
+            list->addItem(*i);
+    }
+    return list;
+}
+
+PerformanceEntryList PerformanceImp::getEntriesByName(const std::u16string& name)
+{
+    auto list = std::make_shared<PerformanceEntryListImp>();
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+        if ((*i)->getName() == name)
+            list->addItem(*i);
+    }
+    return list;
+}
+
+PerformanceEntryList PerformanceImp::getEntriesByName(const std::u16string& name, const std::u16string& entryType)
+{
+    auto list = std::make_shared<PerformanceEntryListImp>();
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+        if ((*i)->getName() == name && (*i)->getEntryType() == entryType)
+            list->addItem(*i);
+    }
+    return list;
+}
+
+void PerformanceImp::clearResourceTimings()
+{
+    entries.clear();
+}
+
+void PerformanceImp::setResourceTimingBufferSize(unsigned int maxSize)
+{
+    bufferSize = maxSize;
+}
+
+}
+}
+}
+}
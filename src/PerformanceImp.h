@@ -0,0 +1,85 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEIMP_H_INCLUDED
+#define ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEIMP_H_INCLUDED
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <org/w3c/dom/Performance.h>
+
+#include <org/w3c/dom/PerformanceEntryList.h>
+
+#include <deque>
+
+#include "PerformanceResourceTimingImp.h"
+#include "http/HTTPRequest.h"
+
+namespace org
+{
+namespace w3c
+{
+namespace dom
+{
+namespace bootstrap
+{
+class PerformanceImp : public ObjectMixin<PerformanceImp>
+{
+    double timeOrigin;  // in milliseconds of HttpTiming::now()
+    unsigned bufferSize;
+    std::deque<PerformanceResourceTimingPtr> entries;
+
+    void addResourceTiming(HttpRequest* request, const std::u16string& initiatorType, const std::u16string& origin);
+
+public:
+    static const unsigned DefaultBufferSize = 150;
+
+    PerformanceImp();
+
+    // Adds the Resource Timing entry of request once it completes. origin is
+    // the origin of the document that has initiated the request.
+    void observe(const HttpRequestPtr& request, const std::u16string& initiatorType, const URL& origin);
+
+    // Performance
+    double now();
+    PerformanceEntryList getEntries();
+    PerformanceEntryList getEntriesByType(const std::u16string& entryType);
+    PerformanceEntryList getEntriesByName(const std::u16string& name);
+    PerformanceEntryList getEntriesByName(const std::u16string& name, const std::u16string& entryType);
+    void clearResourceTimings();
+    void setResourceTimingBufferSize(unsigned int maxSize);
+    // Object
+    virtual Any message_(uint32_t selector, const char* id, int argc, Any* argv)
+    {
+        return Performance::dispatch(this, selector, id, argc, argv);
+    }
+    static const char* const getMetaData()
+    {
+        return Performance::getMetaData();
+    }
+};
+
+typedef std::shared_ptr<PerformanceImp> PerformancePtr;
+
+}
+}
+}
+}
+
+#endif  // ORG_W3C_DOM_BOOTSTRAP_PERFORMANCEIMP_H_INCLUDED
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PerformanceResourceTimingImp.h"
+
+namespace org
+{
+namespace w3c
+{
+namespace dom
+{
+namespace bootstrap
+{
+
+PerformanceResourceTimingImp::PerformanceResourceTimingImp(const std::u16string& name, const std::u16string& initiatorType,
+                                                           const HttpTiming& timing, double timeOrigin, bool detailed) :
+    ObjectMixin(name, u"resource", timing.startTime - timeOrigin, timing.responseEnd - timing.startTime),
+    initiatorType(initiatorType),
+    redirectStart(0.0),
+    redirectEnd(0.0),
+    fetchStart(timing.fetchStart - timeOrigin),
+    domainLookupStart(fetchStart),
+    domainLookupEnd(fetchStart),
+    connectStart(fetchStart),
+    connectEnd(fetchStart),
+    secureConnectionStart(0.0),
+    requestStart(fetchStart),
+    responseStart(fetchStart),
+    responseEnd(timing.responseEnd - timeOrigin)
+{
+    if (!detailed) {
+        domainLookupStart = domainLookupEnd = 0.0;
+        connectStart = connectEnd = 0.0;
+        requestStart = responseStart = 0.0;
+        return;
+    }
+
+    // A phase skipped over, e.g., by a persistent connection or by the
+    // cache, is reported at the time of the preceding phase.
+    if (timing.startTime < timing.fetchStart) {
+        redirectStart = startTime;
+        redirectEnd = fetchStart;
+    }
+    if (timing.domainLookupStart) {
+        domainLookupStart = timing.domainLookupStart - timeOrigin;
+        domainLookupEnd = timing.domainLookupEnd ? timing.domainLookupEnd - timeOrigin : domainLookupStart;
+        connectStart = connectEnd = domainLookupEnd;
+    }
+    if (timing.connectStart) {
+        connectStart = timing.connectStart - timeOrigin;
+        connectEnd = timing.connectEnd ? timing.connectEnd - timeOrigin : connectStart;
+    }
+    if (timing.secureConnectionStart)
+        secureConnectionStart = timing.secureConnectionStart - timeOrigin;
+    requestStart = timing.requestStart ? timing.requestStart - timeOrigin : connectEnd;
+    responseStart = timing.responseStart ? timing.responseStart - timeOrigin : requestStart;
+}
+
+std::u16string PerformanceResourceTimingImp::getInitiatorType()
+{
+    return initiatorType;
+}
+
+double PerformanceResourceTimingImp::getRedirectStart()
+{
+    return redirectStart;
+}
+
+double PerformanceResourceTimingImp::getRedirectEnd()
+{
+    return redirectEnd;
+}
+
+double PerformanceResourceTimingImp::getFetchStart()
+{
+    return fetchStart;
+}
+
+double PerformanceResourceTimingImp::getDomainLookupStart()
+{
+    return domainLookupStart;
+}
+
+double PerformanceResourceTimingImp::getDomainLookupEnd()
+{
+    return domainLookupEnd;
+}
+
+double PerformanceResourceTimingImp::getConnectStart()
+{
+    return connectStart;
+}
+
+double PerformanceResourceTimingImp::getConnectEnd()
+{
+    return connectEnd;
+}
+
+double PerformanceResourceTimingImp::getSecureConnectionStart()
+{
+    return secureConnectionStart;
+}
+
+double PerformanceResourceTimingImp::getRequestStart()
+{
+    return requestStart;
+}
+
+double PerformanceResourceTimingImp::getResponseStart()
+{
+    return responseStart;
+}
+
+double PerformanceResourceTimingImp::getResponseEnd()
+{
+    return responseEnd;
+}
+
+}
+}
+}
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ORG_W3C_DOM_BOOTSTRAP_PERFORMANCERESOURCETIMINGIMP_H_INCLUDED
+#define ORG_W3C_DOM_BOOTSTRAP_PERFORMANCERESOURCETIMINGIMP_H_INCLUDED
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <org/w3c/dom/PerformanceResourceTiming.h>
+
+#include "PerformanceEntryImp.h"
+#include "http/HTTPRequest.h"
+
+namespace org
+{
+namespace w3c
+{
+namespace dom
+{
+namespace bootstrap
+{
+class PerformanceResourceTimingImp : public ObjectMixin<PerformanceResourceTimingImp, PerformanceEntryImp>
+{
+    std::u16string initiatorType;
+    double redirectStart;
+    double redirectEnd;
+    double fetchStart;
+    double domainLookupStart;
+    double domainLookupEnd;
+    double connectStart;
+    double connectEnd;
+    double secureConnectionStart;
+    double requestStart;
+    double responseStart;
+    double responseEnd;
+
+public:
+    // The times in timing are converted relative to timeOrigin. Unless
+    // detailed, only fetchStart and responseEnd are exposed as required for
+    // a cross-origin resource without Timing-Allow-Origin.
+    PerformanceResourceTimingImp(const std::u16string& name, const std::u16string& initiatorType,
+                                 const HttpTiming& timing, double timeOrigin, bool detailed);
+
+    // PerformanceResourceTiming
+    std::u16string getInitiatorType();
+    double getRedirectStart();
+    double getRedirectEnd();
+    double getFetchStart();
+    double getDomainLookupStart();
+    double getDomainLookupEnd();
+    double getConnectStart();
+    double getConnectEnd();
+    double getSecureConnectionStart();
+    double getRequestStart();
+    double getResponseStart();
+    double getResponseEnd();
+    // Object
+    virtual Any message_(uint32_t selector, const char* id, int argc, Any* argv)
+    {
+        return PerformanceResourceTiming::dispatch(this, selector, id, argc, argv);
+    }
+    static const char* const getMetaData()
+    {
+        return PerformanceResourceTiming::getMetaData();
+    }
+};
+
+typedef std::shared_ptr<PerformanceResourceTimingImp> PerformanceResourceTimingPtr;
+
+}
+}
+}
+}
+
+#endif  // ORG_W3C_DOM_BOOTSTRAP_PERFORMANCERESOURCETIMINGIMP_H_INCLUDED
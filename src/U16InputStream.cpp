@@ -23,6 +23,10 @@
 
 #include <algorithm>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 const char* U16ConverterInputStream::DefaultEncoding = "utf-8";
 
 namespace {
@@ -162,6 +166,8 @@ void U16ConverterInputStream::setEncoding(std::string value, bool useDefault)
             eof = true;
     }
     encoding = value;
+    if (converter)
+        utf8 = !strcmp(ucnv_getName(converter, &error), "UTF-8");
 }
 
 void U16ConverterInputStream::initializeConverter()
@@ -169,6 +175,7 @@ void U16ConverterInputStream::initializeConverter()
     flush = false;
     eof = !stream;
     converter = 0;
+    utf8 = false;
     source = sourceLimit = sourceBuffer;
     target = targetBuffer;
     nextChar = target;
@@ -201,14 +208,134 @@ void U16ConverterInputStream::updateSource()
     }
 }
 
+// Decodes UTF-8 without the converter, which spends most of its time on
+// ASCII characters one by one. Each ill-formed sequence is replaced with a
+// U+FFFD as in the Encoding Standard, which is what ICU does, too. An
+// incomplete sequence at the end of the source is left to the next chunk.
+void U16ConverterInputStream::decodeUTF8()
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(source);
+    const unsigned char* end = reinterpret_cast<const unsigned char*>(sourceLimit);
+    char16_t* t = target;
+    while (p < end) {
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        while (16 <= end - p) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            if (_mm_movemask_epi8(bytes))
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(t), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(t + 8), _mm_unpackhi_epi8(bytes, zero));
+            p += 16;
+            t += 16;
+        }
+        if (p == end)
+            break;
+#endif
+        unsigned char c = *p;
+        if (c < 0x80) {
+            *t++ = c;
+            ++p;
+            continue;
+        }
+        unsigned needed;
+        unsigned char lower = 0x80;
+        unsigned char upper = 0xBF;
+        char32_t u;
+        if (0xC2 <= c && c <= 0xDF) {
+            needed = 1;
+            u = c & 0x1F;
+        } else if (0xE0 <= c && c <= 0xEF) {
+            if (c == 0xE0)
+                lower = 0xA0;
+            else if (c == 0xED)
+                upper = 0x9F;
+            needed = 2;
+            u = c & 0x0F;
+        } else if (0xF0 <= c && c <= 0xF4) {
+            if (c == 0xF0)
+                lower = 0x90;
+            else if (c == 0xF4)
+                upper = 0x8F;
+            needed = 3;
+            u = c & 0x07;
+        } else {
+            *t++ = 0xFFFD;
+            ++p;
+            continue;
+        }
+        const unsigned char* q = p + 1;
+        for (; 0 < needed && q < end; --needed, ++q) {
+            if (*q < lower || upper < *q)
+                break;
+            u = (u << 6) | (*q & 0x3F);
+            lower = 0x80;
+            upper = 0xBF;
+        }
+        if (q == end && 0 < needed && !flush)
+            break;  // wait for the rest of the sequence
+        if (0 < needed)
+            *t++ = 0xFFFD;
+        else if (u < 0x10000)
+            *t++ = static_cast<char16_t>(u);
+        else {
+            u -= 0x10000;
+            *t++ = static_cast<char16_t>(0xD800 + (u >> 10));
+            *t++ = static_cast<char16_t>(0xDC00 + (u & 0x3FF));
+        }
+        p = q;
+    }
+    source = const_cast<char*>(reinterpret_cast<const char*>(p));
+    target = t;
+}
+
+// Replaces CR and CRLF with LF, and NUL with U+FFFD, and removes BOMs in
+// the decoded chunk so that it can be read as a block.
+void U16ConverterInputStream::normalize()
+{
+    char16_t* to = nextChar;
+    for (char16_t* from = nextChar; from < target; ++from) {
+        char16_t c = *from;
+        switch (c) {
+        case '\n':
+            if (lastChar == '\r') {
+                lastChar = c;
+                continue;
+            }
+            break;
+        case '\r':
+            lastChar = c;
+            *to++ = '\n';
+            continue;
+        case '\0':
+            c = u'\xfffd';
+            break;
+        case 0xFEFF:  // BOM
+            continue;
+        default:
+            break;
+        }
+        lastChar = c;
+        *to++ = c;
+    }
+    target = to;
+}
+
 void U16ConverterInputStream::readChunk()
 {
     nextChar = target = targetBuffer;
     updateSource();
-    UErrorCode err = U_ZERO_ERROR;
-    ucnv_toUnicode(converter,
-                   reinterpret_cast<UChar**>(&target),
-                   reinterpret_cast<UChar*>(targetBuffer) + ChunkSize,
-                   const_cast<const char**>(&source),
-                   sourceLimit, 0, flush, &err);
+    if (eof)
+        return;
+    if (utf8)
+        decodeUTF8();
+    else {
+        UErrorCode err = U_ZERO_ERROR;
+        ucnv_toUnicode(converter,
+                       reinterpret_cast<UChar**>(&target),
+                       reinterpret_cast<UChar*>(targetBuffer) + ChunkSize,
+                       const_cast<const char**>(&source),
+                       sourceLimit, 0, flush, &err);
+    }
+    normalize();
 }
@@ -25,6 +25,8 @@ struct UConverter;
 
 class U16InputStream
 {
+    char16_t single;
+
 public:
     virtual ~U16InputStream() {}
 
@@ -33,6 +35,24 @@ public:
     virtual int peek() = 0;
     virtual U16InputStream& get(char16_t& c) = 0;
 
+    // Sets block to the characters that can be read next without decoding
+    // any further, and returns the number of them, which is zero only at the
+    // end of the stream. The block is valid until the stream is read again.
+    virtual size_t peekBlock(const char16_t*& block) {
+        int c = peek();
+        if (c == -1)
+            return 0;
+        single = static_cast<char16_t>(c);
+        block = &single;
+        return 1;
+    }
+    // Consumes count characters of the block returned by peekBlock().
+    virtual void skip(size_t count) {
+        char16_t c;
+        while (0 < count-- && get(c))
+            ;
+    }
+
     int get() {
         char16_t c;
         get(c);
@@ -41,9 +61,11 @@ public:
     operator std::u16string()
     {
         std::u16string text;
-        char16_t c;
-        while (get(c))
-            text += c;
+        const char16_t* block;
+        while (size_t length = peekBlock(block)) {
+            text.append(block, length);
+            skip(length);
+        }
         return text;
     }
 };
@@ -75,7 +97,7 @@ public:
 class U16ConverterInputStream : public U16InputStream
 {
 public:
-    static const size_t ChunkSize = 512;
+    static const size_t ChunkSize = 4096;
     static const char* DefaultEncoding;  // "utf-8"
     enum Confidence
     {
@@ -124,6 +146,7 @@ protected:
 
 private:
     UConverter* converter;
+    bool utf8;  // decoded without converter
 
     std::istream& stream;
 
@@ -139,6 +162,8 @@ private:
 
     void initializeConverter();
     void updateSource();
+    void decodeUTF8();
+    void normalize();
     void readChunk();
 
 public:
@@ -152,48 +177,33 @@ public:
         return eof;
     }
     virtual int peek() {
-        int c;
-        while (!eof) {
-            while (nextChar < target) {
-                c = *nextChar;
-                if (lastChar == '\r' && c == '\n') {
-                    lastChar = '\n';
-                    ++nextChar;
-                    continue;
-                }
-                switch (c) {
-                case '\r':
-                    c = '\n';
-                    break;
-                case '\0':
-                    c = u'\xfffd';
-                    break;
-                case 0xFEFF:  // BOM
-                    ++nextChar;
-                    continue;
-                    break;
-                default:
-                    break;
-                }
-                return c;
-            }
-            if (!flush)
-                readChunk();
-            else
+        while (nextChar == target) {
+            if (eof || flush) {
                 eof = true;
+                return -1;
+            }
+            readChunk();
         }
-        return -1;
+        return *nextChar;
     }
     virtual U16ConverterInputStream& get(char16_t& c)
     {
         int ch = peek();
-        if (!eof) {
-            lastChar = *nextChar;
-            ++nextChar;
+        if (ch != -1) {
             c = static_cast<char16_t>(ch);
+            ++nextChar;
         }
         return *this;
     }
+    virtual size_t peekBlock(const char16_t*& block) {
+        if (peek() == -1)
+            return 0;
+        block = nextChar;
+        return target - nextChar;
+    }
+    virtual void skip(size_t count) {
+        nextChar += count;
+    }
 
     enum Confidence getConfidence() const {
         return confidence;
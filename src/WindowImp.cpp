@@ -93,7 +93,7 @@ void WindowImp::setEventHandler(const std::u16string& type, Object handler)
     addEventListener(type, listener, false, EventTargetImp::UseEventHandler);
 }
 
-HttpRequestPtr WindowImp::preload(const std::u16string& base, const std::u16string& urlString)
+HttpRequestPtr WindowImp::preload(const std::u16string& base, const std::u16string& urlString, unsigned short priority)
 {
     URL url(base, urlString);
     if (url.isEmpty())
@@ -101,17 +101,23 @@ HttpRequestPtr WindowImp::preload(const std::u16string& base, const std::u16stri
 
     for (auto i = cache.begin(); i != cache.end(); ++i) {
         HttpRequestPtr request = *i;
-        if (request->getURL() == url)
+        if (request->getURL() == url) {
+            if (priority < request->getPriority())
+                request->setPriority(priority);
             return request;
+        }
     }
 
     HttpRequestPtr request = std::make_shared<HttpRequest>(base);
     if (request) {
         cache.push_back(request);
         request->open(u"GET", urlString);
+        request->setPriority(priority);
         request->setHandler(boost::bind(&WindowImp::notify, this, request));
-        if (document)
+        if (document) {
             document->incrementLoadEventDelayCount(urlString);
+            performance->observe(request, u"other", URL(document->getDocumentURI()));
+        }
         request->send();
     }
     return request;
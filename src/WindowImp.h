@@ -29,6 +29,7 @@
 #include "EventListenerImp.h"
 #include "EventTargetImp.h"
 #include "ECMAScript.h"
+#include "PerformanceImp.h"
 #include "Task.h"
 #include "css/CSSStyleDeclarationImp.h"
 
@@ -54,6 +55,7 @@ class WindowImp : public EventTargetImp
     int moveY;
     Retained<EventListenerImp> clickListener;
     Retained<EventListenerImp> mouseMoveListener;
+    Retained<PerformanceImp> performance;
 
     // computed style memory manager
     std::map<Element, CSSStyleDeclarationPtr> map;
@@ -88,6 +90,12 @@ public:
         return global;
     }
 
+    // A new WindowImp is created for each navigation, which starts the time
+    // origin of its Performance object.
+    PerformancePtr getPerformanceImp() const {
+        return performance;
+    }
+
     void enter(WindowProxy* proxy);
     void exit(WindowProxy* proxy);
 
@@ -102,7 +110,7 @@ public:
 
     void setEventHandler(const std::u16string& type, Object handler);
 
-    HttpRequestPtr preload(const std::u16string& base, const std::u16string& url);
+    HttpRequestPtr preload(const std::u16string& base, const std::u16string& url, unsigned short priority = HttpRequest::ASYNC);
 
     CSSStyleDeclarationPtr getComputedStyle(Element elt);
     void putComputedStyle(Element elt);
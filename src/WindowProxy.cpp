@@ -33,6 +33,7 @@
 #include "css/BoxImage.h"
 #include "css/Ico.h"
 #include "css/ViewCSSImp.h"
+#include "html/HTMLAnchorElementImp.h"
 #include "html/HTMLIFrameElementImp.h"
 #include "html/HTMLLinkElementImp.h"
 #include "html/HTMLScriptElementImp.h"
@@ -42,13 +43,84 @@
 
 namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
-WindowProxy::Parser::Parser(const DocumentPtr& document, int fd, const std::string& optionalEncoding) :
-    stream(fd, boost::iostreams::close_handle),
-    htmlInputStream(stream, optionalEncoding),
-    tokenizer(&htmlInputStream),
-    parser(document, &tokenizer)
+const unsigned WindowProxy::Parser::LayoutInterval;
+unsigned WindowProxy::Parser::timeSlice = 20;
+unsigned WindowProxy::Parser::tokenBudget = 0;
+
+WindowProxy::Parser::Parser(const DocumentPtr& document, const HttpContentSource& source, const std::string& optionalEncoding) :
+    tokenizerThread(source, optionalEncoding),
+    tokenizer(&tokenizerThread),
+    parser(document, &tokenizer),
+    sliceCount(0),
+    layoutDue(std::chrono::steady_clock::now() + std::chrono::milliseconds(LayoutInterval)),
+    layingOut(false)
+{
+    document->setCharacterSet(utfconv(tokenizerThread.getEncoding()));
+}
+
+void WindowProxy::Parser::startSlice()
+{
+    sliceEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeSlice);
+    sliceCount = 0;
+}
+
+bool WindowProxy::Parser::hasExpired()
+{
+    ++sliceCount;
+    if (tokenBudget && tokenBudget <= sliceCount)
+        return true;
+    // Note most of the tokens are characters, which are processed quickly.
+    return timeSlice && !(sliceCount % 64) && sliceEnd <= std::chrono::steady_clock::now();
+}
+
+bool WindowProxy::Parser::isLayoutDue()
 {
-    document->setCharacterSet(utfconv(htmlInputStream.getEncoding()));
+    auto now = std::chrono::steady_clock::now();
+    if (now < layoutDue)
+        return false;
+    layoutDue = now + std::chrono::milliseconds(LayoutInterval);
+    return true;
+}
+
+// Scans the part of the document that has been received beyond the current
+// input position.
+void WindowProxy::Parser::scan(const HttpRequestPtr& request, std::deque<HTMLPreloadScanner::Resource>& found)
+{
+    if (!getEncoding().compare(0, 6, "utf-16"))
+        return;
+    if (!scanSource) {
+        if (request->getReadyState() == HttpRequest::LOADING)
+            scanSource.reset(new(std::nothrow) HttpContentSource(request->getProgressiveContentSource()));
+        else
+            scanSource.reset(new(std::nothrow) HttpContentSource(request->getContentSource()));
+        if (!scanSource)
+            return;
+        // Note the tokenizer has not processed the text buffered in the
+        // input streams yet.
+        std::streamsize buffered = boost::iostreams::default_device_buffer_size + U16ConverterInputStream::ChunkSize;
+        scanner.setEmitFrom(std::max<std::streamsize>(0, tokenizerThread.getStreamPosition() - buffered));
+    }
+    if (const char* data = scanSource->getData()) {
+        // The whole document is in memory.
+        std::streamsize position = scanner.getPosition();
+        if (position < scanSource->getSize())
+            scanner.scan(data + position, scanSource->getSize() - position, found);
+        return;
+    }
+    char buffer[4096];
+    for (;;) {
+        std::streamsize length = sizeof buffer;
+        if (request->getReadyState() == HttpRequest::LOADING) {
+            // Do not wait for the rest of the document.
+            length = std::min<std::streamsize>(length, request->getReceivedLength() - scanner.getPosition());
+            if (length <= 0)
+                break;
+        }
+        length = scanSource->read(buffer, length);
+        if (length <= 0)
+            break;
+        scanner.scan(buffer, length, found);
+    }
 }
 
 WindowProxy::WindowProxy(unsigned short flags) :
@@ -59,6 +131,7 @@ WindowProxy::WindowProxy(unsigned short flags) :
     view(0),
     viewFlags(0),
     flags(flags),
+    historyPending(false),
     detail(0),
     buttons(0),
     scrollWidth(0),
@@ -198,14 +271,63 @@ bool WindowProxy::isBindingDocumentWindow()
     return false;
 }
 
+DocumentPtr WindowProxy::createDocument(const HttpContentSource& source)
+{
+    // TODO: Check header
+    Document newDocument = getDOMImplementation()->createDocument(u"", u"", nullptr); // TODO: Create HTML document
+    DocumentPtr document = std::dynamic_pointer_cast<DocumentImp>(newDocument.self());
+    if (!document)
+        return nullptr;
+    // TODO: Fire a simple unload event.
+    document->setDefaultView(std::static_pointer_cast<WindowProxy>(self()));
+    document->setURL(request->getURL());
+    document->setLastModified(request->getLastModified());
+    window->setDocument(document);
+    // Whether the request has failed is not known until it is done.
+    historyPending = request->getReadyState() != HttpRequest::DONE;
+    if (!historyPending)
+        updateHistory(document);
+    document->enter();
+    parser.reset(new(std::nothrow) Parser(document, source, request->getResponseMessage().getContentCharset()));
+    document->exit();
+    return document;
+}
+
+void WindowProxy::updateHistory(const DocumentPtr& document)
+{
+    if (!request->getError())
+        history->update(window);
+    else
+        document->setError(request->getError());
+}
+
+// Requests the resources found ahead of the parser while it is blocked by
+// a script.
+void WindowProxy::preload()
+{
+    std::deque<HTMLPreloadScanner::Resource> found;
+    parser->scan(request, found);
+    if (found.empty())
+        return;
+    std::u16string base = window->getDocument()->getDocumentURI();
+    for (auto i = found.begin(); i != found.end(); ++i) {
+        unsigned short priority = (i->type == HTMLPreloadScanner::Image) ? HttpRequest::IMAGE : HttpRequest::BLOCKING;
+        if (3 <= getLogLevel())
+            std::cerr << __func__ << ' ' << i->url << '\n';
+        window->preload(base, utfconv(i->url), priority);
+    }
+}
+
 bool WindowProxy::poll()
 {
     if (!window)
         return false;
     auto document = window->getDocument();
 
-    // Update the canvas before processing events.
-    if (request->getReadyState() == HttpRequest::DONE && document && backgroundTask.getState() == BackgroundTask::Done) {
+    // Update the canvas before processing events. Note the part of the
+    // document parsed so far can be laid out while loading.
+    unsigned short readyState = request->getReadyState();
+    if ((readyState == HttpRequest::LOADING || readyState == HttpRequest::DONE) && document && backgroundTask.getState() == BackgroundTask::Done) {
         ViewCSSImp* next = backgroundTask.getView();
         updateView(next);
         if (view) {
@@ -262,138 +384,141 @@ bool WindowProxy::poll()
         break;
     case HttpRequest::OPENED:
     case HttpRequest::HEADERS_RECEIVED:
+    case HttpRequest::COMPLETE:
+        break;
     case HttpRequest::LOADING:
+        // Parse the part of the document received so far so that the
+        // subresources referred from it can be fetched early. Note the end of
+        // the document is processed once the request is done.
+        if (!document) {
+            if (request->getReceivedLength() < Parser::ReadAhead)
+                break;
+            recordTime("%*shttp request loading", windowDepth * 2, "");
+            document = createDocument(request->getProgressiveContentSource());
+            if (!document || !parser)
+                break;  // TODO: error handling
+        }
+        if (!parser || document->getReadyState() != u"loading")
+            break;
+        if (parser->isLayingOut()) {
+            // Do not modify the document until the background task has laid
+            // out the part of it parsed so far.
+            if (!backgroundTask.isBusy())
+                parser->setLayingOut(false);
+        }
+        if (!parser->isLayingOut()) {
+            document->enter();
+            bool expired = false;
+            if (parser->processPendingParsingBlockingScript()) {
+                parser->startSlice();
+                while (parser->isReady(request)) {
+                    Token token = parser->getToken();
+                    parser->processToken(token);
+                    if (document->getPendingParsingBlockingScript())
+                        break;
+                    if (parser->hasExpired()) {
+                        expired = true;
+                        break;
+                    }
+                }
+            }
+            if (document->getPendingParsingBlockingScript())
+                preload();
+            else if (expired && parser->isLayoutDue()) {
+                // Lay out the part of the document parsed so far as in the
+                // DONE state below.
+                if (!view) {
+                    document->resetStyleSheets();
+                    backgroundTask.restart(BackgroundTask::Cascade);
+                }
+                parser->setLayingOut(true);
+                recordTime("%*shtml partially parsed", windowDepth * 2, "");
+            }
+            document->exit();
+        }
+        if (parser->isLayingOut())
+            pollBackgroundTask(document);
         break;
     case HttpRequest::DONE:
         if (!document) {
             recordTime("%*shttp request done", windowDepth * 2, "");
-            // TODO: Check header
-            Document newDocument = getDOMImplementation()->createDocument(u"", u"", nullptr); // TODO: Create HTML document
-            if ((document = std::dynamic_pointer_cast<DocumentImp>(newDocument.self()))) {
-                // TODO: Fire a simple unload event.
-                document->setDefaultView(std::static_pointer_cast<WindowProxy>(self()));
-                document->setURL(request->getURL());
-                document->setLastModified(request->getLastModified());
-                window->setDocument(document);
-                if (!request->getError())
-                    history->update(window);
-                else
-                    document->setError(request->getError());
-                document->enter();
-                parser.reset(new(std::nothrow) Parser(document, request->getContentDescriptor(), request->getResponseMessage().getContentCharset()));
-                document->exit();
-                if (!parser)
-                    break;  // TODO: error handling
-            } else
+            document = createDocument(request->getContentSource());
+            if (!document || !parser)
                 break;  // TODO: error handling
+        } else if (historyPending) {
+            historyPending = false;
+            updateHistory(document);
         }
-        if (document->getReadyState() == u"loading") {
-            // TODO: Note white it would be nice to parse the HTML docucment in
-            // the background task, firstly we need to check if we can run JS
-            // in the background.
+        if (!parser && document->getReadyState() == u"loading")
+            break;  // TODO: error handling
+        if (document->getReadyState() == u"loading" && parser->isLayingOut()) {
+            // Do not modify the document until the background task has laid
+            // out the part of it parsed so far.
+            if (!backgroundTask.isBusy())
+                parser->setLayingOut(false);
+        }
+        if (document->getReadyState() == u"loading" && !parser->isLayingOut()) {
+            // Note the document is tokenized by the tokenizer thread, while
+            // the tree is constructed here as scripts have to run in this
+            // thread.
 
             document->enter();
 
             if (!parser->processPendingParsingBlockingScript()) {
+                preload();
                 document->exit();
                 break;
             }
-            // TODO: run this in the background
+            parser->feed(request);
+            parser->startSlice();
             Token token;
             do {
                 token = parser->getToken();
                 parser->processToken(token);
-            } while (token.getType() != Token::Type::EndOfFile && !document->getPendingParsingBlockingScript());
+            } while (token.getType() != Token::Type::EndOfFile && !document->getPendingParsingBlockingScript() && !parser->hasExpired());
 
             if (document->getPendingParsingBlockingScript()) {
+                preload();
                 document->exit();
                 break;
             }
 
-            // TODO: Check if the parser has been aborted.
-            document->resetStyleSheets();
-            setViewFlags(Box::NEED_SELECTOR_REMATCHING);
-            if (!(flags & Loading) && !isBindingDocumentWindow()) { // Note a binding document does not create its view.
-                flags |= Loading;
-                document->incrementLoadEventDelayCount(u"ViewCSS");
-            }
-
-            parser.reset();
-            document->exit();
-
-            recordTime("%*shtml parsed", windowDepth * 2, "");
-            if (4 <= getLogLevel())
-                dumpTree(std::cerr, document);
-        }
-
-        if (!backgroundTask.isRestarting()) {
-            switch (backgroundTask.getState()) {
-            case BackgroundTask::Cascaded:
-                if (HTMLElementImp::xblEnteredDocument(document))
-                    backgroundTask.wakeUp(BackgroundTask::Cascade);
-                else
-                    backgroundTask.wakeUp(BackgroundTask::Layout);
-                break;
-            case BackgroundTask::Init:
-            case BackgroundTask::Done: {
-
-                eventLoop();
-
-                ViewCSSImp* next = backgroundTask.getView();
-                updateView(next);
-                if (document->getReadyState() == u"interactive") {
-                    // TODO: Check if the parser has been aborted.
-
-                    // Run from the step 3. of 'stops parsing'.
-                    // cf. http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#the-end
-
-                    // Process scripts that will execute when the document has finished parsing (i.e., defer).
-                    // TODO: Check there's no style sheet that is blocking scripts.
-                    if (document->processDeferScripts()) {
-                        if (!document->hasContentLoaded()) {
-                            if (events::Event event = std::make_shared<EventImp>()) {
-                                event.initEvent(u"DOMContentLoaded", true, false);
-                                document->dispatchEvent(event);
-                            }
-                            document->decrementLoadEventDelayCount();
-                            document->setContentLoaded();
-
-                            backgroundTask.restart(BackgroundTask::Cascade);
-                        }
-                    }
+            if (token.getType() != Token::Type::EndOfFile) {
+                // The time slice has run out. Yield to the other tasks, and
+                // lay out the part of the document parsed so far from time
+                // to time so that it can be painted before the rest is parsed.
+                if (!parser->isLayoutDue()) {
+                    document->exit();
+                    break;
                 }
-                if (document->getReadyState() == u"complete") {
+                // Once the view is created, it gathers the mutations made
+                // by the parser.
+                if (!view) {
+                    document->resetStyleSheets();
+                    backgroundTask.restart(BackgroundTask::Cascade);
                 }
-                if (view) {
-                    if (unsigned short gathered = viewFlags | view->gatherFlags()) {
-                        viewFlags &= ~gathered;
-                        if (gathered & Box::NEED_SELECTOR_REMATCHING) {
-                            recordTime("%*strigger selector rematching", windowDepth * 2, "");
-                            backgroundTask.restart(BackgroundTask::Cascade);
-                            view = 0;
-                        } else if (gathered & Box::NEED_SELECTOR_MATCHING) {
-                            recordTime("%*strigger restyling", windowDepth * 2, "");
-                            backgroundTask.wakeUp(BackgroundTask::Cascade);
-                            view = 0;
-                        } else if (gathered & (Box::NEED_STYLE_RECALCULATION | Box::NEED_EXPANSION | Box::NEED_CHILD_REFLOW | Box::NEED_REFLOW)) {
-                            recordTime("%*strigger reflow", windowDepth * 2, "");
-                            backgroundTask.wakeUp(BackgroundTask::Layout);
-                            view = 0;
-                        } else if (gathered & Box::NEED_REPAINT) {
-                            redisplay = true;
-                            if (flags & Loading) {
-                                flags &= ~Loading;
-                                document->decrementLoadEventDelayCount(u"ViewCSS");
-                            }
-                        }
-                    }
+                parser->setLayingOut(true);
+                document->exit();
+                recordTime("%*shtml partially parsed", windowDepth * 2, "");
+            } else {
+                // TODO: Check if the parser has been aborted.
+                document->resetStyleSheets();
+                setViewFlags(Box::NEED_SELECTOR_REMATCHING);
+                if (!(flags & Loading) && !isBindingDocumentWindow()) { // Note a binding document does not create its view.
+                    flags |= Loading;
+                    document->incrementLoadEventDelayCount(u"ViewCSS");
                 }
-                break;
-            }
-            default:
-                break;
+
+                parser.reset();
+                document->exit();
+
+                recordTime("%*shtml parsed", windowDepth * 2, "");
+                if (4 <= getLogLevel())
+                    dumpTree(std::cerr, document);
             }
         }
+
+        pollBackgroundTask(document);
         break;
     default:
         break;
@@ -409,6 +534,80 @@ bool WindowProxy::poll()
     return result;
 }
 
+// Lets the background task cascade and lay out document, and picks up the
+// view it has made.
+void WindowProxy::pollBackgroundTask(const DocumentPtr& document)
+{
+    if (backgroundTask.isRestarting())
+        return;
+    switch (backgroundTask.getState()) {
+    case BackgroundTask::Cascaded:
+        if (HTMLElementImp::xblEnteredDocument(document))
+            backgroundTask.wakeUp(BackgroundTask::Cascade);
+        else
+            backgroundTask.wakeUp(BackgroundTask::Layout);
+        break;
+    case BackgroundTask::Init:
+    case BackgroundTask::Done: {
+
+        eventLoop();
+
+        ViewCSSImp* next = backgroundTask.getView();
+        updateView(next);
+        if (document->getReadyState() == u"interactive") {
+            // TODO: Check if the parser has been aborted.
+
+            // Run from the step 3. of 'stops parsing'.
+            // cf. http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#the-end
+
+            // Process scripts that will execute when the document has finished parsing (i.e., defer).
+            // TODO: Check there's no style sheet that is blocking scripts.
+            if (document->processDeferScripts()) {
+                if (!document->hasContentLoaded()) {
+                    if (events::Event event = std::make_shared<EventImp>()) {
+                        event.initEvent(u"DOMContentLoaded", true, false);
+                        document->dispatchEvent(event);
+                    }
+                    document->decrementLoadEventDelayCount();
+                    document->setContentLoaded();
+
+                    backgroundTask.restart(BackgroundTask::Cascade);
+                }
+            }
+        }
+        if (document->getReadyState() == u"complete") {
+        }
+        if (view) {
+            if (unsigned short gathered = viewFlags | view->gatherFlags()) {
+                viewFlags &= ~gathered;
+                if (gathered & Box::NEED_SELECTOR_REMATCHING) {
+                    recordTime("%*strigger selector rematching", windowDepth * 2, "");
+                    backgroundTask.restart(BackgroundTask::Cascade);
+                    view = 0;
+                } else if (gathered & Box::NEED_SELECTOR_MATCHING) {
+                    recordTime("%*strigger restyling", windowDepth * 2, "");
+                    backgroundTask.wakeUp(BackgroundTask::Cascade);
+                    view = 0;
+                } else if (gathered & (Box::NEED_STYLE_RECALCULATION | Box::NEED_EXPANSION | Box::NEED_CHILD_REFLOW | Box::NEED_REFLOW)) {
+                    recordTime("%*strigger reflow", windowDepth * 2, "");
+                    backgroundTask.wakeUp(BackgroundTask::Layout);
+                    view = 0;
+                } else if (gathered & Box::NEED_REPAINT) {
+                    redisplay = true;
+                    if (flags & Loading) {
+                        flags &= ~Loading;
+                        document->decrementLoadEventDelayCount(u"ViewCSS");
+                    }
+                }
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 void WindowProxy::render(ViewCSSImp* parentView)
 {
     if (view) {
@@ -510,6 +709,9 @@ void WindowProxy::mouse(const EventTask& task)
 
     Element target = Box::getContainingElement(box->getTargetNode());
 
+    if (!up)
+        preconnect(target);
+
     // mousedown, mousemove
     if (auto event = std::make_shared<MouseEventImp>()) {
         if (!up) {
@@ -566,6 +768,8 @@ void WindowProxy::mouseMove(const EventTask& task)
                                modifiers);
     }
     if (prev != target) {
+        preconnect(target);
+
         // mouseout
         if (auto event = std::make_shared<MouseEventImp>()) {
             event->initMouseEvent(u"mouseout",
@@ -597,6 +801,22 @@ void WindowProxy::mouseMove(const EventTask& task)
     }
 }
 
+// Opens a connection to the origin of the link under the pointer so that
+// the navigation request finds it already established.
+void WindowProxy::preconnect(Element target)
+{
+    if (!window || !window->getDocument())
+        return;
+    for (Node node = target; node; node = node.getParentNode()) {
+        if (auto anchor = std::dynamic_pointer_cast<HTMLAnchorElementImp>(node.self())) {
+            std::u16string href = anchor->getHref();
+            if (!href.empty())
+                HttpConnectionManager::getInstance().preconnect(URL(window->getDocument()->getDocumentURI(), href));
+            return;
+        }
+    }
+}
+
 void WindowProxy::keydown(const EventTask& task)
 {
     unsigned charCode = task.charCode;
@@ -1038,10 +1258,18 @@ void WindowProxy::navigate(std::u16string url, bool replace, WindowProxy* srcWin
         }
     }
 
+    // Stop parsing the current document before reusing request for the next
+    // one; its tokenizer thread might be waiting for the rest of the content.
+    if (parser) {
+        request->cutOffProgressiveContent();
+        parser.reset();
+    }
+    historyPending = false;
     window = std::make_shared<WindowImp>();
     request->abort();
     history->setReplace(replace);
     request->open(u"get", url.empty() ? u"about:blank" : url);
+    request->setPriority(HttpRequest::DOCUMENT);
     request->send();
 }
 
@@ -1947,6 +2175,13 @@ int WindowProxy::getOuterHeight()
     return 0;
 }
 
+Performance WindowProxy::getPerformance()
+{
+    if (!window)
+        return nullptr;
+    return window->getPerformanceImp();
+}
+
 void WindowProxy::addEventListener(const std::u16string& type, events::EventListener listener, bool capture)
 {
     if (window)
@@ -40,8 +40,10 @@
 #include <org/w3c/dom/html/External.h>
 #include <org/w3c/dom/html/Transferable.h>
 #include <org/w3c/dom/Document.h>
+#include <org/w3c/dom/Performance.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdio>
 #include <deque>
@@ -61,8 +63,9 @@
 #include "LocationImp.h"
 #include "NavigatorImp.h"
 #include "html/HTMLIFrameElementImp.h"
-#include "html/HTMLInputStream.h"
 #include "html/HTMLParser.h"
+#include "html/HTMLPreloadScanner.h"
+#include "html/HTMLTokenizerThread.h"
 #include "html/ScreenImp.h"
 #include "http/HTTPRequest.h"
 
@@ -170,17 +173,51 @@ private:
         bool isRestarting() const {
             return flags & Restart;
         }
+        // Returns true if the task has been requested, or has not finished.
+        bool isBusy() const {
+            return flags || (state != Init && state != Done);
+        }
         bool wait();
     };
 
     class Parser
     {
-        boost::iostreams::stream<boost::iostreams::file_descriptor_source> stream;
-        HTMLInputStream htmlInputStream;
+        HTMLTokenizerThread tokenizerThread;
         HTMLTokenizer tokenizer;
         HTMLParser parser;
+        HTMLPreloadScanner scanner;
+        std::unique_ptr<HttpContentSource> scanSource;
+        std::chrono::steady_clock::time_point sliceEnd;
+        unsigned sliceCount;    // the number of the tokens processed in the current slice
+        std::chrono::steady_clock::time_point layoutDue;
+        bool layingOut;         // the background task is laying out the partially parsed document
     public:
-        Parser(const DocumentPtr& document, int fd, const std::string& optionalEncoding);
+        // The length of the document that has to be received ahead of the
+        // current input position before parsing it while loading.
+        static const std::streamsize ReadAhead = HTMLTokenizerThread::ReadAhead;
+        // The interval between the layouts of the partially parsed document
+        // in milliseconds.
+        static const unsigned LayoutInterval = 500;
+
+        // How long the parser can run at a time in poll() in milliseconds,
+        // and how many tokens it can process. Zero means no limit.
+        static unsigned timeSlice;
+        static unsigned tokenBudget;
+
+        Parser(const DocumentPtr& document, const HttpContentSource& source, const std::string& optionalEncoding);
+
+        // Lets the tokenizer thread read the part of the document received
+        // so far.
+        void feed(const HttpRequestPtr& request) {
+            tokenizerThread.feed(request->getReceivedLength(), request->getReadyState() == HttpRequest::DONE);
+        }
+
+        // Returns true if the next token can be read without waiting for
+        // the rest of the document to arrive.
+        bool isReady(const HttpRequestPtr& request) {
+            feed(request);
+            return tokenizerThread.isReady();
+        }
 
         Token getToken() {
             return tokenizer.getToken();
@@ -189,12 +226,28 @@ private:
             return parser.processToken(token);
         }
         const std::string& getEncoding() {
-            return htmlInputStream.getEncoding();
+            return tokenizerThread.getEncoding();
         }
 
         bool processPendingParsingBlockingScript() {
             return parser.processPendingParsingBlockingScript();
         }
+
+        void startSlice();
+        // Returns true if the current time slice has run out.
+        bool hasExpired();
+
+        // Returns true if it is time to lay out the part of the document
+        // parsed so far.
+        bool isLayoutDue();
+        bool isLayingOut() const {
+            return layingOut;
+        }
+        void setLayingOut(bool value) {
+            layingOut = value;
+        }
+
+        void scan(const HttpRequestPtr& request, std::deque<HTMLPreloadScanner::Resource>& found);
     };
 
     HttpRequestPtr request;
@@ -217,6 +270,7 @@ private:
     std::deque<EventTask> eventQueue;
 
     std::unique_ptr<Parser> parser;
+    bool historyPending;    // the document created while loading is yet to be added to the history
 
     // for MouseEvent
     Element clickTarget;
@@ -240,6 +294,7 @@ private:
 
     void mouse(const EventTask& task);
     void mouseMove(const EventTask& task);
+    void preconnect(Element target);
     void keydown(const EventTask& task);
     void keyup(const EventTask& task);
 
@@ -248,6 +303,10 @@ private:
     void navigate(std::u16string url, bool replace, WindowProxy* srcWindow);
 
     void updateView(ViewCSSImp* next);
+    DocumentPtr createDocument(const HttpContentSource& source);
+    void updateHistory(const DocumentPtr& document);
+    void preload();
+    void pollBackgroundTask(const DocumentPtr& document);
 
 public:
     WindowProxy(unsigned short flags);
@@ -255,6 +314,13 @@ public:
 
     static css::CSSStyleSheet defaultStyleSheet;
 
+    // Sets how long the HTML parser can run at a time before yielding to
+    // the other tasks, in milliseconds and in tokens. Zero means no limit.
+    static void setParseSlice(unsigned milliseconds, unsigned tokens) {
+        Parser::timeSlice = milliseconds;
+        Parser::tokenBudget = tokens;
+    }
+
     void setBase(const std::u16string& base) {
         request->setBase(base);
     }
@@ -610,6 +676,8 @@ public:
     int getScreenY();
     int getOuterWidth();
     int getOuterHeight();
+    // Window
+    Performance getPerformance();
     // EventTarget
     void addEventListener(const std::u16string& type, events::EventListener listener, bool capture = false);
     void removeEventListener(const std::u16string& type, events::EventListener listener, bool capture = false);
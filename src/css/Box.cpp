@@ -563,8 +563,10 @@ void Block::resolveBackground(ViewCSSImp* view)
         backgroundRequest = std::make_shared<HttpRequest>(document->getDocumentURI());
         if (backgroundRequest) {
             backgroundRequest->open(u"GET", style->backgroundImage.getValue());
+            backgroundRequest->setPriority(HttpRequest::IMAGE);
             backgroundRequest->setHandler(std::bind(&Block::notifyBackground, self(), view->getDocument()));
             document->incrementLoadEventDelayCount(backgroundRequest->getURL());
+            document->observeResourceTiming(backgroundRequest, u"css");
             backgroundRequest->send();
         }
     }
@@ -96,8 +96,10 @@ css::CSSStyleSheet CSSImportRuleImp::getStyleSheet()
         request = std::make_shared<HttpRequest>(doc->getDocumentURI());
         if (request) {
             request->open(u"GET", href);
+            request->setPriority(HttpRequest::BLOCKING);
             request->setHandler(boost::bind(&CSSImportRuleImp::notify, this));
             doc->incrementLoadEventDelayCount(request->getURL());
+            doc->observeResourceTiming(request, u"css");
             request->send();
         }
     }
@@ -111,7 +113,7 @@ void CSSImportRuleImp::notify()
         return;
 
     if (request->getStatus() == 200) {
-        boost::iostreams::stream<boost::iostreams::file_descriptor_source> stream(request->getContentDescriptor(), boost::iostreams::close_handle);
+        HttpContentStream stream(request->getContentSource());
         CSSParser parser(request->getURL());
         CSSInputStream cssStream(stream, request->getResponseMessage().getContentCharset(), utfconv(doc->getCharacterSet()));
         styleSheet = parser.parse(doc, cssStream);
@@ -31,6 +31,7 @@ constexpr auto Intern = &one_at_a_time::hash<char16_t>;
 #include "DOMTokenListImp.h"
 #include "HTMLUtil.h"
 #include "WindowProxy.h"
+#include "http/HTTPConnection.h"
 
 namespace org
 {
@@ -79,6 +80,11 @@ void HTMLAnchorElementImp::handleMutation(events::MutationEvent mutation)
     switch (Intern(mutation.getAttrName().c_str())) {
     case Intern(u"href"):
         handleMutationHref(mutation);
+        // Look up the host of the link in advance.
+        if (mutation.getAttrChange() != events::MutationEvent::REMOVAL) {
+            if (DocumentPtr document = getOwnerDocumentImp())
+                HttpConnectionManager::getInstance().prefetch(URL(document->getDocumentURI(), mutation.getNewValue()));
+        }
         break;
     case Intern(u"tabindex"):
         if (hasAttribute(u"href") && !toInteger(mutation.getNewValue(), tabIndex))
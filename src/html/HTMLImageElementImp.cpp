@@ -46,8 +46,10 @@ void HTMLImageElementImp::handleMutation(events::MutationEvent mutation)
             current = std::make_shared<HttpRequest>(document->getDocumentURI());
             if (current) {
                 current->open(u"GET", getSrc());
+                current->setPriority(HttpRequest::IMAGE);
                 current->setHandler(boost::bind(&HTMLImageElementImp::notify, this, current));
                 document->incrementLoadEventDelayCount(current->getURL());
+                document->observeResourceTiming(current, u"img");
                 current->send();
             } else
                 active = false;
@@ -128,8 +128,10 @@ void HTMLLinkElementImp::refresh()
                 current = std::make_shared<HttpRequest>(document->getDocumentURI());
                 if (current) {
                     current->open(u"GET", href);
+                    current->setPriority(HttpRequest::BLOCKING);
                     current->setHandler(boost::bind(&HTMLLinkElementImp::linkStyleSheet, this, current));
                     document->incrementLoadEventDelayCount(current->getURL());
+                    document->observeResourceTiming(current, u"link");
                     current->send();
                     return; // Do not reset styleSheet.
                 }
@@ -140,8 +142,10 @@ void HTMLLinkElementImp::refresh()
             current = std::make_shared<HttpRequest>(document->getDocumentURI());
             if (current) {
                 current->open(u"GET", href);
+                current->setPriority(HttpRequest::PREFETCH);
                 current->setHandler(boost::bind(&HTMLLinkElementImp::linkIcon, this, current));
                 document->incrementLoadEventDelayCount(current->getURL());
+                document->observeResourceTiming(current, u"link");
                 current->send();
             }
         }
@@ -156,7 +160,7 @@ void HTMLLinkElementImp::linkStyleSheet(const HttpRequestPtr& request)
 
     DocumentPtr document = getOwnerDocumentImp();
     if (current->getStatus() == 200) {
-        boost::iostreams::stream<boost::iostreams::file_descriptor_source> stream(current->getContentDescriptor(), boost::iostreams::close_handle);
+        HttpContentStream stream(current->getContentSource());
         CSSParser parser(current->getURL());
         CSSInputStream cssStream(stream, current->getResponseMessage().getContentCharset(), utfconv(document->getCharacterSet()));
         styleSheet = parser.parse(document, cssStream);
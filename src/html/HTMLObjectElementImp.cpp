@@ -137,6 +137,7 @@ void HTMLObjectElementImp::refresh()
         current->open(u"GET", data);
         current->setHandler(boost::bind(&HTMLObjectElementImp::handleRefresh, this, current));
         document->incrementLoadEventDelayCount(current->getURL());
+        document->observeResourceTiming(current, u"object");
         current->send();
     } else
         active = false;
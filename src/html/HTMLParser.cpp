@@ -329,7 +329,7 @@ bool HTMLParser::stopParsing()
 void HTMLParser::parseRawtext(Token& token, HTMLTokenizer::State* state)
 {
     insertHtmlElement(token);
-    tokenizer->setState(state);
+    tokenizer->switchState(state);
     originalInsertionMode = insertionMode;
     setInsertionMode(&text);
 }
@@ -906,7 +906,7 @@ bool HTMLParser::InHead::processStartTag(HTMLParser* parser, Token& token)
             // TODO: fragment case
         }
         parser->insertHtmlElement(script);
-        parser->tokenizer->setState(&HTMLTokenizer::scriptDataState);
+        parser->tokenizer->switchState(&HTMLTokenizer::scriptDataState);
         parser->originalInsertionMode = parser->insertionMode;
         parser->setInsertionMode(&text);
         return false;
@@ -1125,6 +1125,22 @@ bool HTMLParser::InBody::processCharacter(HTMLParser* parser, Token& token)
     return true;
 }
 
+bool HTMLParser::InBody::processCharacters(HTMLParser* parser, Token& token)
+{
+    const std::u16string& data = token.getCharacters();
+    parser->reconstructActiveFormattingElements();
+    parser->insertCharacter(data);
+    if (parser->framesetOkFlag) {
+        for (auto i = data.begin(); i < data.end(); ++i) {
+            if (!isSpace(*i)) {
+                parser->framesetOkFlag = false;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
 bool HTMLParser::InBody::processStartTag(HTMLParser* parser, Token& token)
 {
     static Token endTagA(Token::Type::EndTag, u"a");
@@ -1237,7 +1253,7 @@ bool HTMLParser::InBody::processStartTag(HTMLParser* parser, Token& token)
         if (parser->elementInButtonScope(u"p"))
             processEndTag(parser, endTagP);
         parser->insertHtmlElement(token);
-        parser->tokenizer->setState(&HTMLTokenizer::plaintextState);
+        parser->tokenizer->switchState(&HTMLTokenizer::plaintextState);
         return true;
     }
     if (token.getName() == u"button") {
@@ -1349,7 +1365,7 @@ bool HTMLParser::InBody::processStartTag(HTMLParser* parser, Token& token)
     }
     if (token.getName() == u"textarea") {
         parser->insertHtmlElement(token);
-        parser->tokenizer->setState(&HTMLTokenizer::rcdataState);
+        parser->tokenizer->switchState(&HTMLTokenizer::rcdataState);
         Token nextToken = parser->tokenizer->peekToken();
         if (nextToken.getType() == Token::Type::Character && nextToken.getChar() == '\n')
             parser->tokenizer->getToken();
@@ -1727,6 +1743,12 @@ bool HTMLParser::Text::processCharacter(HTMLParser* parser, Token& token)
     return true;
 }
 
+bool HTMLParser::Text::processCharacters(HTMLParser* parser, Token& token)
+{
+    pendingCharacters += token.getCharacters();
+    return true;
+}
+
 bool HTMLParser::Text::processStartTag(HTMLParser* parser, Token& token)
 {
     return false;
@@ -2872,7 +2894,7 @@ bool HTMLParser::InBinding::processStartTag(HTMLParser* parser, Token& token)
             // TODO: fragment case
         }
         parser->insertHtmlElement(script);
-        parser->tokenizer->setState(&HTMLTokenizer::scriptDataState);
+        parser->tokenizer->switchState(&HTMLTokenizer::scriptDataState);
         parser->originalInsertionMode = parser->insertionMode;
         parser->setInsertionMode(&text);
         return false;
@@ -2920,6 +2942,18 @@ HTMLParser::HTMLParser(const DocumentPtr& document, HTMLTokenizer* tokenizer, bo
 
 bool HTMLParser::processToken(Token& token)
 {
+    if (token.getType() == Token::Type::Character && !token.getCharacters().empty()) {
+        if (insertionMode->processCharacters(this, token))
+            return true;
+        // The insertion mode can change at any character.
+        std::u16string data(token.getCharacters());
+        bool result = true;
+        for (auto i = data.begin(); i < data.end(); ++i) {
+            Token c(*i);
+            result = insertionMode->processToken(this, c);
+        }
+        return result;
+    }
     return insertionMode->processToken(this, token);
 }
 
@@ -59,6 +59,13 @@ class HTMLParser
         virtual bool processStartTag(HTMLParser* parser, Token& token) = 0;
         virtual bool processEndTag(HTMLParser* parser, Token& token) = 0;
 
+        // Processes a Character token holding a run of characters at once.
+        // Returns false if the characters need to be processed one by one.
+        virtual bool processCharacters(HTMLParser* parser, Token& token)
+        {
+            return false;
+        }
+
         bool processToken(HTMLParser* parser, Token& token)
         {
             bool result;
@@ -171,6 +178,7 @@ class HTMLParser
         virtual bool processComment(HTMLParser* parser, Token& token);
         virtual bool processDoctype(HTMLParser* parser, Token& token);
         virtual bool processCharacter(HTMLParser* parser, Token& token);
+        virtual bool processCharacters(HTMLParser* parser, Token& token);
         virtual bool processStartTag(HTMLParser* parser, Token& token);
         virtual bool processEndTag(HTMLParser* parser, Token& token);
     };
@@ -187,6 +195,7 @@ class HTMLParser
         virtual bool processComment(HTMLParser* parser, Token& token);
         virtual bool processDoctype(HTMLParser* parser, Token& token);
         virtual bool processCharacter(HTMLParser* parser, Token& token);
+        virtual bool processCharacters(HTMLParser* parser, Token& token);
         virtual bool processStartTag(HTMLParser* parser, Token& token);
         virtual bool processEndTag(HTMLParser* parser, Token& token);
     };
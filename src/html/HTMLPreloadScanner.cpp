@@ -0,0 +1,295 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTMLPreloadScanner.h"
+
+#include <string.h>
+
+namespace {
+
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+}
+
+bool isAlpha(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+char toLower(char c)
+{
+    return ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Returns true if the text of the element is not markup.
+bool isRawText(const std::string& name)
+{
+    static const char* const names[] = {
+        "iframe", "noembed", "noframes", "script", "style", "textarea", "title", "xmp"
+    };
+    for (auto i = names; i < names + sizeof names / sizeof names[0]; ++i) {
+        if (name == *i)
+            return true;
+    }
+    return false;
+}
+
+bool containsToken(const std::string& list, const char* token)
+{
+    size_t length = strlen(token);
+    for (size_t pos = list.find(token); pos != std::string::npos; pos = list.find(token, pos + 1)) {
+        if ((pos == 0 || isSpace(list[pos - 1])) &&
+            (pos + length == list.length() || isSpace(list[pos + length])))
+            return true;
+    }
+    return false;
+}
+
+// Decodes the character references which often appear in URLs.
+std::string decodeURL(std::string url)
+{
+    size_t begin = 0;
+    while (begin < url.length() && isSpace(url[begin]))
+        ++begin;
+    size_t end = url.length();
+    while (begin < end && isSpace(url[end - 1]))
+        --end;
+    url = url.substr(begin, end - begin);
+    for (size_t pos = url.find("&amp;"); pos != std::string::npos; pos = url.find("&amp;", pos + 1))
+        url.erase(pos + 1, 4);
+    return url;
+}
+
+}  // namespace
+
+HTMLPreloadScanner::HTMLPreloadScanner() :
+    state(Data),
+    position(0),
+    tagStart(0),
+    emitFrom(0),
+    dashes(0),
+    quote(0),
+    endTag(false)
+{
+}
+
+void HTMLPreloadScanner::startTag(bool isEndTag)
+{
+    endTag = isEndTag;
+    tagName.clear();
+    attributeName.clear();
+    attributeValue.clear();
+    src.clear();
+    href.clear();
+    rel.clear();
+}
+
+void HTMLPreloadScanner::endAttribute()
+{
+    if (!endTag) {
+        if (attributeName == "src")
+            src = attributeValue;
+        else if (attributeName == "href")
+            href = attributeValue;
+        else if (attributeName == "rel") {
+            rel = attributeValue;
+            for (auto i = rel.begin(); i != rel.end(); ++i)
+                *i = toLower(*i);
+        }
+    }
+    attributeName.clear();
+    attributeValue.clear();
+}
+
+void HTMLPreloadScanner::emitTag(std::deque<Resource>& found)
+{
+    endAttribute();
+    state = Data;
+    if (endTag)
+        return;
+    if (isRawText(tagName)) {
+        rawTextTag = tagName;
+        rawTextEnd.clear();
+        state = RawText;
+    } else if (tagName == "plaintext")
+        state = Plaintext;
+    if (tagStart < emitFrom)
+        return;
+
+    Resource resource;
+    if (tagName == "script" && !src.empty()) {
+        resource.type = Script;
+        resource.url = src;
+    } else if (tagName == "img" && !src.empty()) {
+        resource.type = Image;
+        resource.url = src;
+    } else if (tagName == "link" && !href.empty() &&
+               containsToken(rel, "stylesheet") && !containsToken(rel, "alternate")) {
+        resource.type = StyleSheet;
+        resource.url = href;
+    } else
+        return;
+    resource.url = decodeURL(resource.url);
+    if (!resource.url.empty())
+        found.push_back(resource);
+}
+
+void HTMLPreloadScanner::scan(const char* data, size_t length, std::deque<Resource>& found)
+{
+    for (const char* end = data + length; data < end; ++data, ++position) {
+        char c = *data;
+        switch (state) {
+        case Data:
+            if (c == '<') {
+                tagStart = position;
+                state = TagOpen;
+            }
+            break;
+        case TagOpen:
+            if (c == '!') {
+                markup.clear();
+                state = MarkupDeclaration;
+            } else if (c == '/') {
+                startTag(true);
+                state = TagName;
+            } else if (isAlpha(c)) {
+                startTag(false);
+                tagName += toLower(c);
+                state = TagName;
+            } else if (c == '?')
+                state = Bogus;
+            else if (c != '<')
+                state = Data;
+            break;
+        case MarkupDeclaration:
+            markup += c;
+            if (markup == "--") {
+                dashes = 0;
+                state = Comment;
+            } else if (markup != "-")
+                state = (c == '>') ? Data : Bogus;
+            break;
+        case Comment:
+            if (c == '-')
+                ++dashes;
+            else if (c == '>' && 2 <= dashes)
+                state = Data;
+            else
+                dashes = 0;
+            break;
+        case Bogus:
+            if (c == '>')
+                state = Data;
+            break;
+        case TagName:
+            if (isSpace(c))
+                state = BeforeAttributeName;
+            else if (c == '/')
+                state = BeforeAttributeName;
+            else if (c == '>')
+                emitTag(found);
+            else if (tagName.empty() && !isAlpha(c))
+                state = Bogus;
+            else
+                tagName += toLower(c);
+            break;
+        case BeforeAttributeName:
+            if (c == '>')
+                emitTag(found);
+            else if (!isSpace(c) && c != '/') {
+                attributeName += toLower(c);
+                state = AttributeName;
+            }
+            break;
+        case AttributeName:
+            if (isSpace(c))
+                state = AfterAttributeName;
+            else if (c == '/') {
+                endAttribute();
+                state = BeforeAttributeName;
+            } else if (c == '=')
+                state = BeforeAttributeValue;
+            else if (c == '>')
+                emitTag(found);
+            else
+                attributeName += toLower(c);
+            break;
+        case AfterAttributeName:
+            if (c == '=')
+                state = BeforeAttributeValue;
+            else if (c == '>')
+                emitTag(found);
+            else if (!isSpace(c)) {
+                endAttribute();
+                if (c == '/')
+                    state = BeforeAttributeName;
+                else {
+                    attributeName += toLower(c);
+                    state = AttributeName;
+                }
+            }
+            break;
+        case BeforeAttributeValue:
+            if (c == '"' || c == '\'') {
+                quote = c;
+                state = AttributeValue;
+            } else if (c == '>')
+                emitTag(found);
+            else if (!isSpace(c)) {
+                quote = 0;
+                attributeValue += c;
+                state = AttributeValue;
+            }
+            break;
+        case AttributeValue:
+            if (quote ? (c == quote) : isSpace(c)) {
+                endAttribute();
+                state = BeforeAttributeName;
+            } else if (!quote && c == '>')
+                emitTag(found);
+            else
+                attributeValue += c;
+            break;
+        case RawText:
+            // Look for "</" followed by the element name.
+            if (c == '<')
+                rawTextEnd = "<";
+            else if (rawTextEnd.empty())
+                break;
+            else if (rawTextEnd.length() == 1)
+                rawTextEnd = (c == '/') ? "</" : "";
+            else if (rawTextEnd.length() < rawTextTag.length() + 2) {
+                if (toLower(c) == rawTextTag[rawTextEnd.length() - 2])
+                    rawTextEnd += c;
+                else
+                    rawTextEnd.clear();
+            } else if (isSpace(c) || c == '/' || c == '>') {
+                tagStart = position - rawTextEnd.length();
+                startTag(true);
+                tagName = rawTextTag;
+                if (c == '>')
+                    emitTag(found);
+                else
+                    state = BeforeAttributeName;
+            } else
+                rawTextEnd.clear();
+            break;
+        case Plaintext:
+            return;
+        }
+    }
+}
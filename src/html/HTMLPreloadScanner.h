@@ -0,0 +1,100 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTMLPRELOADSCANNER_H
+#define ES_HTMLPRELOADSCANNER_H
+
+#include <deque>
+#include <string>
+
+// HTMLPreloadScanner looks through the raw bytes of an HTML document for
+// the style sheets, scripts, and images it refers to, so that they can be
+// requested before the parser reaches them. It does not build any tree, and
+// it only understands ASCII compatible character encodings.
+class HTMLPreloadScanner
+{
+public:
+    enum Type
+    {
+        StyleSheet,
+        Script,
+        Image
+    };
+
+    struct Resource
+    {
+        Type type;
+        std::string url;
+    };
+
+private:
+    enum State
+    {
+        Data,
+        TagOpen,
+        MarkupDeclaration,
+        Comment,
+        Bogus,
+        TagName,
+        BeforeAttributeName,
+        AttributeName,
+        AfterAttributeName,
+        BeforeAttributeValue,
+        AttributeValue,
+        RawText,
+        Plaintext
+    };
+
+    State state;
+    unsigned long long position;
+    unsigned long long tagStart;
+    unsigned long long emitFrom;
+    std::string markup;     // the beginning of a markup declaration
+    int dashes;             // the number of '-' just before '>' in a comment
+    char quote;
+    bool endTag;
+    std::string tagName;
+    std::string attributeName;
+    std::string attributeValue;
+    std::string rawTextTag;     // the element whose text is skipped
+    std::string rawTextEnd;     // the end tag text seen so far
+
+    // attributes of interest
+    std::string src;
+    std::string href;
+    std::string rel;
+
+    void startTag(bool endTag);
+    void endAttribute();
+    void emitTag(std::deque<Resource>& found);
+
+public:
+    HTMLPreloadScanner();
+
+    // Resources found before offset are not reported.
+    void setEmitFrom(unsigned long long offset) {
+        emitFrom = offset;
+    }
+    unsigned long long getPosition() const {
+        return position;
+    }
+
+    // Scans the next part of the document, and appends the resources found
+    // to found.
+    void scan(const char* data, size_t length, std::deque<Resource>& found);
+};
+
+#endif  // ES_HTMLPRELOADSCANNER_H
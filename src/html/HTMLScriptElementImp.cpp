@@ -107,11 +107,13 @@ bool HTMLScriptElementImp::prepare()
             request->open(u"GET", src);
             request->setHandler(boost::bind(&HTMLScriptElementImp::notify, this));
             document->incrementLoadEventDelayCount(request->getURL());
+            document->observeResourceTiming(request, u"script");
             if (hasDefer && parserInserted && !hasAsync) {
                 type = Defer;
                 document->addDeferScript(self());
             } else if (parserInserted && !hasAsync) {
                 type = Blocking;
+                request->setPriority(HttpRequest::BLOCKING);
                 document->setPendingParsingBlockingScript(std::static_pointer_cast<HTMLScriptElementImp>(self()));
             } else if (!hasAsync && !forceAsync) {
                 type = Ordered;
@@ -176,7 +178,7 @@ bool HTMLScriptElementImp::execute()
     std::u16string script;
     if (request) {
         assert(request->getStatus() == 200);
-        boost::iostreams::stream<boost::iostreams::file_descriptor_source> stream(request->getContentDescriptor(), boost::iostreams::close_handle);
+        HttpContentStream stream(request->getContentSource());
         U16ConverterInputStream u16stream(stream, "utf-8");  // TODO detect encode
         script = u16stream;
     } else {
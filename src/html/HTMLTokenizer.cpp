@@ -23,9 +23,15 @@
 
 #include "AttrImp.h"
 #include "css/CSSSerialize.h"
+#include "html/HTMLTokenizerThread.h"
 #include "html/HTMLUtil.h"
 
 #include <algorithm>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace org::w3c::dom::bootstrap;
 
@@ -92,11 +98,6 @@ struct Entity
     char32_t unicode;
 };
 
-bool compareEntities(const Entity& s, const Entity& t)
-{
-    return strcmp(s.entity, t.entity) < 0;
-}
-
 Entity entities[] = {
     { "AElig", u'\xc6' },
     { "AElig;", u'\xc6' },
@@ -2236,15 +2237,95 @@ Entity entities[] = {
     { "zscr;", U'\x0001d4cf' },
     { "zwj;", u'\x200d' },
     { "zwnj;", u'\x200c' },
-    { "~", u'\xfffd' },  // sentinel. "~" is not a valid entity name.
 };
 
-Entity* lookupEntity(const char* entity)
+// EntityTrie is the trie of the entity names, which is walked one character
+// at a time while a named character reference is consumed. The children of
+// each node are kept next to each other in the order of the characters.
+class EntityTrie
+{
+    struct Node
+    {
+        char c;
+        unsigned char childCount;
+        unsigned short entity;  // the index in entities plus one, or zero
+        unsigned first;         // the index of the first child
+    };
+
+    std::vector<Node> nodes;
+
+    static bool compareNode(const Node& node, int c)
+    {
+        return node.c < c;
+    }
+
+public:
+    EntityTrie();
+
+    // Returns the child of node for c, or zero if there is none. The root
+    // node is zero.
+    unsigned next(unsigned node, int c) const
+    {
+        auto begin = nodes.begin() + nodes[node].first;
+        auto end = begin + nodes[node].childCount;
+        auto i = std::lower_bound(begin, end, c, compareNode);
+        if (i == end || i->c != c)
+            return 0;
+        return i - nodes.begin();
+    }
+
+    // Returns the entity named by the path to node, or zero.
+    const Entity* getEntity(unsigned node) const
+    {
+        unsigned short entity = nodes[node].entity;
+        return entity ? &entities[entity - 1] : 0;
+    }
+};
+
+// Builds the trie breadth first from entities, which is sorted by name, so
+// that the children of each node can be appended at once.
+EntityTrie::EntityTrie()
 {
-    Entity target = { entity, 0 };
-    return std::lower_bound(entities,
-                            &entities[sizeof entities / sizeof entities[0] - 1],
-                            target, compareEntities);
+    struct Range
+    {
+        const Entity* begin;
+        const Entity* end;
+        size_t depth;   // the length of the name shared in the range
+    };
+    std::vector<Range> ranges;  // for each node
+
+    Node root = { 0, 0, 0, 0 };
+    nodes.push_back(root);
+    Range all = { entities, entities + sizeof entities / sizeof entities[0], 0 };
+    ranges.push_back(all);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const Entity* entity = ranges[i].begin;
+        const Entity* end = ranges[i].end;
+        size_t depth = ranges[i].depth;
+        if (!entity->entity[depth]) {
+            nodes[i].entity = entity - entities + 1;
+            ++entity;
+        }
+        nodes[i].first = nodes.size();
+        while (entity < end) {
+            char c = entity->entity[depth];
+            const Entity* next = entity;
+            while (next < end && next->entity[depth] == c)
+                ++next;
+            Node node = { c, 0, 0, 0 };
+            nodes.push_back(node);
+            Range range = { entity, next, depth + 1 };
+            ranges.push_back(range);
+            entity = next;
+        }
+        nodes[i].childCount = nodes.size() - nodes[i].first;
+    }
+}
+
+const EntityTrie& getEntityTrie()
+{
+    static EntityTrie trie;
+    return trie;
 }
 
 struct Key
@@ -2318,6 +2399,31 @@ public:
     }
 };
 
+// Returns the first character in [p, end) that is either NUL or one of
+// stops, which holds up to two ASCII characters.
+const char16_t* findStop(const char16_t* p, const char16_t* end, const char* stops)
+{
+    char16_t a = stops[0];
+    char16_t b = a ? stops[1] : 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ma = _mm_set1_epi16(a);
+    const __m128i mb = _mm_set1_epi16(b);
+    for (; 8 <= end - p; p += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi16(v, zero), _mm_or_si128(_mm_cmpeq_epi16(v, ma), _mm_cmpeq_epi16(v, mb)));
+        if (int mask = _mm_movemask_epi8(m))
+            return p + __builtin_ctz(mask) / 2;
+    }
+#endif
+    for (; p < end; ++p) {
+        char16_t c = *p;
+        if (!c || c == a || c == b)
+            return p;
+    }
+    return p;
+}
+
 }  // namespace
 
 Attribute::Attribute(int ch)
@@ -2341,6 +2447,11 @@ void Attribute::appendValue(int ch)
     value += ch;
 }
 
+void Attribute::appendValue(const std::u16string& s)
+{
+    value += s;
+}
+
 Token::Token(int ucode) :
     type(Type::Character),
     flags(0),
@@ -2366,6 +2477,14 @@ Token::Token(Token::Type type, const std::u16string& name) :
 {
 }
 
+Token::Token(const std::u16string& characters) :
+    type(Type::Character),
+    flags(0),
+    ucode(characters.empty() ? 0 : characters[0]),
+    name(characters)
+{
+}
+
 void Token::append(int ch)
 {
     assert(ch != EOF);
@@ -2487,7 +2606,7 @@ bool HTMLTokenizer::DataState::consume(HTMLTokenizer* tokenizer, int ch)
         emitted |= tokenizer->emit(EOF);
         break;
     default:
-        emitted |= tokenizer->emit(ch);
+        emitted |= tokenizer->emitRun(ch, "&<");
         break;
     }
     return emitted;
@@ -2511,7 +2630,7 @@ bool HTMLTokenizer::RcdataState::consume(HTMLTokenizer* tokenizer, int ch)
         emitted |= tokenizer->emit(EOF);
         break;
     default:
-        emitted |= tokenizer->emit(ch);
+        emitted |= tokenizer->emitRun(ch, "&<");
         break;
     }
     return emitted;
@@ -2528,7 +2647,7 @@ bool HTMLTokenizer::RawtextState::consume(HTMLTokenizer* tokenizer, int ch)
         emitted |= tokenizer->emit(EOF);
         break;
     default:
-        emitted |= tokenizer->emit(ch);
+        emitted |= tokenizer->emitRun(ch, "<");
         break;
     }
     return emitted;
@@ -2545,7 +2664,7 @@ bool HTMLTokenizer::ScriptDataState::consume(HTMLTokenizer* tokenizer, int ch)
         emitted |= tokenizer->emit(EOF);
         break;
     default:
-        emitted |= tokenizer->emit(ch);
+        emitted |= tokenizer->emitRun(ch, "<");
         break;
     }
     return emitted;
@@ -2559,7 +2678,7 @@ bool HTMLTokenizer::PlaintextState::consume(HTMLTokenizer* tokenizer, int ch)
         emitted |= tokenizer->emit(EOF);
         break;
     default:
-        emitted |= tokenizer->emit(ch);
+        emitted |= tokenizer->emitRun(ch, "");
         break;
     }
     return emitted;
@@ -3350,10 +3469,13 @@ bool HTMLTokenizer::AttributeValueDoubleQuotedState::consume(HTMLTokenizer* toke
         tokenizer->parseError();
         tokenizer->setState(&tokenizer->dataState, ch);
         break;
-    default:
-        tokenizer->currentAttribute.appendValue(ch);
+    default: {
+        std::u16string run(1, ch);
+        tokenizer->readRun(run, "&\"");
+        tokenizer->currentAttribute.appendValue(run);
         break;
     }
+    }
     return emitted;
 }
 
@@ -3375,10 +3497,13 @@ bool HTMLTokenizer::AttributeValueSingleQuotedState::consume(HTMLTokenizer* toke
         tokenizer->parseError();
         tokenizer->setState(&tokenizer->dataState, ch);
         break;
-    default:
-        tokenizer->currentAttribute.appendValue(ch);
+    default: {
+        std::u16string run(1, ch);
+        tokenizer->readRun(run, "&'");
+        tokenizer->currentAttribute.appendValue(run);
         break;
     }
+    }
     return emitted;
 }
 
@@ -4302,8 +4427,9 @@ int HTMLTokenizer::consumeCharacterReference(int additionalAllowedCharacter)
     char name[MaxEntityName + 1];
     char* nameLimit;
     char* entityLimit;
-    Entity* entity;
-    Entity* found;
+    const EntityTrie& trie = getEntityTrie();
+    unsigned node;
+    const Entity* found;
 
     int ch = peekChar();
     if (ch == additionalAllowedCharacter)
@@ -4357,19 +4483,18 @@ int HTMLTokenizer::consumeCharacterReference(int additionalAllowedCharacter)
         break;
     default:
         found = 0;
+        node = 0;
         entityLimit = nameLimit = name;
-        while (isAlnum(ch = peekChar()) || ch == ';') {
+        while ((node = trie.next(node, ch))) {
             getChar();
             *nameLimit++ = static_cast<char>(ch);
-            *nameLimit = '\0';
-            entity = lookupEntity(name);
-            if (strcmp(entity->entity, name) == 0) {
+            if (const Entity* entity = trie.getEntity(node)) {
                 found = entity;
                 entityLimit = nameLimit;
-            } else if (strncmp(entity->entity, name, nameLimit - name) != 0)
-                break;
-            if (ch == ';' || MaxEntityName <= nameLimit - name)
+            }
+            if (ch == ';')
                 break;
+            ch = peekChar();
         }
         while (entityLimit <= --nameLimit)
             ungetChar(*nameLimit);
@@ -4412,6 +4537,43 @@ bool HTMLTokenizer::emit(const std::u16string& s)
     return true;
 }
 
+// Reads the characters that follow into s up to the next one in stops, NUL,
+// or EOF, so that a run of characters that has no special meaning in the
+// current state is consumed at once.
+void HTMLTokenizer::readRun(std::u16string& s, const char* stops)
+{
+    while (!charStack.empty()) {
+        const char16_t* c = &charStack.back();
+        if (findStop(c, c + 1, stops) == c)
+            return;
+        s += *c;
+        charStack.pop_back();
+    }
+    const char16_t* block;
+    while (size_t length = stream->peekBlock(block)) {
+        const char16_t* end = findStop(block, block + length, stops);
+        s.append(block, end);
+        stream->skip(end - block);
+        if (end < block + length)
+            return;
+    }
+}
+
+// Emits ch together with the run of characters that follows as a single
+// Character token. A line feed is emitted by itself so that the one right
+// after <pre>, <listing>, and <textarea> can be dropped by the parser.
+bool HTMLTokenizer::emitRun(int ch, const char* stops)
+{
+    if (ch == '\n' || ch == 0)
+        return emit(ch);
+    std::u16string run(1, ch);
+    readRun(run, stops);
+    if (run.length() == 1)
+        return emit(ch);
+    tokenQueue.push(Token(run));
+    return true;
+}
+
 bool HTMLTokenizer::emit(const Token& tag)
 {
     if (tag.getType() == Token::Type::StartTag)
@@ -4426,11 +4588,9 @@ bool HTMLTokenizer::emit(const Token& tag)
     return true;
 }
 
-Token HTMLTokenizer::peekToken()
+void HTMLTokenizer::tokenize()
 {
-    for (;;) {
-        if (!tokenQueue.empty())
-            return tokenQueue.front();
+    while (tokenQueue.empty()) {
         int c;
         do {
             c = getChar();
@@ -4438,19 +4598,41 @@ Token HTMLTokenizer::peekToken()
     }
 }
 
+Token HTMLTokenizer::peekToken()
+{
+    if (thread)
+        return thread->peekToken();
+    tokenize();
+    return tokenQueue.front();
+}
+
 Token HTMLTokenizer::getToken()
 {
-    Token token = peekToken();
+    if (thread)
+        return thread->getToken();
+    tokenize();
+    Token token(std::move(tokenQueue.front()));
     tokenQueue.pop();
     return token;
 }
 
 void HTMLTokenizer::insertString(const std::u16string& s)
 {
+    if (thread) {
+        thread->insertString(s);
+        return;
+    }
     for (auto i = s.rbegin(); i < s.rend(); ++i)
         ungetChar(*i);
 }
 
+void HTMLTokenizer::switchState(State* state)
+{
+    if (thread)
+        thread->switchState(state);
+    setState(state);
+}
+
 void HTMLTokenizer::setContext(org::w3c::dom::Element context)
 {
     setState(&dataState);
@@ -28,7 +28,6 @@
 #include <iostream>
 #include <queue>
 #include <set>
-#include <stack>
 #include <string>
 
 #include "U16InputStream.h"
@@ -47,6 +46,7 @@ public:
 
     void append(int ch);
     void appendValue(int ch);
+    void appendValue(const std::u16string& s);
 
     const std::u16string& getName() const
     {
@@ -119,6 +119,8 @@ public:
     Token(int ucode);
     Token(Type type, int ch);
     Token(Type type, const std::u16string& name);
+    // A Character token holding a run of characters
+    explicit Token(const std::u16string& characters);
 
     void append(int ch);
     bool append(Attribute& attribute);
@@ -207,6 +209,13 @@ public:
         return ucode;
     }
 
+    // Returns the run of characters of a Character token, or an empty
+    // string if the token holds a single character.
+    const std::u16string& getCharacters() const
+    {
+        return name;
+    }
+
     void acknowledge()
     {
         if (flags & Flag::SelfClosing)
@@ -214,6 +223,8 @@ public:
     }
 };
 
+class HTMLTokenizerThread;
+
 class HTMLTokenizer
 {
     class State
@@ -695,9 +706,10 @@ class HTMLTokenizer
     std::u16string appropriateTagName;
 
     U16InputStream* stream;
+    HTMLTokenizerThread* thread;
     bool fromAttribute;
     State* state;
-    std::stack<char16_t> charStack;
+    std::u16string charStack;  // the last character is read first
 
     std::queue<Token> tokenQueue;
 
@@ -707,7 +719,7 @@ class HTMLTokenizer
     void ungetChar(int ch)
     {
         if (ch != EOF)
-            charStack.push(ch);
+            charStack.push_back(ch);
     }
 
     void ungetString(const std::string& s)
@@ -719,8 +731,8 @@ class HTMLTokenizer
     int getChar()
     {
         if (!charStack.empty()) {
-            char16_t ch = charStack.top();
-            charStack.pop();
+            char16_t ch = charStack.back();
+            charStack.pop_back();
             return ch;
         }
         return stream->get();
@@ -729,7 +741,7 @@ class HTMLTokenizer
     int peekChar()
     {
         if (!charStack.empty())
-            return charStack.top();
+            return charStack.back();
         return stream->peek();
     }
 
@@ -753,13 +765,28 @@ class HTMLTokenizer
     bool emit(const std::u16string& s);
     bool emit(const Token& tag);
 
+    void readRun(std::u16string& s, const char* stops);
+    bool emitRun(int ch, const char* stops);
+
     bool isAppropriate(const std::u16string& name) {
         return name == appropriateTagName;
     }
 
+    void tokenize();
+
 public:
     HTMLTokenizer(U16InputStream* stream) :
         stream(stream),
+        thread(0),
+        fromAttribute(false),
+        state(&dataState)
+    {
+    }
+
+    // Reads the tokens from the worker thread instead of tokenizing stream.
+    explicit HTMLTokenizer(HTMLTokenizerThread* thread) :
+        stream(0),
+        thread(thread),
         fromAttribute(false),
         state(&dataState)
     {
@@ -770,9 +797,13 @@ public:
 
     void insertString(const std::u16string& s);
 
+    // Called by the tree construction stage to switch the state.
+    void switchState(State* state);
+
     void setContext(org::w3c::dom::Element context);
 
     friend class HTMLParser;
+    friend class HTMLTokenizerThread;
 };
 
 #endif  // ES_HTMLTOKENIZER_H
@@ -0,0 +1,401 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTMLTokenizerThread.h"
+
+#include <functional>
+
+const size_t HTMLTokenizerThread::BatchSize;
+const unsigned HTMLTokenizerThread::MaxBatches;
+const size_t HTMLTokenizerThread::TrimLength;
+const std::streamsize HTMLTokenizerThread::ReadAhead;
+
+int HTMLTokenizerThread::Input::peek()
+{
+    if (eof)
+        return -1;
+    if (thread->base + thread->text.length() <= position && !thread->fill()) {
+        eof = true;
+        return -1;
+    }
+    return thread->text[position - thread->base];
+}
+
+HTMLTokenizerThread::Input& HTMLTokenizerThread::Input::get(char16_t& c)
+{
+    int ch = peek();
+    if (ch != -1) {
+        c = static_cast<char16_t>(ch);
+        ++position;
+    }
+    return *this;
+}
+
+size_t HTMLTokenizerThread::Input::peekBlock(const char16_t*& block)
+{
+    if (peek() == -1)
+        return 0;
+    block = thread->text.data() + (position - thread->base);
+    return thread->base + thread->text.length() - position;
+}
+
+HTMLTokenizerThread::HTMLTokenizerThread(const HttpContentSource& source, const std::string& optionalEncoding) :
+    stream(source),
+    htmlInputStream(stream, optionalEncoding),
+    encoding(htmlInputStream.getEncoding()),
+    input(this),
+    tokenizer(&input),
+    base(0),
+    foreignDepth(0),
+    finished(false),
+    replayed(0),
+    nextEdit(0),
+    received(0),
+    complete(false),
+    waiting(false),
+    stopping(false),
+    restarting(false),
+    restartGeneration(0),
+    queued(0),
+    interrupted(false),
+    anchorPosition(0),
+    generation(0),
+    next(0),
+    nextCheckpoint(0),
+    streamPosition(0),
+    count(0),
+    verifying(false),
+    requested(&HTMLTokenizer::dataState)
+{
+    anchor.state = &HTMLTokenizer::dataState;
+    startBatch(generation);
+    thread = std::thread(std::ref(*this));
+}
+
+HTMLTokenizerThread::~HTMLTokenizerThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        interrupted = true;
+        cond.notify_one();
+    }
+    // The worker might be waiting for the rest of the document to arrive.
+    stream.cutOff();
+    thread.join();
+}
+
+//
+// The worker thread
+//
+
+void HTMLTokenizerThread::operator()()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (finished && !restarting && !stopping)
+                cond.wait(lock);
+            if (stopping)
+                return;
+            if (restarting)
+                restart();
+        }
+        Token token = tokenizer.getToken();
+        if (interrupted)
+            continue;   // the token might have been cut short
+        Token::Type type = token.getType();
+        HTMLTokenizer::State* state = 0;
+        if (type == Token::Type::StartTag || type == Token::Type::EndTag)
+            state = predict(token);
+        if (nextEdit < edits.size()) {
+            // The parser has read this token before the restart.
+            if (state)
+                tokenizer.setState(state);
+            replay();
+            continue;
+        }
+        if (state) {
+            // Note a tag is always the last token queued in the tokenizer.
+            Checkpoint checkpoint;
+            checkpoint.index = batch->tokens.size();
+            checkpoint.position = input.position;
+            checkpoint.pending = tokenizer.charStack;
+            checkpoint.tagName = tokenizer.appropriateTagName;
+            checkpoint.state = state;
+            checkpoint.foreignDepth = foreignDepth;
+            batch->checkpoints.push_back(std::move(checkpoint));
+            tokenizer.setState(state);
+        }
+        batch->tokens.push_back(std::move(token));
+        if (type == Token::Type::EndOfFile) {
+            finished = true;
+            flush();
+        } else if (BatchSize <= batch->tokens.size())
+            flush();
+    }
+}
+
+// Returns the state the tree construction stage is expected to switch the
+// tokenizer to after the tag, or zero if the tag is not a checkpoint.
+HTMLTokenizer::State* HTMLTokenizerThread::predict(const Token& token)
+{
+    const std::u16string& name = token.getName();
+    if (token.getType() == Token::Type::EndTag) {
+        if (name == u"svg" || name == u"math") {
+            if (0 < foreignDepth)
+                --foreignDepth;
+            return 0;
+        }
+        if (name == u"script" || name == u"implementation")
+            return &HTMLTokenizer::dataState;   // document.write() may follow
+        return 0;
+    }
+
+    if (name == u"svg" || name == u"math") {
+        if (!(token.getFlags() & Token::SelfClosing))
+            ++foreignDepth;
+        return 0;
+    }
+    HTMLTokenizer::State* state = 0;
+    if (name == u"title" || name == u"textarea")
+        state = &HTMLTokenizer::rcdataState;
+    else if (name == u"style" || name == u"xmp" || name == u"iframe" || name == u"noembed" || name == u"noframes" || name == u"noscript")
+        state = &HTMLTokenizer::rawtextState;
+    else if (name == u"script" || name == u"implementation")
+        state = &HTMLTokenizer::scriptDataState;
+    else if (name == u"plaintext")
+        state = &HTMLTokenizer::plaintextState;
+    if (state && foreignDepth)
+        state = &HTMLTokenizer::dataState;  // an element in foreign content
+    return state;
+}
+
+// Decodes the next part of the document into text. Returns false at the end
+// of the document, or if the worker has been interrupted.
+bool HTMLTokenizerThread::fill()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (interrupted)
+                return false;
+            if (complete || waiting || ReadAhead <= received - stream.getPosition())
+                break;
+            if (batch->tokens.empty()) {
+                cond.wait(lock);
+                continue;
+            }
+        }
+        // Hand over the tokens read so far before waiting for the rest.
+        flush();
+    }
+
+    size_t anchor = anchorPosition;
+    if (base + TrimLength <= anchor) {
+        text.erase(0, anchor - base);
+        base = anchor;
+    }
+    size_t length = text.length();
+    const char16_t* block;
+    while (text.length() - length < U16ConverterInputStream::ChunkSize) {
+        size_t count = htmlInputStream.peekBlock(block);
+        if (!count)
+            break;
+        text.append(block, count);
+        htmlInputStream.skip(count);
+    }
+    return length < text.length();
+}
+
+void HTMLTokenizerThread::startBatch(unsigned generation)
+{
+    batch = std::make_shared<Batch>();
+    batch->generation = generation;
+    batch->streamPosition = stream.getPosition();
+    batch->tokens.reserve(BatchSize);
+}
+
+void HTMLTokenizerThread::flush()
+{
+    if (batch->tokens.empty())
+        return;
+    queue.push(batch);
+    startBatch(batch->generation);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ++queued;
+    while (MaxBatches <= queued && !interrupted)
+        cond.wait(lock);
+}
+
+// Starts over from restartPoint. Called with mutex locked.
+void HTMLTokenizerThread::restart()
+{
+    restarting = false;
+    interrupted = false;
+    input.reset(restartPoint.position);
+    tokenizer.state = restartPoint.state;
+    tokenizer.charStack = restartPoint.pending;
+    tokenizer.appropriateTagName = restartPoint.tagName;
+    tokenizer.temporaryBuffer.clear();
+    tokenizer.currentToken = Token();
+    tokenizer.currentAttribute.clear();
+    tokenizer.fromAttribute = false;
+    std::queue<Token>().swap(tokenizer.tokenQueue);
+    foreignDepth = restartPoint.foreignDepth;
+    finished = false;
+    edits = restartPoint.edits;
+    replayed = 0;
+    nextEdit = 0;
+    startBatch(restartGeneration);
+}
+
+// Applies the edits made by the parser after the token that has just been
+// read again.
+void HTMLTokenizerThread::replay()
+{
+    ++replayed;
+    for (; nextEdit < edits.size() && edits[nextEdit].count == replayed; ++nextEdit) {
+        const Edit& edit = edits[nextEdit];
+        if (edit.state)
+            tokenizer.setState(edit.state);
+        tokenizer.charStack += edit.inserted;
+    }
+}
+
+//
+// The main thread
+//
+
+void HTMLTokenizerThread::feed(std::streamsize length, bool done)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (received == length && complete == done)
+        return;
+    received = length;
+    complete = done;
+    cond.notify_one();
+}
+
+// Makes the next token available in current. Returns false if it is not
+// available yet and wait is false.
+bool HTMLTokenizerThread::load(bool wait)
+{
+    verify();
+    while (!current || current->tokens.size() <= next) {
+        BatchPtr batch;
+        if (!queue.tryPop(batch)) {
+            if (!wait)
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                waiting = true;
+                cond.notify_one();
+            }
+            queue.pop(batch);
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --queued;
+            cond.notify_one();
+        }
+        if (batch->generation != generation)
+            continue;   // discarded by restart
+        current = batch;
+        next = 0;
+        nextCheckpoint = 0;
+        streamPosition = batch->streamPosition;
+    }
+    return true;
+}
+
+// Checks the state set by the parser and the text written after the last
+// checkpoint, and lets the worker start over from there if either is not
+// what the worker has assumed.
+void HTMLTokenizerThread::verify()
+{
+    if (!verifying)
+        return;
+    verifying = false;
+    if (!count) {
+        if (requested == anchor.state && inserted.empty())
+            return;
+        anchor.state = requested;
+        anchor.pending += inserted;
+    } else {
+        if (!requested && inserted.empty())
+            return;
+        Edit edit;
+        edit.count = count;
+        edit.state = requested;
+        edit.inserted = inserted;
+        anchor.edits.push_back(std::move(edit));
+    }
+    inserted.clear();
+    ++generation;
+    current.reset();
+    std::lock_guard<std::mutex> lock(mutex);
+    restartPoint = anchor;
+    restartGeneration = generation;
+    restarting = true;
+    interrupted = true;
+    cond.notify_one();
+}
+
+bool HTMLTokenizerThread::isReady()
+{
+    return load(false);
+}
+
+Token HTMLTokenizerThread::peekToken()
+{
+    load(true);
+    return current->tokens[next];
+}
+
+Token HTMLTokenizerThread::getToken()
+{
+    load(true);
+    Token& token = current->tokens[next];
+    if (token.getType() == Token::Type::EndOfFile)
+        return token;   // keep returning the end of file like HTMLTokenizer
+    if (nextCheckpoint < current->checkpoints.size() && current->checkpoints[nextCheckpoint].index == next) {
+        anchor = std::move(current->checkpoints[nextCheckpoint++]);
+        anchorPosition = anchor.position;
+        count = 0;
+        verifying = true;
+        requested = &HTMLTokenizer::dataState;
+    } else {
+        ++count;
+        requested = 0;
+    }
+    return std::move(current->tokens[next++]);
+}
+
+void HTMLTokenizerThread::switchState(HTMLTokenizer::State* state)
+{
+    requested = state;
+    verifying = true;
+}
+
+void HTMLTokenizerThread::insertString(const std::u16string& s)
+{
+    inserted.append(s.rbegin(), s.rend());
+    verifying = true;
+}
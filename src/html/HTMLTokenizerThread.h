@@ -0,0 +1,220 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTMLTOKENIZERTHREAD_H
+#define ES_HTMLTOKENIZERTHREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Queue.h"
+#include "U16InputStream.h"
+#include "html/HTMLInputStream.h"
+#include "html/HTMLTokenizer.h"
+#include "http/HTTPRequest.h"
+
+// HTMLTokenizerThread decodes and tokenizes an HTML document on a worker
+// thread, and hands the tokens over to the main thread in batches through
+// a queue. The main thread reads them through an HTMLTokenizer constructed
+// with this thread, so HTMLParser does not tell them apart.
+//
+// The tree construction stage can change the state of the tokenizer, and
+// document.write() can insert text at the insertion point, both of which
+// the worker cannot see in advance. The worker predicts the state after each
+// start tag that might change it, and records where the input was at such a
+// tag and at the end tags of scripts. If the tree construction stage
+// disagrees with the prediction, or document.write() has been called, the
+// tokens after that point are discarded and the worker starts over from
+// there. If the state is switched or text is written after any other token,
+// the worker starts over from the last checkpoint instead, reads again the
+// tokens up to that one, and then applies the change.
+class HTMLTokenizerThread
+{
+    typedef org::w3c::dom::bootstrap::HttpContentSource HttpContentSource;
+    typedef org::w3c::dom::bootstrap::HttpContentStream HttpContentStream;
+
+public:
+    // The number of the tokens handed over at a time
+    static const size_t BatchSize = 1024;
+    // The number of the batches the worker can read ahead of the parser
+    static const unsigned MaxBatches = 16;
+    // The length of the decoded text to be kept before it is trimmed
+    static const size_t TrimLength = 64 * 1024;
+    // The length of the document that has to be received ahead of the
+    // current input position before decoding it while loading.
+    static const std::streamsize ReadAhead = 4096;
+
+private:
+    // Edit is a change made by the tree construction stage after a token
+    // that is not a checkpoint.
+    struct Edit
+    {
+        size_t count;           // the number of the tokens read after the checkpoint
+        HTMLTokenizer::State* state;    // the state switched to, or zero
+        std::u16string inserted;        // the text written, as in HTMLTokenizer::charStack
+    };
+
+    struct Checkpoint
+    {
+        size_t index;           // of the token in the batch
+        size_t position;        // of the input just after the token
+        std::u16string pending; // characters to be read before position, as in HTMLTokenizer::charStack
+        std::u16string tagName; // the appropriate end tag name
+        HTMLTokenizer::State* state;    // the predicted state after the token
+        unsigned foreignDepth;  // the number of the open svg and math elements
+        std::vector<Edit> edits;    // made after the checkpoint
+
+        Checkpoint() :
+            index(0),
+            position(0),
+            state(0),
+            foreignDepth(0)
+        {
+        }
+    };
+
+    struct Batch
+    {
+        unsigned generation;
+        std::streamsize streamPosition; // of the encoded input when the batch started
+        std::vector<Token> tokens;
+        std::vector<Checkpoint> checkpoints;
+    };
+    typedef std::shared_ptr<Batch> BatchPtr;
+
+    // Input reads the decoded document kept in text for the worker
+    // tokenizer, so that it can be read again from a checkpoint.
+    class Input : public U16InputStream
+    {
+        HTMLTokenizerThread* thread;
+        bool eof;
+    public:
+        size_t position;
+
+        explicit Input(HTMLTokenizerThread* thread) :
+            thread(thread),
+            eof(false),
+            position(0)
+        {
+        }
+        void reset(size_t value) {
+            position = value;
+            eof = false;
+        }
+        virtual explicit operator bool() const {
+            return !eof;
+        }
+        virtual bool operator!() const {
+            return eof;
+        }
+        virtual int peek();
+        virtual Input& get(char16_t& c);
+        virtual size_t peekBlock(const char16_t*& block);
+        virtual void skip(size_t count) {
+            position += count;
+        }
+    };
+
+    HttpContentStream stream;
+    HTMLInputStream htmlInputStream;
+    std::string encoding;
+
+    // The fields below are used by the worker thread.
+    Input input;
+    HTMLTokenizer tokenizer;
+    std::u16string text;    // the decoded document from base
+    size_t base;
+    unsigned foreignDepth;
+    BatchPtr batch;
+    bool finished;          // the end of file token has been handed over
+    std::vector<Edit> edits;    // to be applied again after restart
+    size_t replayed;        // the number of the tokens read again after restart
+    size_t nextEdit;
+
+    // The fields below are shared with the main thread under mutex.
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::streamsize received;   // the length of the document received so far
+    bool complete;              // the whole document has been received
+    bool waiting;               // the main thread is waiting for a batch
+    bool stopping;
+    bool restarting;
+    Checkpoint restartPoint;
+    unsigned restartGeneration;
+    unsigned queued;            // the number of the batches in queue
+    std::atomic_bool interrupted;   // either restarting or stopping
+    std::atomic<size_t> anchorPosition; // no checkpoint before this is used any more
+    Queue<BatchPtr> queue;
+
+    // The fields below are used by the main thread.
+    unsigned generation;
+    BatchPtr current;
+    size_t next;            // the index of the next token in current
+    size_t nextCheckpoint;
+    std::streamsize streamPosition;
+    Checkpoint anchor;      // the last checkpoint read by the parser
+    size_t count;           // the number of the tokens read after anchor
+    bool verifying;         // the state after anchor has to be checked
+    HTMLTokenizer::State* requested;    // the state set by the parser after the last token, or zero
+    std::u16string inserted;            // the text written after the last token, as in HTMLTokenizer::charStack
+
+    std::thread thread;
+
+    bool fill();
+    void startBatch(unsigned generation);
+    void flush();
+    void restart();
+    void replay();
+    HTMLTokenizer::State* predict(const Token& token);
+
+    bool load(bool wait);
+    void verify();
+
+public:
+    HTMLTokenizerThread(const HttpContentSource& source, const std::string& optionalEncoding);
+    ~HTMLTokenizerThread();
+
+    void operator()();
+
+    const std::string& getEncoding() const {
+        return encoding;
+    }
+    // Returns the position in the encoded document where the tokens being
+    // read have been decoded from.
+    std::streamsize getStreamPosition() const {
+        return streamPosition;
+    }
+
+    // Tells how much of the document has been received.
+    void feed(std::streamsize length, bool done);
+
+    // Returns true if the next token can be read without waiting for the
+    // worker thread.
+    bool isReady();
+    Token peekToken();
+    Token getToken();
+
+    // Called through HTMLTokenizer by the tree construction stage.
+    void switchState(HTMLTokenizer::State* state);
+    void insertString(const std::u16string& s);
+};
+
+#endif  // ES_HTMLTOKENIZERTHREAD_H
@@ -0,0 +1,639 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTTP2Session.h"
+
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include "url/URI.h"
+#include "http/HTTPConnection.h"
+#include "http/HTTPUtil.h"
+
+#include "Test.util.h"
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+using namespace http;
+
+namespace {
+
+const char* const Preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+unsigned long readUnsigned(const char* p, int length)
+{
+    unsigned long value = 0;
+    while (0 < length--)
+        value = (value << 8) | static_cast<unsigned char>(*p++);
+    return value;
+}
+
+void appendUnsigned(std::string& s, unsigned long value, int length)
+{
+    while (0 < length--)
+        s += static_cast<char>(value >> (length * 8));
+}
+
+// Removes the padding of a DATA, HEADERS, or PUSH_PROMISE frame. Returns
+// false if the padding is longer than the payload.
+bool removePadding(unsigned char flags, const char*& payload, size_t& length)
+{
+    if (!(flags & 0x8))   // PADDED
+        return true;
+    if (length < 1)
+        return false;
+    size_t padding = static_cast<unsigned char>(*payload);
+    ++payload;
+    --length;
+    if (length < padding)
+        return false;
+    length -= padding;
+    return true;
+}
+
+}
+
+const unsigned char Http2Session::END_STREAM;
+const unsigned char Http2Session::ACK;
+const unsigned char Http2Session::END_HEADERS;
+const unsigned char Http2Session::PADDED;
+const unsigned char Http2Session::PRIORITY_FLAG;
+const size_t Http2Session::FrameHeaderLength;
+const size_t Http2Session::DefaultMaxFrameSize;
+const unsigned long Http2Session::MaxWindowSize;
+const unsigned long Http2Session::StreamWindowSize;
+const unsigned long Http2Session::ConnectionWindowSize;
+const unsigned Http2Session::DefaultMaxStreams;
+
+Http2Session::Http2Session(HttpConnection& connection) :
+    connection(connection),
+    nextStreamId(1),
+    lastStreamId(0),
+    completedCount(0),
+    maxFrameSize(DefaultMaxFrameSize),
+    unacknowledged(0),
+    settled(false),
+    goingAway(false),
+    failed(false),
+    writing(false),
+    headerStreamId(0),
+    headerFlags(0)
+{
+}
+
+// Maps the priority of the request to the weight of its stream. The streams
+// are not made dependent on each other, so that a response is not delayed
+// by another one that has stalled.
+unsigned char Http2Session::getWeight(unsigned short priority)
+{
+    switch (priority) {
+    case HttpRequest::DOCUMENT:
+        return 255;
+    case HttpRequest::BLOCKING:
+        return 219;
+    case HttpRequest::ASYNC:
+        return 182;
+    case HttpRequest::IMAGE:
+        return 109;
+    default:
+        return 15;
+    }
+}
+
+// The header fields that vary with each request or carry a credential are
+// not added to the dynamic table.
+bool Http2Session::isIndexed(const std::string& name)
+{
+    static const char* const notIndexed[] = {
+        ":path",
+        "authorization",
+        "cookie",
+        "if-modified-since",
+        "if-none-match",
+        "if-range",
+        "range",
+        "proxy-authorization"
+    };
+    for (auto i = std::begin(notIndexed); i != std::end(notIndexed); ++i) {
+        if (name == *i)
+            return false;
+    }
+    return true;
+}
+
+void Http2Session::writeFrame(unsigned char type, unsigned char flags, unsigned id, const std::string& payload)
+{
+    appendUnsigned(output, payload.length(), 3);
+    output += static_cast<char>(type);
+    output += static_cast<char>(flags);
+    appendUnsigned(output, id, 4);
+    output += payload;
+}
+
+void Http2Session::writeSettings()
+{
+    std::string payload;
+    appendUnsigned(payload, SETTINGS_ENABLE_PUSH, 2);
+    appendUnsigned(payload, 0, 4);
+    appendUnsigned(payload, SETTINGS_INITIAL_WINDOW_SIZE, 2);
+    appendUnsigned(payload, StreamWindowSize, 4);
+    writeFrame(SETTINGS, 0, 0, payload);
+}
+
+void Http2Session::writeWindowUpdate(unsigned id, unsigned long increment)
+{
+    std::string payload;
+    appendUnsigned(payload, increment, 4);
+    writeFrame(WINDOW_UPDATE, 0, id, payload);
+}
+
+void Http2Session::writeReset(unsigned id, unsigned long errorCode)
+{
+    std::string payload;
+    appendUnsigned(payload, errorCode, 4);
+    writeFrame(RST_STREAM, 0, id, payload);
+}
+
+void Http2Session::writeGoaway(unsigned long errorCode)
+{
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << errorCode << '\n';
+
+    std::string payload;
+    appendUnsigned(payload, 0, 4);  // no stream is initiated by the server
+    appendUnsigned(payload, errorCode, 4);
+    writeFrame(GOAWAY, 0, 0, payload);
+    goingAway = true;
+    failed = true;
+}
+
+void Http2Session::flush()
+{
+    if (writing || output.empty())
+        return;
+    writing = true;
+    std::ostream stream(&connection.request);
+    stream.write(output.data(), output.length());
+    output.clear();
+    connection.asyncWrite(connection.request, boost::bind(&HttpConnection::handleWriteFrames, connection.shared_from_this(), boost::asio::placeholders::error));
+}
+
+bool Http2Session::written()
+{
+    writing = false;
+    if ((failed || (goingAway && streams.empty())) && output.empty())
+        return false;
+    flush();
+    return true;
+}
+
+void Http2Session::start()
+{
+    output = Preface;
+    writeSettings();
+    writeWindowUpdate(0, ConnectionWindowSize - 65535);
+    flush();
+}
+
+bool Http2Session::open(const HttpRequestPtr& request)
+{
+    if (goingAway || MaxWindowSize < nextStreamId)
+        return false;
+
+    HttpRequestMessage& message(request->getRequestMessage());
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << nextStreamId << ' ' << message.getMethod() << ' ' << message.getURL() << '\n';
+
+    URI uri(message.getURL());
+    std::string block;
+    encoder.begin(block);
+    encoder.encode(block, ":method", message.getMethod());
+    encoder.encode(block, ":scheme", "https");
+    encoder.encode(block, ":authority", uri.getHost());
+    encoder.encode(block, ":path", uri.getPathname() + uri.getSearch(), false);
+    const HttpHeaderList& headers(message.getHeaders());
+    for (auto i = headers.begin(); i != headers.end(); ++i) {
+        switch (i->id) {
+        case HttpHeader::Connection:
+        case HttpHeader::Host:
+        case HttpHeader::KeepAlive:
+        case HttpHeader::TE:
+        case HttpHeader::TransferEncoding:
+        case HttpHeader::Upgrade:
+            continue;   // connection-specific
+        default:
+            break;
+        }
+        std::string name(i->header);
+        toLowerCase(name);
+        if (name == "proxy-connection")
+            continue;
+        encoder.encode(block, name, i->value, isIndexed(name));
+    }
+
+    unsigned id = nextStreamId;
+    nextStreamId += 2;
+    std::string payload;
+    appendUnsigned(payload, 0, 4);  // depends on nothing
+    payload += static_cast<char>(getWeight(request->getPriority()));
+    size_t length = std::min(block.length(), maxFrameSize - payload.length());
+    payload.append(block, 0, length);
+    writeFrame(HEADERS, END_STREAM | PRIORITY_FLAG | (length == block.length() ? END_HEADERS : 0), id, payload);
+    for (size_t offset = length; offset < block.length(); offset += length) {
+        length = std::min(block.length() - offset, maxFrameSize);
+        writeFrame(CONTINUATION, (offset + length == block.length()) ? END_HEADERS : 0, id, block.substr(offset, length));
+    }
+
+    streams[id].reset(new Stream(request));
+    request->getTiming().requestStart = HttpTiming::now();
+    flush();
+    return true;
+}
+
+void Http2Session::cancel(const HttpRequestPtr& request)
+{
+    for (auto i = streams.begin(); i != streams.end(); ++i) {
+        if (i->second->request == request) {
+            writeReset(i->first, CANCEL);
+            streams.erase(i);
+            flush();
+            break;
+        }
+    }
+    // The request has been completed by HttpConnectionManager::abort().
+    HttpConnectionManager::getInstance().done(&connection, request, true);
+}
+
+void Http2Session::prioritize(const HttpRequestPtr& request)
+{
+    for (auto i = streams.begin(); i != streams.end(); ++i) {
+        if (i->second->request == request) {
+            std::string payload;
+            appendUnsigned(payload, 0, 4);
+            payload += static_cast<char>(getWeight(request->getPriority()));
+            writeFrame(PRIORITY, 0, i->first, payload);
+            flush();
+            return;
+        }
+    }
+}
+
+bool Http2Session::read()
+{
+    boost::asio::streambuf& response(connection.response);
+    while (FrameHeaderLength <= response.size()) {
+        const char* header = boost::asio::buffer_cast<const char*>(response.data());
+        size_t length = readUnsigned(header, 3);
+        if (DefaultMaxFrameSize < length) {
+            writeGoaway(FRAME_SIZE_ERROR);
+            break;
+        }
+        if (response.size() < FrameHeaderLength + length)
+            break;
+        unsigned char type = header[3];
+        unsigned char flags = header[4];
+        unsigned id = readUnsigned(header + 5, 4) & MaxWindowSize;
+
+        if (4 <= getLogLevel())
+            std::cerr << __func__ << " type " << static_cast<int>(type) << " flags " << static_cast<int>(flags) << " stream " << id << " length " << length << '\n';
+
+        bool ok;
+        if (!settled && type != SETTINGS)
+            ok = false;     // the server preface must start with SETTINGS
+        else if (headerStreamId && type != CONTINUATION)
+            ok = false;     // a header block must be contiguous
+        else
+            ok = readFrame(type, flags, id, header + FrameHeaderLength, length);
+        response.consume(FrameHeaderLength + length);
+        if (!ok)
+            writeGoaway(PROTOCOL_ERROR);
+        if (failed)
+            break;
+    }
+    if (unacknowledged && ConnectionWindowSize / 2 <= unacknowledged) {
+        writeWindowUpdate(0, unacknowledged);
+        unacknowledged = 0;
+    }
+    flush();
+    return !failed && (!goingAway || !streams.empty());
+}
+
+bool Http2Session::readFrame(unsigned char type, unsigned char flags, unsigned id, const char* payload, size_t length)
+{
+    switch (type) {
+    case DATA:
+        return readData(flags, id, payload, length);
+    case HEADERS:
+        return readHeaders(flags, id, payload, length);
+    case PRIORITY:
+        return id && length == 5;
+    case RST_STREAM:
+        return readReset(id, payload, length);
+    case SETTINGS:
+        return readSettings(flags, id, payload, length);
+    case PUSH_PROMISE:
+        return false;   // disabled by SETTINGS_ENABLE_PUSH
+    case PING:
+        if (id || length != 8)
+            return false;
+        if (!(flags & ACK))
+            writeFrame(PING, ACK, 0, std::string(payload, length));
+        return true;
+    case GOAWAY:
+        return readGoaway(payload, length);
+    case WINDOW_UPDATE:
+        // No request sends DATA frames, so the send windows do not matter.
+        return length == 4 && (readUnsigned(payload, 4) & MaxWindowSize);
+    case CONTINUATION:
+        return readContinuation(flags, id, payload, length);
+    default:
+        return true;    // unknown frame types are ignored
+    }
+}
+
+bool Http2Session::readSettings(unsigned char flags, unsigned id, const char* payload, size_t length)
+{
+    if (id || length % 6)
+        return false;
+    if (flags & ACK)
+        return length == 0;
+    settled = true;
+    for (const char* end = payload + length; payload < end; payload += 6) {
+        unsigned long value = readUnsigned(payload + 2, 4);
+        switch (readUnsigned(payload, 2)) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            encoder.setMaxSize(value);
+            break;
+        case SETTINGS_MAX_CONCURRENT_STREAMS:
+            HttpConnectionManager::getInstance().multiplex(&connection, std::min(static_cast<unsigned long>(DefaultMaxStreams), value));
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+            if (MaxWindowSize < value)
+                return false;
+            break;
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < DefaultMaxFrameSize || 0xffffff < value)
+                return false;
+            maxFrameSize = value;
+            break;
+        default:
+            break;
+        }
+    }
+    writeFrame(SETTINGS, ACK, 0, std::string());
+    return true;
+}
+
+bool Http2Session::readHeaders(unsigned char flags, unsigned id, const char* payload, size_t length)
+{
+    if (!id || !removePadding(flags, payload, length))
+        return false;
+    if (flags & PRIORITY_FLAG) {
+        if (length < 5)
+            return false;
+        payload += 5;
+        length -= 5;
+    }
+    headerBlock.assign(payload, length);
+    headerStreamId = id;
+    headerFlags = flags;
+    if (flags & END_HEADERS)
+        return endHeaders();
+    return true;
+}
+
+bool Http2Session::readContinuation(unsigned char flags, unsigned id, const char* payload, size_t length)
+{
+    if (!headerStreamId || id != headerStreamId)
+        return false;
+    if (HttpConnection::MaxHeadLength < headerBlock.length() + length)
+        return false;
+    headerBlock.append(payload, length);
+    if (flags & END_HEADERS)
+        return endHeaders();
+    return true;
+}
+
+// Processes the header block once it has been received as a whole. The
+// block is decoded even if its stream has been canceled so that the dynamic
+// table stays in sync with the server.
+bool Http2Session::endHeaders()
+{
+    unsigned id = headerStreamId;
+    headerStreamId = 0;
+    HttpHpackFieldList fields;
+    if (!decoder.decode(headerBlock.data(), headerBlock.data() + headerBlock.length(), fields)) {
+        writeGoaway(COMPRESSION_ERROR);
+        return true;
+    }
+    headerBlock.clear();
+
+    auto found = streams.find(id);
+    if (found == streams.end())
+        return true;
+    Stream* stream = found->second.get();
+
+    if (stream->responded) {
+        // Trailers are not used.
+        if (headerFlags & END_STREAM)
+            close(id, false);
+        return true;
+    }
+
+    HttpRequestPtr request = stream->request;
+    HttpTiming& timing(request->getTiming());
+    if (!timing.responseStart)
+        timing.responseStart = HttpTiming::now();
+
+    HttpResponseMessage& responseMessage = request->getResponseMessage();
+    if (!responseMessage.parse(fields)) {
+        writeReset(id, PROTOCOL_ERROR);
+        close(id, true);
+        return true;
+    }
+    if (responseMessage.getStatus() < 200)
+        return true;    // wait for the final response
+    stream->responded = true;
+
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << id << ": " << responseMessage.toString();
+
+    if (responseMessage.getStatus() != 304 && !startContent(stream)) {
+        writeReset(id, CANCEL);
+        close(id, true);
+        return true;
+    }
+    if (headerFlags & END_STREAM)
+        close(id, false);
+    return true;
+}
+
+bool Http2Session::readData(unsigned char flags, unsigned id, const char* payload, size_t length)
+{
+    if (!id)
+        return false;
+    // The padding is also subject to the flow control of both the
+    // connection and the stream.
+    size_t frameLength = length;
+    unacknowledged += frameLength;
+    if (!removePadding(flags, payload, length))
+        return false;
+
+    auto found = streams.find(id);
+    if (found == streams.end())
+        return true;    // canceled
+    Stream* stream = found->second.get();
+    if (!stream->responded)
+        return false;
+    stream->unacknowledged += frameLength;
+    if (stream->started && length && !writeContent(stream, payload, length)) {
+        writeReset(id, CANCEL);
+        close(id, true);
+        return true;
+    }
+    if (flags & END_STREAM) {
+        close(id, false);
+        return true;
+    }
+    if (StreamWindowSize / 2 <= stream->unacknowledged) {
+        writeWindowUpdate(id, stream->unacknowledged);
+        stream->unacknowledged = 0;
+    }
+    return true;
+}
+
+bool Http2Session::readReset(unsigned id, const char* payload, size_t length)
+{
+    if (!id || length != 4)
+        return false;
+    auto found = streams.find(id);
+    if (found == streams.end())
+        return true;
+    unsigned long errorCode = readUnsigned(payload, 4);
+
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << id << ' ' << errorCode << '\n';
+
+    if (errorCode == REFUSED_STREAM && !found->second->responded)
+        refuse(id);
+    else
+        close(id, true);
+    return true;
+}
+
+bool Http2Session::readGoaway(const char* payload, size_t length)
+{
+    if (length < 8)
+        return false;
+    lastStreamId = readUnsigned(payload, 4) & MaxWindowSize;
+
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << lastStreamId << ' ' << readUnsigned(payload + 4, 4) << '\n';
+
+    goingAway = true;
+    HttpConnectionManager::getInstance().multiplex(&connection, 0);
+    // The streams after lastStreamId have not been processed at all.
+    for (auto i = streams.upper_bound(lastStreamId); i != streams.end();)
+        refuse((i++)->first);
+    return true;
+}
+
+bool Http2Session::startContent(Stream* stream)
+{
+    HttpRequestPtr& request(stream->request);
+    if (!request->startContent())
+        return false;
+    HttpResponseMessage& responseMessage = request->getResponseMessage();
+    if (responseMessage.getContentEncoding() != HttpResponseMessage::Identity &&
+        request->getRequestMessage().getMethodCode() != HttpRequestMessage::HEAD)
+        stream->decoder.start(responseMessage.getContentEncoding());   // an unknown coding is kept as it is
+    stream->started = true;
+    return true;
+}
+
+bool Http2Session::writeContent(Stream* stream, const char* data, size_t length)
+{
+    std::ostream& content = stream->request->getContent();
+    if (!content)
+        return false;
+    if (!stream->decoder.isActive())
+        content.write(data, length);
+    else if (!stream->decoder.write(content, data, length))
+        return false;
+    stream->octetCount += length;
+    stream->request->progress();
+    return true;
+}
+
+// cf. HttpConnection::endContent()
+void Http2Session::endContent(Stream* stream)
+{
+    HttpResponseMessage& responseMessage = stream->request->getResponseMessage();
+    if (stream->decoder.isActive()) {
+        responseMessage.clearContentEncoding();
+        responseMessage.setContentLength(stream->decoder.getDecodedLength());
+        stream->decoder.end();
+    } else if (!responseMessage.hasContentLengthHeader() &&
+               stream->request->getRequestMessage().getMethodCode() != HttpRequestMessage::HEAD)
+        responseMessage.setContentLength(stream->octetCount);
+}
+
+// Closes the stream, and completes its request.
+void Http2Session::close(unsigned id, bool error)
+{
+    auto found = streams.find(id);
+    if (found == streams.end())
+        return;
+    std::unique_ptr<Stream> stream(std::move(found->second));
+    streams.erase(found);
+    if (stream->started) {
+        HttpResponseMessage& responseMessage = stream->request->getResponseMessage();
+        if (!error && responseMessage.hasContentLengthHeader() && stream->octetCount < responseMessage.getContentLength() &&
+            stream->request->getRequestMessage().getMethodCode() != HttpRequestMessage::HEAD)
+            error = true;   // keep it undecoded so that HttpCache can resume it
+        if (!error)
+            endContent(stream.get());
+        stream->request->getContent().flush();
+    }
+    if (!error)
+        ++completedCount;
+    HttpConnectionManager::getInstance().done(&connection, stream->request, error);
+}
+
+// Sends the request of the stream again, which has not been processed by
+// the server.
+void Http2Session::refuse(unsigned id)
+{
+    auto found = streams.find(id);
+    if (found == streams.end())
+        return;
+    HttpRequestPtr request = found->second->request;
+    streams.erase(found);
+    HttpConnectionManager::getInstance().resend(&connection, request);
+}
+
+void Http2Session::abort()
+{
+    while (!streams.empty()) {
+        auto i = streams.begin();
+        if (!i->second->responded && completedCount)
+            refuse(i->first);
+        else
+            close(i->first, true);
+    }
+}
+
+}}}}  // org::w3c::dom::bootstrap
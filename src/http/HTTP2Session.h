@@ -0,0 +1,193 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTTP2_SESSION_H
+#define ES_HTTP2_SESSION_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "http/HTTPContentDecoder.h"
+#include "http/HTTPHpack.h"
+#include "http/HTTPRequest.h"
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+class HttpConnection;
+
+// Http2Session multiplexes the requests to an origin over a single TLS
+// connection that has negotiated "h2" by ALPN, cf. RFC 7540. It is owned by
+// HttpConnection, and every method of it is called through the strand of
+// the connection. The frames are read from and written to the stream
+// buffers of the connection.
+class Http2Session
+{
+    // frame types
+    enum {
+        DATA,
+        HEADERS,
+        PRIORITY,
+        RST_STREAM,
+        SETTINGS,
+        PUSH_PROMISE,
+        PING,
+        GOAWAY,
+        WINDOW_UPDATE,
+        CONTINUATION
+    };
+
+    // flags
+    static const unsigned char END_STREAM = 0x1;
+    static const unsigned char ACK = 0x1;
+    static const unsigned char END_HEADERS = 0x4;
+    static const unsigned char PADDED = 0x8;
+    static const unsigned char PRIORITY_FLAG = 0x20;
+
+    // settings
+    enum {
+        SETTINGS_HEADER_TABLE_SIZE = 1,
+        SETTINGS_ENABLE_PUSH,
+        SETTINGS_MAX_CONCURRENT_STREAMS,
+        SETTINGS_INITIAL_WINDOW_SIZE,
+        SETTINGS_MAX_FRAME_SIZE,
+        SETTINGS_MAX_HEADER_LIST_SIZE
+    };
+
+    // error codes
+    enum {
+        NO_ERROR,
+        PROTOCOL_ERROR,
+        INTERNAL_ERROR,
+        FLOW_CONTROL_ERROR,
+        SETTINGS_TIMEOUT,
+        STREAM_CLOSED,
+        FRAME_SIZE_ERROR,
+        REFUSED_STREAM,
+        CANCEL,
+        COMPRESSION_ERROR
+    };
+
+    static const size_t FrameHeaderLength = 9;
+    static const size_t DefaultMaxFrameSize = 16384;
+    static const unsigned long MaxWindowSize = 0x7fffffff;
+    // The receive windows are enlarged from 64 KiB so that a large response
+    // is not throttled by the round trips of WINDOW_UPDATE.
+    static const unsigned long StreamWindowSize = 4 * 1024 * 1024;
+    static const unsigned long ConnectionWindowSize = 16 * 1024 * 1024;
+
+    struct Stream
+    {
+        HttpRequestPtr request;
+        HttpContentDecoder decoder;
+        bool responded;     // the final response headers have been received
+        bool started;       // the entity-body is being written to the request
+        unsigned long long octetCount;
+        unsigned long unacknowledged;  // received but not yet given back by WINDOW_UPDATE
+
+        explicit Stream(const HttpRequestPtr& request) :
+            request(request),
+            responded(false),
+            started(false),
+            octetCount(0),
+            unacknowledged(0)
+        {
+        }
+    };
+
+    HttpConnection& connection;
+    std::map<unsigned, std::unique_ptr<Stream>> streams;
+    HttpHpackEncoder encoder;
+    HttpHpackDecoder decoder;
+
+    unsigned nextStreamId;
+    unsigned lastStreamId;      // the last stream processed by the peer if going away
+    unsigned completedCount;    // the number of the streams completed so far
+    size_t maxFrameSize;        // SETTINGS_MAX_FRAME_SIZE of the peer
+    unsigned long unacknowledged;  // received on the connection but not yet given back
+
+    bool settled;       // the first SETTINGS frame from the peer has been received
+    bool goingAway;     // GOAWAY has been either sent or received
+    bool failed;        // GOAWAY has been sent upon a connection error
+    bool writing;
+    std::string output; // frames waiting for the write in progress
+
+    // The header block being received in HEADERS and CONTINUATION frames.
+    std::string headerBlock;
+    unsigned headerStreamId;
+    unsigned char headerFlags;
+
+    void writeFrame(unsigned char type, unsigned char flags, unsigned id, const std::string& payload);
+    void writeSettings();
+    void writeWindowUpdate(unsigned id, unsigned long increment);
+    void writeReset(unsigned id, unsigned long errorCode);
+    void writeGoaway(unsigned long errorCode);
+    void flush();
+
+    bool readFrame(unsigned char type, unsigned char flags, unsigned id, const char* payload, size_t length);
+    bool readSettings(unsigned char flags, unsigned id, const char* payload, size_t length);
+    bool readHeaders(unsigned char flags, unsigned id, const char* payload, size_t length);
+    bool readContinuation(unsigned char flags, unsigned id, const char* payload, size_t length);
+    bool readData(unsigned char flags, unsigned id, const char* payload, size_t length);
+    bool readReset(unsigned id, const char* payload, size_t length);
+    bool readGoaway(const char* payload, size_t length);
+    bool endHeaders();
+
+    bool startContent(Stream* stream);
+    bool writeContent(Stream* stream, const char* data, size_t length);
+    void endContent(Stream* stream);
+    void close(unsigned id, bool error);
+    void refuse(unsigned id);
+
+    static unsigned char getWeight(unsigned short priority);
+    static bool isIndexed(const std::string& name);
+
+public:
+    static const unsigned DefaultMaxStreams = 100;
+
+    explicit Http2Session(HttpConnection& connection);
+
+    // Sends the connection preface.
+    void start();
+    // Opens a new stream for the request. Returns false if the session
+    // cannot take a new stream any more.
+    bool open(const HttpRequestPtr& request);
+    // Resets the stream of the request aborted by HttpConnectionManager.
+    void cancel(const HttpRequestPtr& request);
+    void prioritize(const HttpRequestPtr& request);
+
+    // Processes the frames received in the response buffer of the connection.
+    // Returns false if the connection has to be closed.
+    bool read();
+    // Called once the write in progress has been completed. Returns false if
+    // the connection has to be closed.
+    bool written();
+    bool isWriting() const {
+        return writing;
+    }
+    // Called as the connection is being closed. The streams without any
+    // response are sent again over another connection if this session has
+    // proven to work; the others fail.
+    void abort();
+
+    size_t getStreamCount() const {
+        return streams.size();
+    }
+};
+
+}}}}  // org::w3c::dom::bootstrap
+
+#endif  // ES_HTTP2_SESSION_H
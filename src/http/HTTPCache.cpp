@@ -17,9 +17,16 @@
 #include "HTTPCache.h"
 
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <iostream>
+#include <set>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "url/URI.h"
 #include "http/HTTPConnection.h"
@@ -31,25 +38,65 @@
 
 namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
+namespace {
+
+const char* const IndexSignature = "escudo-cache 1";
+
+// Returns a pointer to the beginning of the next line, or end.
+const char* getLine(const char* start, const char* const end, std::string& line)
+{
+    const char* eol = std::find(start, end, '\n');
+    line.assign(start, eol);
+    return (eol < end) ? eol + 1 : end;
+}
+
+}
+
 void HttpCache::notify(HttpRequest* request, bool error)
 {
     current = 0;
 
-    if (error)
+    if (error && request->isTruncated()) {
+        // Keep the partial entity-body so that it can be resumed by the
+        // waiting request or by a later one.
+        if (!range) {
+            response.clear();
+            response.update(request->getResponseMessage());
+        }
+        setBodyFile(request->getBodyFile());
+        body = request->getBody();
+        range = true;
+        HttpCacheManager::getInstance().update(this);
+        if (!requests.empty()) {
+            HttpRequestPtr pending = requests.front();
+            requests.pop_front();
+            send(pending);
+        }
+        return;
+    }
+
+    if (error) {
+        // The partial entity-body handed over to the request is no longer needed.
+        if (range)
+            request->removeFile();
         invalidate();
-    else {
+    } else {
         response.update(request->getResponseMessage());
-        // TODO: deal with partial...
         unsigned short status = request->getResponseMessage().getStatus();
         if (status == 304) {  // Not Modified?
             request->removeFile();
             request->constructResponseFromCache(false);
         } else {
-            if (!filePath.empty() && filePath != request->getFilePath())
-                remove(filePath.c_str());
+            // The old entity-body is removed once the requests served
+            // from it while stale have released it.
             response.updateStatus(request->getResponseMessage());
-            filePath = request->getFilePath();
+            setBodyFile(request->getBodyFile());
+            body = request->getBody();
+            range = false;
         }
+        // The entry is as fresh as the response that has just validated it.
+        requestTime = sentTime;
+        HttpCacheManager::getInstance().update(this);
     }
 
     while (!requests.empty()) {
@@ -71,24 +118,29 @@ void HttpCache::notify(HttpRequest* request, bool error)
 void HttpCache::invalidate()
 {
     response.clear();
-    contentLength = 0;
-    if (!filePath.empty()) {
-        remove(filePath.c_str());
-        filePath.clear();
-    }
+    setBodyFile(0);
+    body.reset();
     requestTime = 0;
+    range = false;
+    HttpCacheManager::getInstance().update(this);
 }
 
 HttpCache* HttpCache::send(const HttpRequestPtr& request)
 {
     if (current) {
+        // The request in flight should be served no later than the waiting one.
+        if (request->getPriority() < current->getPriority())
+            current->setPriority(request->getPriority());
         requests.push_back(request);
         return this;
     }
     current = request;
+    sentTime = time(0);
 
     if (!requestTime)
-        requestTime = time(0);
+        requestTime = sentTime;
+    else if (range)
+        resume(request);
     else {
         // Validate
         // by If-Modified-Since
@@ -113,6 +165,29 @@ HttpCache* HttpCache::send(const HttpRequestPtr& request)
     return this;
 }
 
+// Hands the partial entity-body over to the request, which asks only for the
+// rest of it. With If-Range, the server sends the whole entity-body instead
+// if the entity has been modified since.
+void HttpCache::resume(const HttpRequestPtr& request)
+{
+    std::string validator = response.getIfRangeValue();
+    unsigned long long offset = 0;
+    if (!validator.empty() && request->getRequestMessage().getMethodCode() == HttpRequestMessage::GET)
+        offset = request->resume(bodyFile, body);
+    if (offset) {
+        HttpRequestMessage& requestMessage(request->getRequestMessage());
+        requestMessage.setHeader("Range", "bytes=" + boost::lexical_cast<std::string>(offset) + '-');
+        requestMessage.setHeader("If-Range", validator);
+        // The range has to be appended to the stored entity-body as it is.
+        requestMessage.eraseHeader("Accept-Encoding");
+        requestMessage.setHeader("Accept-Encoding", "identity");
+    } else
+        range = false;
+    setBodyFile(0);     // now owned by the request if resumed
+    body.reset();
+    HttpCacheManager::getInstance().update(this);
+}
+
 bool HttpCache::abort(const HttpRequestPtr& request)
 {
     if (current != request) {
@@ -122,19 +197,326 @@ bool HttpCache::abort(const HttpRequestPtr& request)
     return false;
 }
 
-HttpCache* HttpCacheManager::getCache(const URL& url)
+HttpCacheManager::HttpCacheManager() :
+    maxEntries(DefaultMaxEntries),
+    hits(0),
+    misses(0),
+    evictions(0),
+    staleHits(0),
+    sizeLimit(DefaultSizeLimit),
+    totalSize(0),
+    openTime(0),
+    saveTime(0),
+    loaded(false),
+    dirty(false)
+{
+}
+
+void HttpCacheManager::open(const std::string& path)
+{
+    cachePath = path;
+    while (1 < cachePath.length() && cachePath[cachePath.length() - 1] == '/')
+        cachePath.erase(cachePath.length() - 1);
+    openTime = time(0);
+    loaded = false;
+}
+
+void HttpCacheManager::setSizeLimit(unsigned long long size)
+{
+    sizeLimit = size;
+    evict();
+}
+
+void HttpCacheManager::setMaxEntries(unsigned count)
+{
+    maxEntries = std::max(1u, count);
+    evict();
+}
+
+namespace {
+
+std::string getOrigin(const URL& url)
+{
+    URI uri(url);
+    return uri.getProtocol() + "//" + uri.getHostname() + ':' + uri.getPort();
+}
+
+}
+
+unsigned HttpCacheManager::getStaleWhileRevalidate(const URL& url) const
+{
+    auto found = staleWindows.find(getOrigin(url));
+    return (found != staleWindows.end()) ? found->second : 0;
+}
+
+void HttpCacheManager::setStaleWhileRevalidate(const URL& url, unsigned seconds)
+{
+    if (seconds)
+        staleWindows[getOrigin(url)] = seconds;
+    else
+        staleWindows.erase(getOrigin(url));
+}
+
+bool HttpCacheManager::isPersistent(const HttpCache* cache) const
+{
+    if (!cache->requestTime)
+        return false;
+    if (cache->filePath.empty()) {
+        if (!cache->body)
+            return false;
+    } else if (cache->filePath.compare(0, cachePath.length() + 1, cachePath + '/') != 0)
+        return false;
+    const HttpResponseMessage& response(cache->response);
+    // A partial entity-body is told by its length shorter than Content-Length.
+    if (cache->range && !response.hasContentLengthHeader())
+        return false;
+    return 10 <= response.getVersion() && response.isCacheable() && !response.isNoStore() && !response.getAllResponseHeaders().empty();
+}
+
+// Writes the entity-body kept in memory into a file so that it can be listed
+// in the index.
+bool HttpCacheManager::store(HttpCache* cache)
+{
+    if (!cache->filePath.empty())
+        return true;
+    if (!cache->body)
+        return false;
+    std::string tempPath = cachePath + "/esrille-XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd == -1)
+        return false;
+    const std::string& body(*cache->body);
+    bool stored = write(fd, body.data(), body.length()) == static_cast<ssize_t>(body.length());
+    close(fd);
+    if (!stored) {
+        ::remove(tempPath.c_str());
+        return false;
+    }
+    cache->setBodyFile(std::make_shared<HttpBodyFile>(tempPath));
+    return true;
+}
+
+// The index consists of the signature line followed by one record per entry:
+//   URL LF file-name LF request-time LF status-line *(header CRLF) CRLF
+// Records are written from the most recently used entry.
+void HttpCacheManager::load()
+{
+    loaded = true;
+    if (cachePath.empty())
+        return;
+
+    std::string index;
+    int fd = ::open(getIndexPath().c_str(), O_RDONLY);
+    if (fd != -1) {
+        char buffer[4096];
+        ssize_t length;
+        while (0 < (length = read(fd, buffer, sizeof buffer)))
+            index.append(buffer, length);
+        close(fd);
+    }
+
+    const char* start = index.c_str();
+    const char* const end = start + index.length();
+    std::string line;
+    start = getLine(start, end, line);
+    if (line == IndexSignature) {
+        while (start < end) {
+            std::string url;
+            std::string name;
+            start = getLine(start, end, url);
+            start = getLine(start, end, name);
+            start = getLine(start, end, line);
+            long long requestTime = 0;
+            try {
+                requestTime = boost::lexical_cast<long long>(line);
+            } catch (...) {
+                break;
+            }
+            HttpResponseMessage response;
+            const char* next = response.parse(start, end);
+            if (!next)
+                break;
+            start = next + 1;
+
+            // Skip the record if its body has been lost.
+            std::string filePath = cachePath + '/' + name;
+            struct stat status;
+            if (name.empty() || name.find('/') != std::string::npos ||
+                stat(filePath.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+                continue;
+            URL key(utfconv(url));
+            if (key.isEmpty() || table.count(key))
+                continue;
+            HttpCache* cache = new(std::nothrow) HttpCache(key);
+            if (!cache)
+                break;
+            cache->response = response;
+            cache->setBodyFile(std::make_shared<HttpBodyFile>(filePath));
+            cache->requestTime = requestTime;
+            cache->contentLength = status.st_size;
+            cache->range = response.hasContentLengthHeader() && cache->contentLength < response.getContentLength();
+            totalSize += cache->contentLength;
+            table[key] = lru.insert(lru.end(), cache);
+        }
+    }
+    removeOrphans();
+    evict();
+}
+
+// Removes the body files that are not referenced from the index. Files
+// created in this session are left untouched as they might still be used.
+void HttpCacheManager::removeOrphans()
 {
+    std::set<std::string> names;
+    for (auto i = lru.begin(); i != lru.end(); ++i) {
+        if (!(*i)->filePath.empty())
+            names.insert((*i)->filePath.substr(cachePath.length() + 1));
+    }
+    DIR* dir = opendir(cachePath.c_str());
+    if (!dir)
+        return;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "esrille-", 8) != 0 || names.count(entry->d_name))
+            continue;
+        std::string filePath = cachePath + '/' + entry->d_name;
+        struct stat status;
+        if (stat(filePath.c_str(), &status) == 0 && S_ISREG(status.st_mode) && status.st_mtime < openTime)
+            ::remove(filePath.c_str());
+    }
+    closedir(dir);
+}
+
+// Writes the index into a temporary file first and then renames it so that
+// the index on the disk is always consistent even if the browser crashes.
+bool HttpCacheManager::writeIndex(const std::string& indexPath, const std::string& index)
+{
+    std::string tempPath = indexPath + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return false;
+    const char* data = index.c_str();
+    size_t length = index.length();
+    while (0 < length) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0)
+            break;
+        data += written;
+        length -= written;
+    }
+    if (length != 0 || fsync(fd) != 0) {
+        close(fd);
+        ::remove(tempPath.c_str());
+        return false;
+    }
+    close(fd);
+    if (rename(tempPath.c_str(), indexPath.c_str()) != 0) {
+        ::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Runs on an HTTP service thread. Only the latest index handed over by save()
+// is written; the ones it has replaced are simply dropped.
+void HttpCacheManager::writePendingIndex()
+{
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    std::string indexPath;
+    std::string index;
+    {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        indexPath.swap(pendingIndexPath);
+        index.swap(pendingIndex);
+    }
+    if (!index.empty())
+        writeIndex(indexPath, index);
+}
+
+// Builds the index on the main thread and lets an HTTP service thread write
+// it, as fsync() can take a while. With sync, the index is written right away.
+void HttpCacheManager::save(bool sync)
+{
+    if (cachePath.empty() || !loaded)
+        return;
+
+    std::string index(IndexSignature);
+    index += '\n';
     for (auto i = lru.begin(); i != lru.end(); ++i) {
         HttpCache* cache = *i;
-        if (cache->url == url) {
-            lru.erase(i);
-            lru.push_front(cache);
-            return cache;
+        if (!isPersistent(cache) || !store(cache))
+            continue;
+        index += utfconv(static_cast<const std::u16string&>(cache->url)) + '\n';
+        index += cache->filePath.substr(cachePath.length() + 1) + '\n';
+        index += boost::lexical_cast<std::string>(cache->requestTime) + '\n';
+        index += cache->response.toString() + "\r\n";
+    }
+
+    if (sync) {
+        std::lock_guard<std::mutex> writeLock(writeMutex);
+        {
+            // The index waiting to be written is older than this one.
+            std::lock_guard<std::mutex> lock(indexMutex);
+            pendingIndexPath.clear();
+            pendingIndex.clear();
         }
+        if (!writeIndex(getIndexPath(), index))
+            return;
+    } else {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        bool posted = !pendingIndex.empty();
+        pendingIndexPath = getIndexPath();
+        pendingIndex.swap(index);
+        if (!posted)
+            HttpConnectionManager::getIOService().post(boost::bind(&HttpCacheManager::writePendingIndex, this));
+    }
+    dirty = false;
+    saveTime = time(0);
+}
+
+void HttpCacheManager::flush()
+{
+    if (dirty)
+        save(true);
+    else
+        writePendingIndex();    // in case no service thread has written it yet
+}
+
+// Discards the least recently used entries until the total size of the
+// stored entity-bodies fits in sizeLimit and the number of the entries
+// fits in maxEntries. Entries in use are never discarded.
+void HttpCacheManager::evict(const HttpCache* keep)
+{
+    for (auto i = lru.rbegin(); i != lru.rend() && (sizeLimit < totalSize || maxEntries < lru.size());) {
+        HttpCache* cache = *i;
+        if (cache == keep || cache->isBusy() || !cache->requests.empty() ||
+            (!cache->contentLength && lru.size() <= maxEntries)) {
+            ++i;
+            continue;
+        }
+        table.erase(cache->url);
+        i = CacheList::reverse_iterator(lru.erase(std::next(i).base()));
+        totalSize -= cache->contentLength;
+        delete cache;
+        ++evictions;
+        dirty = true;
+    }
+}
+
+HttpCache* HttpCacheManager::getCache(const URL& url)
+{
+    if (!loaded)
+        load();
+    auto found = table.find(url);
+    if (found != table.end()) {
+        lru.splice(lru.begin(), lru, found->second);
+        return *found->second;
     }
     HttpCache* cache = new(std::nothrow) HttpCache(url);
-    if (cache)
-        lru.push_front(cache);
+    if (!cache)
+        return 0;
+    lru.push_front(cache);
+    table[url] = lru.begin();
+    evict(cache);
     return cache;
 }
 
@@ -148,13 +530,31 @@ HttpCache* HttpCacheManager::send(const HttpRequestPtr& request)
             return 0;
 
         int code = message.getMethodCode();
-        if (code == HttpRequestMessage::GET || code == HttpRequestMessage::HEAD) {
-            if (cache->response.isCacheable() && cache->response.isFresh(cache->requestTime)) {
+        // A range requested by the page is not stored.
+        if ((code == HttpRequestMessage::GET || code == HttpRequestMessage::HEAD) && !message.hasHeader("Range")) {
+            if (!cache->range && cache->response.isCacheable() && cache->response.isFresh(cache->requestTime)) {
                 if (request->redirect(cache->response))
                     continue;
-                if (code == HttpRequestMessage::HEAD || !cache->filePath.empty())
+                if (code == HttpRequestMessage::HEAD || !cache->filePath.empty() || cache->body) {
+                    ++cache->hitCount;
+                    ++hits;
+                    request->getTiming().cached = true;
                     return cache;
+                }
+            }
+            if (code == HttpRequestMessage::GET && isStaleWhileRevalidate(cache)) {
+                // Serve the stale entry right away, and bring it up to date
+                // for the next request.
+                ++cache->hitCount;
+                ++hits;
+                ++staleHits;
+                request->getTiming().cached = true;
+                revalidate(cache);
+                request->cache = cache;
+                request->constructResponseFromCache(false);
+                return 0;
             }
+            ++misses;
             return cache->send(request);
         }
         break;
@@ -168,9 +568,64 @@ HttpCache* HttpCacheManager::send(const HttpRequestPtr& request)
     return 0;
 }
 
+bool HttpCacheManager::isStaleWhileRevalidate(const HttpCache* cache) const
+{
+    if (!cache->requestTime || cache->range || (cache->filePath.empty() && !cache->body))
+        return false;
+    const HttpResponseMessage& response(cache->response);
+    if (!response.isCacheable() || response.shouldRedirect())
+        return false;
+    return response.isStaleWhileRevalidate(cache->requestTime, getStaleWhileRevalidate(cache->url));
+}
+
+// Sends a conditional request of the cache entry's own unless the entry is
+// already being validated. The response updates the entry through
+// HttpCache::notify() like the one for any other request.
+void HttpCacheManager::revalidate(HttpCache* cache)
+{
+    if (cache->isBusy())
+        return;
+    HttpRequestPtr request(std::make_shared<HttpRequest>());
+    request->open(u"GET", cache->url);
+    request->priority = HttpRequest::PREFETCH;
+    request->cache = cache;
+    cache->send(request);
+}
+
+// Called when the stored entity-body or the response headers of the cache
+// entry have been changed.
+void HttpCacheManager::update(HttpCache* cache)
+{
+    unsigned long long size = 0;
+    struct stat status;
+    if (!cache->filePath.empty()) {
+        if (stat(cache->filePath.c_str(), &status) == 0)
+            size = status.st_size;
+    } else if (cache->body)
+        size = cache->body->length();
+    totalSize = totalSize - cache->contentLength + size;
+    cache->contentLength = size;
+
+    // Keep the updated entry at least until its pending requests are served.
+    evict(cache);
+
+    if (!cachePath.empty()) {
+        dirty = true;
+        if (SaveInterval <= time(0) - saveTime)
+            save();
+    }
+}
+
 void HttpCacheManager::remove(HttpCache* cache)
 {
-    lru.remove(cache);
+    auto found = table.find(cache->url);
+    if (found == table.end() || *found->second != cache)
+        return;
+    lru.erase(found->second);
+    table.erase(found);
+    totalSize -= cache->contentLength;
+    cache->contentLength = 0;
+    dirty = true;
 }
 
 void HttpCacheManager::dump() {
@@ -178,12 +633,23 @@ void HttpCacheManager::dump() {
         HttpCache* cache = *i;
         std::cout << static_cast<std::u16string>(cache->url) << ' ' << cache->response.getStatus() << ' ' << cache->filePath << '\n';
     }
+    std::cout << "entries: " << lru.size() << '/' << maxEntries << " size: " << totalSize << '/' << sizeLimit << '\n';
+    std::cout << "hits: " << hits << " (stale: " << staleHits << ") misses: " << misses << " evictions: " << evictions << '\n';
 }
 
 HttpCacheManager::~HttpCacheManager()
 {
+    flush();
     while (!lru.empty()) {
         HttpCache* cache = lru.front();
+        // Keep the entity-bodies listed in the index for the next session.
+        if (!cachePath.empty() && isPersistent(cache) && cache->bodyFile)
+            cache->bodyFile->keep();
+        // A background revalidation can still be in flight at exit.
+        if (cache->current)
+            cache->current->cache = 0;
+        for (auto i = cache->requests.begin(); i != cache->requests.end(); ++i)
+            (*i)->cache = 0;
         remove(cache);
         delete cache;
     }
@@ -19,6 +19,9 @@
 
 #include <fstream>
 #include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include "http/HTTPRequest.h"
 
@@ -33,11 +36,14 @@ class HttpCache
     unsigned long long contentLength;
 
     std::string filePath;
+    HttpBodyFilePtr bodyFile;           // removes filePath once no request refers to it
+    std::shared_ptr<std::string> body;  // shared with the requests when kept in memory
 
     long long requestTime;
+    long long sentTime;     // when current has been sent
 
     std::string etag;
-    bool range;
+    bool range;     // the stored entity-body is partial
     bool mustRevalidate;
     int hitCount;
 
@@ -45,6 +51,14 @@ class HttpCache
     HttpRequestPtr current;
 
     HttpCache* send(const HttpRequestPtr& request);
+    void resume(const HttpRequestPtr& request);
+    void setBodyFile(const HttpBodyFilePtr& file) {
+        bodyFile = file;
+        if (file)
+            filePath = file->getPath();
+        else
+            filePath.clear();
+    }
 
 public:
 
@@ -55,6 +69,12 @@ public:
     const std::string& getFilePath() const {
         return filePath;
     }
+    const HttpBodyFilePtr& getBodyFile() const {
+        return bodyFile;
+    }
+    const std::shared_ptr<std::string>& getBody() const {
+        return body;
+    }
 
     void notify(HttpRequest* request, bool error);
 
@@ -70,28 +90,93 @@ public:
         url(url),
         contentLength(0),
         requestTime(0),
+        sentTime(0),
         range(false),
         mustRevalidate(false),
         hitCount(0),
         current(0)
     {
     }
-
-    ~HttpCache()
-    {
-        if (!filePath.empty())
-            remove(filePath.c_str());
-    }
 };
 
 class HttpCacheManager
 {
-    std::list<HttpCache*> lru;
+    static const int SaveInterval = 5;  // in seconds
+
+    typedef std::list<HttpCache*> CacheList;
+
+    CacheList lru;
+    std::unordered_map<std::u16string, CacheList::iterator> table;
+    unsigned maxEntries;
+
+    // stale-while-revalidate windows in seconds assumed for the origins
+    // whose responses do not specify one
+    std::unordered_map<std::string, unsigned> staleWindows;
+
+    // statistics
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long staleHits;
+
+    // persistent cache
+    std::string cachePath;  // empty unless the cache is persistent
+    unsigned long long sizeLimit;
+    unsigned long long totalSize;
+    long long openTime;
+    long long saveTime;
+    bool loaded;
+    bool dirty;
+
+    // the index handed over to an HTTP service thread to be written
+    std::mutex indexMutex;
+    std::string pendingIndexPath;
+    std::string pendingIndex;
+    std::mutex writeMutex;  // serializes the writes of the index
+
+    std::string getIndexPath() const {
+        return cachePath + "/index";
+    }
+    bool isPersistent(const HttpCache* cache) const;
+    bool store(HttpCache* cache);
+    void load();
+    static bool writeIndex(const std::string& indexPath, const std::string& index);
+    void writePendingIndex();
+    void save(bool sync = false);
+    void removeOrphans();
+    void evict(const HttpCache* keep = 0);
+    bool isStaleWhileRevalidate(const HttpCache* cache) const;
+    void revalidate(HttpCache* cache);
+
 public:
+    static const unsigned long long DefaultSizeLimit = 64ull * 1024 * 1024;
+    static const unsigned DefaultMaxEntries = 4096;
+
+    HttpCacheManager();
     ~HttpCacheManager();
 
+    // Keeps the cache entries in the specified directory across sessions.
+    // The index is read upon the first request.
+    void open(const std::string& path);
+    void flush();
+
+    unsigned long long getSizeLimit() const {
+        return sizeLimit;
+    }
+    void setSizeLimit(unsigned long long size);
+    unsigned getMaxEntries() const {
+        return maxEntries;
+    }
+    void setMaxEntries(unsigned count);
+    // Lets the stale responses from the origin of url be served for up to
+    // the specified seconds while they are revalidated in the background.
+    // A stale-while-revalidate directive in the response takes precedence.
+    unsigned getStaleWhileRevalidate(const URL& url) const;
+    void setStaleWhileRevalidate(const URL& url, unsigned seconds);
+
     HttpCache* getCache(const URL& url);
     HttpCache* send(const HttpRequestPtr& request);
+    void update(HttpCache* cache);
     void remove(HttpCache* cache);
 
     void dump();
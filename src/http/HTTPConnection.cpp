@@ -29,37 +29,135 @@ namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
 using namespace http;
 
+namespace {
+
+// Returns the end of the header block, i.e., the position next to the empty
+// line, or zero if the block has not been received yet. offset keeps the
+// position to resume scanning from the next time.
+const char* findEndOfHead(const char* start, const char* const end, size_t& offset)
+{
+    const char* p = start + offset;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol)
+            break;
+        const char* next = eol + 1;
+        if (next < end && *next == '\r')
+            ++next;
+        if (end <= next) {
+            offset = eol - start;
+            return 0;
+        }
+        if (*next == '\n')
+            return next + 1;
+        p = eol + 1;
+    }
+    offset = end - start;
+    return 0;
+}
+
+}
+
+const unsigned HttpConnectionManager::DefaultMaxConnectionsPerHost;
+const unsigned HttpConnectionManager::DefaultMaxConnections;
+const unsigned HttpConnectionManager::DefaultIdleTimeout;
+const unsigned HttpConnectionManager::DefaultMaxPreconnections;
+const unsigned HttpConnectionManager::DefaultPreconnectTimeout;
+const unsigned HttpConnectionManager::MaxThreadCount;
+
+const int HttpConnection::MaxRetryCount;
+const size_t HttpConnection::MaxHeadLength;
+
 const char* HttpConnection::States[] = {
     "Closed",
     "Resolving",
     "Resolved",
     "Connected",
     "Handshaking",
-    "ReadStatusLine",
     "ReadHead",
     "ReadContent",
     "ReadChunk",
     "ReadTrailer",
-    "CloseWait"
+    "CloseWait",
+    "Multiplexed"
 };
 
 HttpConnection::HttpConnection(const std::string& protocol, const std::string& hostname, const std::string& port) :
     state(Closed),
     retryCount(0),
+    headScanned(0),
     protocol(protocol),
     hostname(hostname),
     port(port),
+    origin(hostname + ':' + port),
+    strand(HttpConnectionManager::getIOService()),
     socket(HttpConnectionManager::getIOService()),
-    context(boost::asio::ssl::context::sslv23),
-    secureSocket(socket, context),
-    current(0)
+    open(false),
+    idleTimer(HttpConnectionManager::getIOService()),
+    current(0),
+    speculative(false),
+    maxStreams(0),
+    multiplexed(false)
+{
+}
+
+bool HttpConnection::startSecureSession()
 {
-    if (protocol == "https:") {
-        context.set_options(boost::asio::ssl::context::no_sslv2);
-        context.set_default_verify_paths();
-        secureSocket.set_verify_mode(boost::asio::ssl::verify_peer);
-        secureSocket.set_verify_callback(boost::asio::ssl::rfc2818_verification(hostname));
+    HttpSecureContext& context = HttpSecureContext::getInstance();
+    secureSocket.reset(new(std::nothrow) SecureSocket(socket, context.getContext()));
+    if (!secureSocket)
+        return false;
+    secureSocket->set_verify_mode(boost::asio::ssl::verify_peer);
+    secureSocket->set_verify_callback(boost::asio::ssl::rfc2818_verification(hostname));
+    context.prepare(secureSocket->native_handle(), hostname, &origin, HttpConnectionManager::getInstance().isHttp2Enabled());
+    return true;
+}
+
+// Switches the connection to HTTP/2. The request that has opened the
+// connection is handed over to the session together with the requests
+// waiting for the origin.
+void HttpConnection::startSession()
+{
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << origin << '\n';
+
+    session.reset(new(std::nothrow) Http2Session(*this));
+    if (!session) {
+        close();
+        HttpConnectionManager::getInstance().done(this, true);
+        return;
+    }
+    state = Multiplexed;
+    if (current) {
+        current->getTiming().connectEnd = HttpTiming::now();
+        current.reset();
     }
+    session->start();
+    HttpConnectionManager::getInstance().multiplex(this, Http2Session::DefaultMaxStreams);
+    asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void HttpConnection::startStream(const HttpRequestPtr& request)
+{
+    idleTimer.cancel();
+    if (session && session->open(request))
+        return;
+    HttpConnectionManager::getInstance().resend(this, request);
+}
+
+// Closes the connection, and sends the requests left over again over
+// another connection.
+void HttpConnection::stopSession()
+{
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << origin << '\n';
+
+    std::unique_ptr<Http2Session> stopped(std::move(session));
+    close();
+    HttpConnectionManager& manager(HttpConnectionManager::getInstance());
+    manager.multiplex(this, 0);
+    stopped->abort();
+    manager.closed(this);
 }
 
 void HttpConnection::sendRequest()
@@ -67,44 +165,54 @@ void HttpConnection::sendRequest()
     if (3 <= getLogLevel())
         std::cerr << __func__ << ' ' << current->getRequestMessage().toString() << '\n';
 
+    current->getTiming().requestStart = HttpTiming::now();
     std::ostream stream(&request);
     stream << current->getRequestMessage().toString();
     stream << "\r\n";
-    asyncWrite(request, boost::bind(&HttpConnection::handleWriteRequest, this, boost::asio::placeholders::error));
+    asyncWrite(request, boost::bind(&HttpConnection::handleWriteRequest, shared_from_this(), boost::asio::placeholders::error));
 }
 
 void HttpConnection::done(HttpConnectionManager* manager, bool error)
 {
     line.clear();
+    if (!error)
+        retryCount = 0;
     if (current) {
         HttpRequestPtr request = current;
         current.reset();
-        manager->complete(request, error);
-    }
-    if (!error) {
-        retryCount = 0;
-        if (!requests.empty()) {
-            // Note at this point, the socket might have been closed.
-            HttpRequestPtr request = requests.front();
-            requests.pop_front();
-            send(request);
-        }
-    } else {
-        while (!requests.empty()) {
-            current = requests.front();
-            requests.pop_front();
-            manager->complete(current, error);
+        // The request might have been canceled in the meantime.
+        if (assigned == request) {
+            assigned.reset();
+            manager->complete(request, error);
         }
-        current.reset();
     }
 }
 
+void HttpConnection::startIdleTimer(unsigned timeout)
+{
+    idleTimer.expires_from_now(boost::posix_time::seconds(timeout));
+    idleTimer.async_wait(strand.wrap(boost::bind(&HttpConnection::handleIdleTimeout, shared_from_this(), boost::asio::placeholders::error)));
+}
+
+void HttpConnection::handleIdleTimeout(const boost::system::error_code& err)
+{
+    if (err == boost::asio::error::operation_aborted)
+        return;
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << hostname << ' ' << States[state] << '\n';
+    HttpConnectionManager::getInstance().idle(this);
+}
+
 void HttpConnection::close()
 {
     state = Closed;
     line.clear();
     retryCount = 0;
+    idleTimer.cancel();
+    decoder.end();
+    session.reset();
     socket.close();
+    open = false;
     request.consume(request.size());
     response.consume(response.size());
 }
@@ -117,11 +225,9 @@ void HttpConnection::retry()
     int count = retryCount;
     close();
     retryCount = count + 1;
-    if (retryCount < MaxRetryCount) {
-        HttpRequestPtr request = current;
-        current.reset();
-        send(request);
-    } else
+    if (retryCount < MaxRetryCount)
+        start(current);
+    else
         HttpConnectionManager::getInstance().done(this, true);
 }
 
@@ -130,12 +236,20 @@ void HttpConnection::handleResolve(const boost::system::error_code& err, boost::
     if (3 <= getLogLevel())
         std::cerr << __func__ << ' ' << err << '\n';
 
+    if (state != Resolving)
+        return;     // retired while resolving
     if (!err) {
         state = Resolved;
+        if (current) {
+            HttpTiming& timing(current->getTiming());
+            timing.domainLookupEnd = timing.connectStart = HttpTiming::now();
+        }
         boost::asio::ip::tcp::endpoint endpoint = *endpointIterator;
-        socket.async_connect(endpoint, boost::bind(&HttpConnection::handleConnect, this, boost::asio::placeholders::error, ++endpointIterator));
+        open = true;    // async_connect() opens socket
+        socket.async_connect(endpoint, strand.wrap(boost::bind(&HttpConnection::handleConnect, shared_from_this(), boost::asio::placeholders::error, ++endpointIterator)));
         return;
     }
+    close();
     HttpConnectionManager::getInstance().done(this, true);
 }
 
@@ -144,27 +258,43 @@ void HttpConnection::handleConnect(const boost::system::error_code& err, boost::
     if (3 <= getLogLevel())
         std::cerr << __func__ << ' ' << err << '\n';
 
+    if (err == boost::asio::error::operation_aborted)
+        return;     // canceled by close()
+
     if (!err) {
         if (protocol == "https:" && state == Resolved) {
             state = Handshaking;
-            secureSocket.async_handshake(boost::asio::ssl::stream_base::client, boost::bind(&HttpConnection::handleHandshake, this, boost::asio::placeholders::error));
+            if (current)
+                current->getTiming().secureConnectionStart = HttpTiming::now();
+            if (!startSecureSession()) {
+                close();
+                HttpConnectionManager::getInstance().done(this, true);
+                return;
+            }
+            secureSocket->async_handshake(boost::asio::ssl::stream_base::client, strand.wrap(holdSecureSocket(boost::bind(&HttpConnection::handleHandshake, shared_from_this(), boost::asio::placeholders::error))));
         } else {
             state = Connected;
             boost::asio::ip::tcp::no_delay option(true);
             socket.set_option(option);
             if (current) {
+                current->getTiming().connectEnd = HttpTiming::now();
                 sendRequest();
-                asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
-            }
+            } else
+                state = CloseWait;  // preconnected; wait for a request like a persistent connection
+            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
         }
         return;
     }
     if (endpointIterator != boost::asio::ip::tcp::resolver::iterator()) {
         close();
         boost::asio::ip::tcp::endpoint endpoint = *endpointIterator;
-        socket.async_connect(endpoint, boost::bind(&HttpConnection::handleConnect, this, boost::asio::placeholders::error, ++endpointIterator));
+        open = true;    // async_connect() opens socket
+        socket.async_connect(endpoint, strand.wrap(boost::bind(&HttpConnection::handleConnect, shared_from_this(), boost::asio::placeholders::error, ++endpointIterator)));
         return;
     }
+    // The cached addresses might be stale.
+    HttpConnectionManager::getInstance().getResolver().invalidate(hostname, port);
+    close();
     HttpConnectionManager::getInstance().done(this, true);
 }
 
@@ -173,16 +303,28 @@ void HttpConnection::handleHandshake(const boost::system::error_code& err)
     if (3 <= getLogLevel())
         std::cerr << __func__ << ' ' << err << '\n';
 
+    if (err == boost::asio::error::operation_aborted || state != Handshaking)
+        return;     // canceled by close(), which might have completed the handshake just before
+
     if (!err) {
         state = Connected;
+        HttpSecureContext::getInstance().handshaken(secureSocket->native_handle());
         boost::asio::ip::tcp::no_delay option(true);
         socket.set_option(option);
+        if (HttpSecureContext::isHttp2(secureSocket->native_handle())) {
+            startSession();
+            return;
+        }
         if (current) {
+            current->getTiming().connectEnd = HttpTiming::now();
             sendRequest();
-            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
-        }
+        } else
+            state = CloseWait;  // preconnected; wait for a request like a persistent connection
+        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
         return;
     }
+    // Do not try to resume the session again.
+    HttpSecureContext::getInstance().removeSession(origin);
     close();
     HttpConnectionManager::getInstance().done(this, true);
 }
@@ -192,12 +334,11 @@ void HttpConnection::handleRead(const boost::system::error_code& err)
     if (4 <= getLogLevel())
         std::cerr << __func__ << ' ' << state << ' ' << err << '\n';
 
+    if (err == boost::asio::error::operation_aborted)
+        return;     // canceled by close()
     switch (state) {
     case Closed:
         break;
-    case ReadStatusLine:
-        readStatusLine(err);
-        break;
     case ReadHead:
         readHead(err);
         break;
@@ -213,6 +354,9 @@ void HttpConnection::handleRead(const boost::system::error_code& err)
     case CloseWait:
         close();
         break;
+    case Multiplexed:
+        readFrames(err);
+        break;
     default:
         close();
         HttpConnectionManager::getInstance().done(this, true);
@@ -225,6 +369,9 @@ void HttpConnection::handleWriteRequest(const boost::system::error_code& err)
     if (3 <= getLogLevel())
         std::cerr << __func__ << ' ' << err <<  '\n';
 
+    if (err == boost::asio::error::operation_aborted)
+        return;     // canceled by close()
+
     if (!err && current) {
         if (state != Connected && state != CloseWait) {
             retry();
@@ -232,58 +379,31 @@ void HttpConnection::handleWriteRequest(const boost::system::error_code& err)
         }
         if (current->getRequestMessage().getVersion() < 10)
             state = ReadContent;
-        else
-            state = ReadStatusLine;
+        else {
+            state = ReadHead;
+            headScanned = 0;
+        }
         return;
     }
     close();
     HttpConnectionManager::getInstance().done(this, true);
 }
 
-void HttpConnection::readStatusLine(const boost::system::error_code& err)
+void HttpConnection::handleWriteFrames(const boost::system::error_code& err)
 {
-    if (err && err != boost::asio::error::eof) {
-        close();
-        HttpConnectionManager::getInstance().done(this, true);
-        return;
-    }
-    const char* start = boost::asio::buffer_cast<const char*>(response.data());
-    const char* end = start + response.size();
-    const char* eol = std::find(start, end, '\n');
-    if (eol == end) {
-        if (err == boost::asio::error::eof) {
-            retry();
-            return;
-        }
-        line += std::string(start, response.size());
-        response.consume(response.size());
-        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
-        return;
-    }
-    ++eol;
-    if (!line.empty()) {
-        line += std::string(start, eol - start);
-        response.consume(eol - start);
-        start = line.c_str();
-        eol = start + line.length();
-    }
-
-    if (3 <= getLogLevel())
-        std::cerr << __func__ << ": " <<  std::string(start, eol - start) << '\n';
+    if (4 <= getLogLevel())
+        std::cerr << __func__ << ' ' << err <<  '\n';
 
-    const char* statusLine = current->getResponseMessage().parseStatusLine(start, eol);
-    if (!statusLine) {
-        close();
-        HttpConnectionManager::getInstance().done(this, true);
+    if (err == boost::asio::error::operation_aborted || !session)
+        return;     // canceled by close()
+    if (!err && session->written())
         return;
-    }
-    if (line.empty())
-        response.consume(eol - start);
-    line.clear();
-    state = ReadHead;
-    readHead(err);
+    stopSession();
 }
 
+// Reads the status line and the header fields as a whole. The received data
+// is scanned for the empty line only once, and then the header block is
+// parsed in place without being copied line by line.
 void HttpConnection::readHead(const boost::system::error_code& err)
 {
     if (err && err != boost::asio::error::eof) {
@@ -291,58 +411,58 @@ void HttpConnection::readHead(const boost::system::error_code& err)
         HttpConnectionManager::getInstance().done(this, true);
         return;
     }
-    HttpResponseMessage& responseMessage = current->getResponseMessage();
-    for (;;) {
-        const char* start = boost::asio::buffer_cast<const char*>(response.data());
-        const char* end = start + response.size();
-        const char* eol = std::find(start, end, '\n');
-        if (eol == end) {
-            if (err == boost::asio::error::eof) {
+    HttpTiming& timing(current->getTiming());
+    if (!timing.responseStart && response.size())
+        timing.responseStart = HttpTiming::now();
+    const char* start = boost::asio::buffer_cast<const char*>(response.data());
+    const char* end = start + response.size();
+    const char* head = findEndOfHead(start, end, headScanned);
+    if (!head) {
+        if (err == boost::asio::error::eof) {
+            // The server might have closed the persistent connection.
+            if (!memchr(start, '\n', end - start))
+                retry();
+            else {
                 close();
                 HttpConnectionManager::getInstance().done(this, true);
-                return;
             }
-            line += std::string(start, response.size());
-            response.consume(response.size());
-            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
             return;
         }
-        ++eol;
-        if (!line.empty()) {
-            line += std::string(start, eol - start);
-            response.consume(eol - start);
-            start = line.c_str();
-            eol = start + line.length();
-        }
-
-        if (3 <= getLogLevel())
-            std::cerr << __func__ << ": " <<  std::string(start, eol - start);
-
-        const char* header = parseCRLF(start, eol);
-        if (*header == '\n') {
-            if (line.empty())
-                response.consume(eol - start);
-            else
-                line.clear();
-            break;
-        }
-        header = responseMessage.parseHeader(start, eol);
-        if (!header) {
+        if (MaxHeadLength < response.size()) {
             close();
             HttpConnectionManager::getInstance().done(this, true);
             return;
         }
-        if (line.empty())
-            response.consume(eol - start);
-        line.clear();
+        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
+        return;
     }
 
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ": " <<  std::string(start, head - start);
+
+    HttpResponseMessage& responseMessage = current->getResponseMessage();
+    if (!responseMessage.parse(start, head)) {
+        close();
+        HttpConnectionManager::getInstance().done(this, true);
+        return;
+    }
+    response.consume(head - start);
+    headScanned = 0;
+
     // TODO: handle every status code
     switch (responseMessage.getStatus()) {
     case 304:   // Not Modified
         break;
     default:
+        if (!current->startContent()) {
+            close();
+            HttpConnectionManager::getInstance().done(this, true);
+            return;
+        }
         octetCount = 0;
+        if (responseMessage.getContentEncoding() != HttpResponseMessage::Identity &&
+            current->getRequestMessage().getMethodCode() != HttpRequestMessage::HEAD)
+            decoder.start(responseMessage.getContentEncoding());   // an unknown coding is kept as it is
         if (responseMessage.isChunked()) {
             chunkCRLF = 0;
             contentLength = 0;
@@ -362,57 +482,92 @@ void HttpConnection::readHead(const boost::system::error_code& err)
     HttpConnectionManager::getInstance().done(this, false);
     if (!err) {
         state = CloseWait;
-        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
+        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
     }
 }
 
+bool HttpConnection::writeContent(std::ostream& content, const char* data, size_t length)
+{
+    if (!decoder.isActive())
+        content.write(data, length);
+    else if (!decoder.write(content, data, length))
+        return false;
+    current->progress();
+    return true;
+}
+
+// Once the entity-body has been decoded, the response message describes the
+// decoded body so that HttpCache stores the headers consistent with it.
+void HttpConnection::endContent()
+{
+    if (!decoder.isActive())
+        return;
+    HttpResponseMessage& responseMessage = current->getResponseMessage();
+    responseMessage.clearContentEncoding();
+    responseMessage.setContentLength(decoder.getDecodedLength());
+    decoder.end();
+}
+
 void HttpConnection::readContent(const boost::system::error_code& err)
 {
-    if (!err || err == boost::asio::error::eof) {
-        std::fstream& content = current->getContent();
-        if (!content.is_open()) {
+    if (err && err != boost::asio::error::eof) {
+        close();
+        HttpConnectionManager::getInstance().done(this, true);
+        return;
+    }
+    std::ostream& content = current->getContent();
+    if (!content) {
+        HttpConnectionManager::getInstance().done(this, true);
+        return;
+    }
+    bool completed = false;
+    if (0 < response.size()) {
+        unsigned long long length = response.size();
+        if (contentLength)
+            length = std::min(length, contentLength - octetCount);
+        if (!writeContent(content, boost::asio::buffer_cast<const char*>(response.data()), length)) {
+            close();
             HttpConnectionManager::getInstance().done(this, true);
             return;
         }
-        bool completed = false;
-        if (0 < response.size()) {
-            if (!contentLength) {
-                octetCount += response.size();
-                content << &response;
-            } else {
-                unsigned long long length = std::min(static_cast<unsigned long long>(response.size()), contentLength - octetCount);
-                content.write(boost::asio::buffer_cast<const char*>(response.data()), length);
-                response.consume(length);
-                octetCount += length;
-            }
-            if (contentLength <= octetCount)
-                completed = true;
-        }
-        if (!err && !completed) {
-            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
-            return;
-        }
+        response.consume(length);
+        octetCount += length;
+        if (contentLength <= octetCount)
+            completed = true;
+    }
+    if (!err && !completed) {
+        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
+        return;
+    }
+    if (err == boost::asio::error::eof && octetCount < contentLength) {
+        // The entity-body has been cut off. Keep it undecoded so that
+        // HttpCache can resume it by a range request later.
         content.flush();
+        close();
+        HttpConnectionManager::getInstance().done(this, true);
+        return;
     }
+    endContent();
+    content.flush();
     if (err == boost::asio::error::eof) {
         close();
         if (contentLength < octetCount) {
             contentLength = octetCount;
             // TODO: set Content-length:
         }
-        HttpConnectionManager::getInstance().done(this, octetCount < contentLength);
+        HttpConnectionManager::getInstance().done(this, false);
         return;
     }
-    HttpConnectionManager::getInstance().done(this, err);
+    HttpConnectionManager::getInstance().done(this, false);
     state = CloseWait;
-    asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
+    asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
 }
 
 void HttpConnection::readChunk(const boost::system::error_code& err)
 {
     if (!err || err == boost::asio::error::eof) {
-        std::fstream& content = current->getContent();
-        if (!content.is_open()) {
+        std::ostream& content = current->getContent();
+        if (!content) {
             HttpConnectionManager::getInstance().done(this, true);
             return;
         }
@@ -433,11 +588,12 @@ void HttpConnection::readChunk(const boost::system::error_code& err)
                     contentLength += chunkLength;
                     if (chunkLength == 0) {
                         if (line[0] != '0') {
-                            HttpConnectionManager::getInstance().done(this, true);
                             close();
+                            HttpConnectionManager::getInstance().done(this, true);
                             return;
                         }
                         completed = true;
+                        endContent();
                         content.flush();
                         chunkCRLF = 1;
                     }
@@ -446,7 +602,11 @@ void HttpConnection::readChunk(const boost::system::error_code& err)
             if (!completed) {
                 if (0 < response.size() && octetCount < contentLength) {
                     unsigned long long length = std::min(static_cast<unsigned long long>(response.size()), contentLength - octetCount);
-                    content.write(boost::asio::buffer_cast<const char*>(response.data()), length);
+                    if (!writeContent(content, boost::asio::buffer_cast<const char*>(response.data()), length)) {
+                        close();
+                        HttpConnectionManager::getInstance().done(this, true);
+                        return;
+                    }
                     response.consume(length);
                     octetCount += length;
                 }
@@ -459,8 +619,8 @@ void HttpConnection::readChunk(const boost::system::error_code& err)
                     } else if (c == '\r' && chunkCRLF == 0)
                         ++chunkCRLF;
                     else {
-                        HttpConnectionManager::getInstance().done(this, true);
                         close();
+                        HttpConnectionManager::getInstance().done(this, true);
                         return;
                     }
                 }
@@ -472,13 +632,13 @@ void HttpConnection::readChunk(const boost::system::error_code& err)
             }
         }
         if (!err) {
-            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
+            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
             return;
         }
     }
     assert(err);
-    HttpConnectionManager::getInstance().done(this, err);
     close();
+    HttpConnectionManager::getInstance().done(this, true);
 }
 
 void HttpConnection::readTrailer(const boost::system::error_code& err)
@@ -489,12 +649,12 @@ void HttpConnection::readTrailer(const boost::system::error_code& err)
             if (c == '\n') {
                 if (++chunkCRLF == 2) {
                     // TODO: set Content-length:
-                    HttpConnectionManager::getInstance().done(this, false);
                     if (err)
                         close();
-                    else {
+                    HttpConnectionManager::getInstance().done(this, false);
+                    if (!err) {
                         state = CloseWait;
-                        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
+                        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
                     }
                     return;
                 }
@@ -502,63 +662,261 @@ void HttpConnection::readTrailer(const boost::system::error_code& err)
                 chunkCRLF = 0;
         }
         if (!err) {
-            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, this, boost::asio::placeholders::error));
+            asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
             return;
         }
     }
     assert(err);
-    HttpConnectionManager::getInstance().done(this, err);
     close();
+    HttpConnectionManager::getInstance().done(this, true);
+}
+
+void HttpConnection::readFrames(const boost::system::error_code& err)
+{
+    if (!err && session->read()) {
+        asyncRead(response, boost::asio::transfer_at_least(1), boost::bind(&HttpConnection::handleRead, shared_from_this(), boost::asio::placeholders::error));
+        return;
+    }
+    // Close the connection after GOAWAY has been written.
+    if (err || !session->isWriting())
+        stopSession();
 }
 
 void HttpConnection::send(const HttpRequestPtr& request)
 {
-    if (current) {
-        assert(current != request);
-        requests.push_back(request);
+    speculative = false;
+    if (multiplexed) {
+        assignedStreams.push_back(request);
+        strand.post(boost::bind(&HttpConnection::startStream, shared_from_this(), request));
         return;
     }
+    assert(!assigned);
+    assigned = request;
+    strand.post(boost::bind(&HttpConnection::start, shared_from_this(), request));
+}
+
+void HttpConnection::preconnect(unsigned timeout)
+{
+    assert(!assigned);
+    speculative = true;
+    strand.post(boost::bind(&HttpConnection::startPreconnect, shared_from_this(), timeout));
+}
+
+void HttpConnection::start(const HttpRequestPtr& request)
+{
+    if (session)
+        return;     // the handshake has just turned the request into a stream
     current = request;
+    idleTimer.cancel();
 
+    switch (state) {
+    case Resolving:
+    case Resolved:
+    case Handshaking:
+        // The request is sent once the preconnection has been established.
+        return;
+    default:
+        break;
+    }
     if (socket.is_open()) {
         sendRequest();
         return;
     }
 
     state = Resolving;
-    boost::asio::ip::tcp::resolver::query query(hostname, port);
-    HttpConnectionManager::getInstance().resolve(query,
-                                                 boost::bind(&HttpConnection::handleResolve, this,
-                                                             boost::asio::placeholders::error,
-                                                             boost::asio::placeholders::iterator));
+    request->getTiming().domainLookupStart = HttpTiming::now();
+    HttpConnectionManager::getInstance().resolve(hostname, port,
+                                                 strand.wrap(boost::bind(&HttpConnection::handleResolve, shared_from_this(),
+                                                                         boost::asio::placeholders::error,
+                                                                         boost::asio::placeholders::iterator)));
 }
 
-void HttpConnection::abort(const HttpRequestPtr& request)
+// Resolves, connects, and handshakes without a request. The idle timer
+// closes the connection if no request takes it over within timeout.
+void HttpConnection::startPreconnect(unsigned timeout)
 {
-    if (current != request) {
-        requests.remove(request);
-        request->notify(true);
+    if (current || state != Closed)
+        return;
+
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << protocol << ' ' << origin << '\n';
+
+    startIdleTimer(timeout);
+    state = Resolving;
+    HttpConnectionManager::getInstance().resolve(hostname, port,
+                                                 strand.wrap(boost::bind(&HttpConnection::handleResolve, shared_from_this(),
+                                                                         boost::asio::placeholders::error,
+                                                                         boost::asio::placeholders::iterator)));
+}
+
+// Releases the connection from the request being aborted. The connection
+// is closed on the strand once the handler in progress, if any, returns.
+// With HTTP/2, only the stream of the request is reset.
+void HttpConnection::cancel(const HttpRequestPtr& request)
+{
+    if (assigned == request)
+        assigned.reset();
+    else
+        assignedStreams.remove(request);
+    strand.post(boost::bind(&HttpConnection::handleCancel, shared_from_this(), request));
+}
+
+void HttpConnection::handleCancel(const HttpRequestPtr& request)
+{
+    if (session) {
+        session->cancel(request);
         return;
     }
+    if (current != request)
+        return;
     close();
-    done(&HttpConnectionManager::getInstance(), true);
+    HttpConnectionManager::getInstance().done(this, true);
+}
+
+void HttpConnection::prioritize(const HttpRequestPtr& request)
+{
+    strand.post(boost::bind(&HttpConnection::handlePrioritize, shared_from_this(), request));
+}
+
+void HttpConnection::handlePrioritize(const HttpRequestPtr& request)
+{
+    if (session)
+        session->prioritize(request);
+}
+
+void HttpConnection::retire()
+{
+    strand.post(boost::bind(&HttpConnection::close, shared_from_this()));
 }
 
 void HttpConnection::dump()
 {
-    std::cout << "HttpConnection: " << protocol << ' ' << hostname << ' ' << States[state] << ' ' << requests.size() << '\n';
+    std::cout << "HttpConnection: " << protocol << ' ' << hostname << ' ' << States[state] << ' ' << (isIdle() ? "idle" : "busy");
+    if (multiplexed)
+        std::cout << ' ' << assignedStreams.size() << '/' << maxStreams;
+    std::cout << '\n';
+}
+
+// Returns a free connection to the specified origin, or zero if the request
+// has to wait until one of the connections becomes available. Images and
+// prefetches cannot occupy the last connection to the origin so that a
+// render-blocking request can be sent without waiting for them. All the
+// requests to an HTTP/2 origin share a single connection.
+HttpConnection* HttpConnectionManager::getConnection(const std::string& protocol, const std::string& hostname, const std::string& port, unsigned short priority)
+{
+    unsigned limit = maxConnectionsPerHost;
+    if (HttpRequest::IMAGE <= priority && 1 < limit)
+        --limit;
+    HttpConnection* idle = 0;
+    unsigned count = 0;
+    unsigned busy = 0;
+    bool connecting = false;
+    for (auto i = connections.begin(); i != connections.end(); ++i) {
+        HttpConnection* conn = i->get();
+        if (!conn->matches(protocol, hostname, port))
+            continue;
+        if (conn->multiplexed) {
+            if (conn->assignedStreams.size() < conn->maxStreams)
+                return conn;
+            if (conn->maxStreams)
+                return 0;
+            continue;   // going away
+        }
+        ++count;
+        if (!conn->isIdle()) {
+            ++busy;
+            if (!conn->isOpen())
+                connecting = true;
+            continue;
+        }
+        if (conn->isWarm() && (!idle || !idle->isWarm()))
+            idle = conn;    // reuse the keep-alive or preconnected connection first
+        else if (!idle)
+            idle = conn;
+    }
+    if (limit <= busy)
+        return 0;
+    if (idle)
+        return idle;
+    if (connecting && http2Origins.count(hostname + ':' + port))
+        return 0;
+    if (limit <= count)
+        return 0;
+    if (maxConnections <= connections.size() && !retireIdleConnection())
+        return 0;
+    HttpConnectionPtr c(new(std::nothrow) HttpConnection(protocol, hostname, port));
+    if (!c)
+        return 0;
+    connections.push_back(c);
+    return c.get();
+}
+
+HttpConnection* HttpConnectionManager::findConnection(const HttpRequestPtr& request)
+{
+    for (auto i = connections.begin(); i != connections.end(); ++i) {
+        HttpConnection* conn = i->get();
+        if (conn->assigned == request)
+            return conn;
+        if (std::find(conn->assignedStreams.begin(), conn->assignedStreams.end(), request) != conn->assignedStreams.end())
+            return conn;
+    }
+    return 0;
 }
 
-HttpConnection* HttpConnectionManager::getConnection(const std::string& protocol, const std::string& hostname, const std::string& port)
+// Closes one of the idle connections to make room for a new connection.
+// Connections without an open socket are retired first.
+bool HttpConnectionManager::retireIdleConnection()
 {
+    auto found = connections.end();
     for (auto i = connections.begin(); i != connections.end(); ++i) {
-        if ((*i)->protocol == protocol && (*i)->hostname == hostname && (*i)->port == port)
-            return *i;
+        if (!(*i)->isIdle())
+            continue;
+        found = i;
+        if (!(*i)->isOpen())
+            break;
+    }
+    if (found == connections.end())
+        return false;
+    (*found)->retire();
+    connections.erase(found);
+    return true;
+}
+
+void HttpConnectionManager::retire(HttpConnection* conn)
+{
+    for (auto i = connections.begin(); i != connections.end(); ++i) {
+        if (i->get() == conn) {
+            conn->close();
+            connections.erase(i);
+            return;
+        }
+    }
+}
+
+// Queues the request after the requests of the same or higher priority.
+void HttpConnectionManager::enqueue(const PendingRequest& entry)
+{
+    unsigned short priority = entry.request->getPriority();
+    auto i = std::find_if(pending.begin(), pending.end(), [=](const PendingRequest& queued) {
+        return priority < queued.request->getPriority();
+    });
+    pending.insert(i, entry);
+}
+
+// Hands the queued requests over to the free connections in the order of
+// priority.
+void HttpConnectionManager::dispatch()
+{
+    for (auto i = pending.begin(); i != pending.end();) {
+        HttpConnection* conn = getConnection(i->protocol, i->hostname, i->port, i->request->getPriority());
+        if (!conn) {
+            ++i;
+            continue;
+        }
+        HttpRequestPtr request = i->request;
+        i = pending.erase(i);
+        conn->send(request);
     }
-    HttpConnection* c = new(std::nothrow) HttpConnection(protocol, hostname, port);
-    if (c)
-        connections.push_back(c);
-    return c;
 }
 
 void HttpConnectionManager::send(const HttpRequestPtr& request)
@@ -566,13 +924,28 @@ void HttpConnectionManager::send(const HttpRequestPtr& request)
     std::lock_guard<std::recursive_mutex> lock(mutex);
 
     URI uri(request->getURL());
-    std::string protocol = uri.getProtocol();
-    std::string hostname = uri.getHostname();
-    std::string port = uri.getPort();
-    HttpConnection* conn = getConnection(protocol, hostname, port);
-    if (!conn)
+    PendingRequest entry = { uri.getProtocol(), uri.getHostname(), uri.getPort(), request };
+    enqueue(entry);
+    dispatch();
+}
+
+void HttpConnectionManager::prioritize(const HttpRequestPtr& request)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    auto i = std::find_if(pending.begin(), pending.end(), [&](const PendingRequest& entry) {
+        return entry.request == request;
+    });
+    if (i == pending.end()) {
+        HttpConnection* conn = findConnection(request);
+        if (conn && conn->multiplexed)
+            conn->prioritize(request);
         return;
-    conn->send(request);
+    }
+    PendingRequest entry = *i;
+    pending.erase(i);
+    enqueue(entry);
+    dispatch();
 }
 
 void HttpConnectionManager::abort(const HttpRequestPtr& request)
@@ -581,17 +954,24 @@ void HttpConnectionManager::abort(const HttpRequestPtr& request)
 
     if (request->getReadyState() != HttpRequest::COMPLETE) {
         if (!request->cache || !request->cache->abort(request)) {
-            URI uri(request->getURL());
-            std::string protocol = uri.getProtocol();
-            std::string hostname = uri.getHostname();
-            std::string port = uri.getPort();
-            HttpConnection* conn = getConnection(protocol, hostname, port);
-            if (conn)
-                conn->abort(request);
+            auto i = std::find_if(pending.begin(), pending.end(), [&](const PendingRequest& entry) {
+                return entry.request == request;
+            });
+            if (i != pending.end()) {
+                pending.erase(i);
+                request->notify(true);
+            } else if (HttpConnection* conn = findConnection(request)) {
+                conn->cancel(request);
+                complete(request, true);
+                dispatch();
+            }
         }
     }
-    if (request->getReadyState() == HttpRequest::COMPLETE)
+    if (request->getReadyState() == HttpRequest::COMPLETE) {
+        notifying.remove(request);
+        std::lock_guard<std::mutex> completedLock(completedMutex);
         completed.remove(request);
+    }
     request->notify();
 }
 
@@ -599,31 +979,186 @@ void HttpConnectionManager::done(HttpConnection* conn, bool error)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex);
 
+    if (conn->speculative) {
+        // The preconnection has failed.
+        retire(conn);
+        dispatch();
+        return;
+    }
     conn->done(this, error);
+    dispatch();
+    if (conn->isIdle())
+        conn->startIdleTimer(idleTimeout);
 }
 
-void HttpConnectionManager::complete(const HttpRequestPtr& request, bool error)
+void HttpConnectionManager::multiplex(HttpConnection* conn, unsigned maxStreams)
 {
-    if (request->complete(error))
-        completed.push_back(request);
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (!conn->multiplexed) {
+        conn->multiplexed = true;
+        http2Origins.insert(conn->origin);
+        // The request that has opened the connection becomes the first stream.
+        if (HttpRequestPtr request = conn->assigned) {
+            conn->assigned.reset();
+            conn->send(request);
+        }
+    }
+    conn->maxStreams = maxStreams;
+    dispatch();
 }
 
-HttpRequestPtr HttpConnectionManager::getCompleted()
+void HttpConnectionManager::done(HttpConnection* conn, const HttpRequestPtr& request, bool error)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex);
 
-    if (!completed.empty()) {
-        HttpRequestPtr request = completed.front();
-        completed.pop_front();
-        return request;
+    auto i = std::find(conn->assignedStreams.begin(), conn->assignedStreams.end(), request);
+    if (i != conn->assignedStreams.end()) {
+        conn->assignedStreams.erase(i);
+        complete(request, error);
     }
-    return 0;
+    dispatch();
+    if (conn->isIdle())
+        conn->startIdleTimer(idleTimeout);
+}
+
+void HttpConnectionManager::resend(HttpConnection* conn, const HttpRequestPtr& request)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    auto i = std::find(conn->assignedStreams.begin(), conn->assignedStreams.end(), request);
+    if (i == conn->assignedStreams.end())
+        return;     // aborted
+    conn->assignedStreams.erase(i);
+    PendingRequest entry = { conn->protocol, conn->hostname, conn->port, request };
+    enqueue(entry);
+    dispatch();
+}
+
+void HttpConnectionManager::closed(HttpConnection* conn)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    conn->multiplexed = false;
+    conn->maxStreams = 0;
+    for (auto i = conn->assignedStreams.begin(); i != conn->assignedStreams.end(); ++i) {
+        PendingRequest entry = { conn->protocol, conn->hostname, conn->port, *i };
+        enqueue(entry);
+    }
+    conn->assignedStreams.clear();
+    dispatch();
+}
+
+void HttpConnectionManager::idle(HttpConnection* conn)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (!conn->isIdle())
+        return;
+    retire(conn);
+    dispatch();
+}
+
+void HttpConnectionManager::setMaxConnectionsPerHost(unsigned count)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    maxConnectionsPerHost = std::max(1u, count);
+    dispatch();
+}
+
+void HttpConnectionManager::setMaxConnections(unsigned count)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    maxConnections = std::max(1u, count);
+    dispatch();
+}
+
+void HttpConnectionManager::setIdleTimeout(unsigned seconds)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    idleTimeout = seconds;
+}
+
+void HttpConnectionManager::setMaxPreconnections(unsigned count)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    maxPreconnections = count;
+}
+
+void HttpConnectionManager::setPreconnectTimeout(unsigned seconds)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    preconnectTimeout = std::max(1u, seconds);
+}
+
+void HttpConnectionManager::complete(const HttpRequestPtr& request, bool error)
+{
+    if (!request->complete(error))
+        return;
+    std::lock_guard<std::mutex> lock(completedMutex);
+    completed.push_back(request);
 }
 
+// Takes all the completed requests at once, and then notifies them one by
+// one. A request aborted by another one's handler is removed from notifying.
 void HttpConnectionManager::poll()
 {
-    while (HttpRequestPtr request = getCompleted())
+    {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        notifying.splice(notifying.end(), completed);
+    }
+    while (!notifying.empty()) {
+        HttpRequestPtr request = notifying.front();
+        notifying.pop_front();
         request->notify();
+    }
+}
+
+void HttpConnectionManager::prefetch(const URL& url)
+{
+    if (!url.testProtocol(u"http") && !url.testProtocol(u"https"))
+        return;
+    URI uri(url);
+    resolver.prefetch(uri.getHostname(), uri.getPort());
+}
+
+void HttpConnectionManager::preconnect(const URL& url)
+{
+    if (!url.testProtocol(u"http") && !url.testProtocol(u"https"))
+        return;
+    URI uri(url);
+    std::string protocol = uri.getProtocol();
+    std::string hostname = uri.getHostname();
+    std::string port = uri.getPort();
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    if (!maxPreconnections)
+        return;
+    auto oldest = connections.end();
+    unsigned count = 0;
+    for (auto i = connections.begin(); i != connections.end(); ++i) {
+        HttpConnection* conn = i->get();
+        if (conn->matches(protocol, hostname, port) && (!conn->isIdle() || conn->isWarm()))
+            return;     // the next request can use this connection, or has to wait anyway
+        if (conn->speculative) {
+            if (oldest == connections.end())
+                oldest = i;
+            ++count;
+        }
+    }
+    // Give up the oldest preconnection as the pointer has moved on.
+    if (maxPreconnections <= count) {
+        (*oldest)->retire();
+        connections.erase(oldest);
+    }
+    if (HttpConnection* conn = getConnection(protocol, hostname, port, HttpRequest::PREFETCH))
+        conn->preconnect(preconnectTimeout);
 }
 
 void HttpConnectionManager::operator()()
@@ -636,7 +1171,10 @@ void HttpConnectionManager::dump()
     HttpConnectionManager& instance(getInstance());
     for (auto i = instance.connections.begin(); i != instance.connections.end(); ++i)
         (*i)->dump();
+    std::cout << "pending: " << instance.pending.size() << '\n';
     std::cout << "completed: " << instance.completed.size() << '\n';
+    instance.resolver.dump();
+    HttpSecureContext::getInstance().dump();
 }
 
 }}}}  // org::w3c::dom::bootstrap
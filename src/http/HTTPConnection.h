@@ -17,48 +17,164 @@
 #ifndef ES_HTTP_CONNECTION_H
 #define ES_HTTP_CONNECTION_H
 
+#include <algorithm>
+#include <atomic>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <thread>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 
+#include "http/HTTP2Session.h"
 #include "http/HTTPCache.h"
+#include "http/HTTPContentDecoder.h"
+#include "http/HTTPResolver.h"
+#include "http/HTTPSecureContext.h"
 
 namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
 class HttpConnection;
 
+typedef std::shared_ptr<HttpConnection> HttpConnectionPtr;
+
 class HttpConnectionManager
 {
+    struct PendingRequest
+    {
+        std::string protocol;
+        std::string hostname;
+        std::string port;
+        HttpRequestPtr request;
+    };
+
+    // ioService is declared first so that it outlives the sockets and the
+    // timers of the connections.
+    boost::asio::io_service ioService;
+
     std::recursive_mutex mutex;
-    std::list<HttpConnection*> connections;
+    std::list<HttpConnectionPtr> connections;
+    std::list<PendingRequest> pending;  // requests waiting for a free connection in the order of priority
+
+    // The completed requests are handed over to the main thread under their
+    // own lock so that the network threads do not wait for each other nor
+    // for the main thread while notifying them.
+    std::mutex completedMutex;
     std::list<HttpRequestPtr> completed;
+    std::list<HttpRequestPtr> notifying;    // used only by the main thread
 
-    boost::asio::io_service ioService;
-    boost::asio::ip::tcp::resolver resolver;
+    unsigned maxConnectionsPerHost;
+    unsigned maxConnections;
+    unsigned idleTimeout;   // in seconds
+    unsigned maxPreconnections;
+    unsigned preconnectTimeout; // in seconds
+    unsigned threadCount;
+    bool http2;
+
+    // The origins known to have negotiated HTTP/2 so far. The requests to
+    // them wait for the connection being opened instead of opening more.
+    std::set<std::string> http2Origins;
+
+    HttpResolver resolver;
     boost::asio::io_service::work work;
 
-    HttpRequestPtr getCompleted();
+    HttpConnection* getConnection(const std::string& protocol, const std::string& hostname, const std::string& port, unsigned short priority);
+    HttpConnection* findConnection(const HttpRequestPtr& request);
+    bool retireIdleConnection();
+    void retire(HttpConnection* conn);
+    void enqueue(const PendingRequest& entry);
+    void dispatch();
 
 public:
+    static const unsigned DefaultMaxConnectionsPerHost = 6;
+    static const unsigned DefaultMaxConnections = 32;
+    static const unsigned DefaultIdleTimeout = 30;
+    static const unsigned DefaultMaxPreconnections = 4;
+    static const unsigned DefaultPreconnectTimeout = 10;
+    static const unsigned MaxThreadCount = 4;
+
     HttpConnectionManager() :
+        maxConnectionsPerHost(DefaultMaxConnectionsPerHost),
+        maxConnections(DefaultMaxConnections),
+        idleTimeout(DefaultIdleTimeout),
+        maxPreconnections(DefaultMaxPreconnections),
+        preconnectTimeout(DefaultPreconnectTimeout),
+        threadCount(std::max(1u, std::min(MaxThreadCount, std::thread::hardware_concurrency()))),
+        http2(true),
         resolver(ioService),
         work(ioService)
     {
     }
 
-    HttpConnection* getConnection(const std::string& protocol, const std::string& hostname, const std::string& port);
     void send(const HttpRequestPtr& request);
+    void prioritize(const HttpRequestPtr& request);
     void abort(const HttpRequestPtr& request);
     void done(HttpConnection* conn, bool error);
+    void idle(HttpConnection* conn);
+
+    // The following are called by Http2Session. multiplex() lets the
+    // connection take up to maxStreams requests at once, or none while
+    // it is going away.
+    void multiplex(HttpConnection* conn, unsigned maxStreams);
+    void done(HttpConnection* conn, const HttpRequestPtr& request, bool error);
+    void resend(HttpConnection* conn, const HttpRequestPtr& request);
+    void closed(HttpConnection* conn);
+
     void complete(const HttpRequestPtr& request, bool error);
     void poll();
 
-    template <typename ResolveHandler>
-    void resolve(const boost::asio::ip::tcp::resolver::query& q, ResolveHandler handler) {
-        resolver.async_resolve(q,handler);
+    unsigned getMaxConnectionsPerHost() const {
+        return maxConnectionsPerHost;
+    }
+    void setMaxConnectionsPerHost(unsigned count);
+    unsigned getMaxConnections() const {
+        return maxConnections;
+    }
+    void setMaxConnections(unsigned count);
+    unsigned getIdleTimeout() const {
+        return idleTimeout;
+    }
+    void setIdleTimeout(unsigned seconds);
+    unsigned getMaxPreconnections() const {
+        return maxPreconnections;
+    }
+    void setMaxPreconnections(unsigned count);
+    unsigned getPreconnectTimeout() const {
+        return preconnectTimeout;
+    }
+    void setPreconnectTimeout(unsigned seconds);
+    // The number of the threads expected to run operator()(). Each
+    // connection is bound to its own strand, so the connections can be
+    // served in parallel.
+    unsigned getThreadCount() const {
+        return threadCount;
+    }
+    void setThreadCount(unsigned count) {
+        threadCount = std::max(1u, count);
+    }
+    // If enabled, https connections offer HTTP/2 during the TLS handshake.
+    bool isHttp2Enabled() const {
+        return http2;
+    }
+    void setHttp2Enabled(bool enabled) {
+        http2 = enabled;
+    }
+
+    void resolve(const std::string& hostname, const std::string& port, const HttpResolver::Handler& handler) {
+        resolver.resolve(hostname, port, handler);
+    }
+    // Looks up the host of the specified URL in advance.
+    void prefetch(const URL& url);
+    // Opens a connection to the origin of the specified URL in advance so
+    // that the next request to it does not wait for the name resolution,
+    // the TCP connection, and the TLS handshake. At most maxPreconnections
+    // connections are opened this way, and each of them is closed unless
+    // used within preconnectTimeout seconds.
+    void preconnect(const URL& url);
+    HttpResolver& getResolver() {
+        return resolver;
     }
 
     void operator()();
@@ -78,9 +194,10 @@ public:
     static void dump();
 };
 
-class HttpConnection
+class HttpConnection : public std::enable_shared_from_this<HttpConnection>
 {
     friend class HttpConnectionManager;
+    friend class Http2Session;
 
     // State
     enum {
@@ -89,33 +206,42 @@ class HttpConnection
         Resolved,
         Connected,
         Handshaking,
-        ReadStatusLine,
         ReadHead,
         ReadContent,
         ReadChunk,
         ReadTrailer,
-        CloseWait
+        CloseWait,
+        Multiplexed     // HTTP/2
     };
 
     static const char* States[];
 
     static const int MaxRetryCount = 3;
+    static const size_t MaxHeadLength = 64 * 1024;
 
     int state;
     int retryCount;
     std::string line;  // line buffer
+    size_t headScanned; // the length of the header block scanned so far
 
     std::string protocol;
     std::string hostname;
     std::string port;
+    std::string origin;     // hostname:port for the TLS session cache
 
     // Boost
+    boost::asio::io_service::strand strand;     // every handler of this connection runs through it
     boost::asio::ip::tcp::socket socket;
+    std::atomic_bool open;  // socket is open; read by HttpConnectionManager off the strand
     boost::asio::streambuf request;
     boost::asio::streambuf response;
 
-    boost::asio::ssl::context context;
-    boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> secureSocket;
+    typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> SecureSocket;
+
+    // A new TLS stream is created for each TCP connection. The operations
+    // pending on the previous stream keep it alive until their handlers run.
+    std::shared_ptr<SecureSocket> secureSocket;
+    boost::asio::deadline_timer idleTimer;
 
     unsigned long long octetCount;
     unsigned long long contentLength;
@@ -124,44 +250,111 @@ class HttpConnection
     unsigned long long chunkLength;
     int chunkCRLF;
 
-    std::list<HttpRequestPtr> requests;
-    HttpRequestPtr current;
+    HttpContentDecoder decoder;
 
+    HttpRequestPtr current;     // accessed only through the strand
+    HttpRequestPtr assigned;    // guarded by the mutex of HttpConnectionManager
+    bool speculative;           // opened by preconnect() and not used yet; guarded likewise
+
+    // HTTP/2
+    std::unique_ptr<Http2Session> session;      // accessed only through the strand
+    std::list<HttpRequestPtr> assignedStreams;  // guarded by the mutex of HttpConnectionManager
+    unsigned maxStreams;                        // guarded likewise
+    bool multiplexed;                           // guarded likewise
+
+    void start(const HttpRequestPtr& request);
+    void startPreconnect(unsigned timeout);
     void sendRequest();
+    bool startSecureSession();
+    void startSession();
+    void startStream(const HttpRequestPtr& request);
+    void stopSession();
 
     void handleResolve(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator endpointIterator);
     void handleConnect(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator endpointIterator);
     void handleHandshake(const boost::system::error_code& err);
     void handleWriteRequest(const boost::system::error_code& err);
+    void handleWriteFrames(const boost::system::error_code& err);
     void handleRead(const boost::system::error_code& err);
+    void handleIdleTimeout(const boost::system::error_code& err);
+    void handleCancel(const HttpRequestPtr& request);
+    void handlePrioritize(const HttpRequestPtr& request);
+
+    bool writeContent(std::ostream& content, const char* data, size_t length);
+    void endContent();
 
-    void readStatusLine(const boost::system::error_code& err);
     void readHead(const boost::system::error_code& err);
     void readContent(const boost::system::error_code& err);
     void readChunk(const boost::system::error_code& err);
     void readTrailer(const boost::system::error_code& err);
+    void readFrames(const boost::system::error_code& err);
 
     void close();
     void retry();
 
+    bool isIdle() const {
+        return !assigned && assignedStreams.empty();
+    }
+    bool isOpen() const {
+        return open;
+    }
+    // Returns true if the connection is open or being opened.
+    bool isWarm() const {
+        return open || speculative;
+    }
+    bool matches(const std::string& protocol, const std::string& hostname, const std::string& port) const {
+        return this->protocol == protocol && this->hostname == hostname && this->port == port;
+    }
+
+    // send(), preconnect(), cancel(), prioritize(), and retire() are called by
+    // HttpConnectionManager with its mutex locked; the actual work is posted
+    // to the strand.
     void send(const HttpRequestPtr& request);
-    void abort(const HttpRequestPtr& request);
+    void preconnect(unsigned timeout);
+    void cancel(const HttpRequestPtr& request);
+    void prioritize(const HttpRequestPtr& request);
+    void retire();
     void done(HttpConnectionManager* manager, bool error);
+    void startIdleTimer(unsigned timeout);
+
+    template<typename Handler>
+    struct SecureHandler
+    {
+        std::shared_ptr<SecureSocket> stream;
+        Handler handler;
+
+        SecureHandler(const std::shared_ptr<SecureSocket>& stream, Handler handler) :
+            stream(stream),
+            handler(handler)
+        {
+        }
+        void operator()(const boost::system::error_code& error) {
+            handler(error);
+        }
+        void operator()(const boost::system::error_code& error, std::size_t transferred) {
+            handler(error, transferred);
+        }
+    };
+
+    template<typename Handler>
+    SecureHandler<Handler> holdSecureSocket(Handler handler) {
+        return SecureHandler<Handler>(secureSocket, handler);
+    }
 
     template<typename CompletionCondition, typename ReadHandler>
     void asyncRead(boost::asio::streambuf& buffers, CompletionCondition completionCondition, ReadHandler handler) {
         if (protocol == "https:")
-            boost::asio::async_read(secureSocket, buffers, completionCondition, handler);
+            boost::asio::async_read(*secureSocket, buffers, completionCondition, strand.wrap(holdSecureSocket(handler)));
         else
-            boost::asio::async_read(socket, buffers, completionCondition, handler);
+            boost::asio::async_read(socket, buffers, completionCondition, strand.wrap(handler));
     }
 
     template<typename WriteHandler>
     void asyncWrite(boost::asio::streambuf& buffers, WriteHandler handler) {
         if (protocol == "https:")
-            boost::asio::async_write(secureSocket, buffers, handler);
+            boost::asio::async_write(*secureSocket, buffers, strand.wrap(holdSecureSocket(handler)));
         else
-            boost::asio::async_write(socket, buffers, handler);
+            boost::asio::async_write(socket, buffers, strand.wrap(handler));
     }
 
 public:
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTTPContentDecoder.h"
+
+#include <string.h>
+
+#include "http/HTTPResponseMessage.h"
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+HttpContentDecoder::HttpContentDecoder() :
+    encoding(HttpResponseMessage::Identity),
+    active(false),
+    finished(false),
+    raw(false),
+    headerLength(0),
+    decodedLength(0)
+{
+    memset(&stream, 0, sizeof stream);
+}
+
+HttpContentDecoder::~HttpContentDecoder()
+{
+    end();
+}
+
+bool HttpContentDecoder::init(int windowBits)
+{
+    memset(&stream, 0, sizeof stream);
+    if (inflateInit2(&stream, windowBits) != Z_OK)
+        return false;
+    active = true;
+    return true;
+}
+
+bool HttpContentDecoder::start(int encoding)
+{
+    end();
+    this->encoding = encoding;
+    finished = false;
+    raw = false;
+    headerLength = 0;
+    decodedLength = 0;
+    switch (encoding) {
+    case HttpResponseMessage::Gzip:
+        return init(MAX_WBITS + 16);
+    case HttpResponseMessage::Deflate:
+        return init(MAX_WBITS);
+    default:
+        return false;
+    }
+}
+
+void HttpContentDecoder::end()
+{
+    if (active) {
+        inflateEnd(&stream);
+        active = false;
+    }
+}
+
+bool HttpContentDecoder::write(std::ostream& content, const char* data, size_t length)
+{
+    if (!active)
+        return false;
+    if (encoding == HttpResponseMessage::Deflate && !raw) {
+        // Keep the zlib header in case the data turns out to be raw deflate data.
+        while (headerLength < sizeof header && headerLength < stream.total_in + length) {
+            header[headerLength] = data[headerLength - stream.total_in];
+            ++headerLength;
+        }
+    }
+    char buffer[BufferSize];
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+    while (!finished) {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = BufferSize;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        size_t decoded = BufferSize - stream.avail_out;
+        if (result == Z_DATA_ERROR && encoding == HttpResponseMessage::Deflate && !raw && stream.total_out == 0) {
+            // Some servers send raw deflate data without the zlib header.
+            size_t previous = stream.total_in - (length - stream.avail_in);
+            if (headerLength < previous)
+                return false;
+            inflateEnd(&stream);
+            active = false;
+            if (!init(-MAX_WBITS))
+                return false;
+            raw = true;
+            return write(content, header, previous) && write(content, data, length);
+        }
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+            return false;
+        if (0 < decoded) {
+            content.write(buffer, decoded);
+            decodedLength += decoded;
+        }
+        if (result == Z_STREAM_END) {
+            // A gzip stream may consist of multiple members, and the next
+            // one may start in the next write().
+            if (encoding == HttpResponseMessage::Gzip)
+                inflateReset(&stream);
+            else
+                finished = true;
+        } else if (result == Z_BUF_ERROR && decoded == 0)
+            break;
+        // Note inflate() might have more output pending if buffer is full.
+        if (stream.avail_in == 0 && 0 < stream.avail_out)
+            break;
+    }
+    return true;
+}
+
+}}}}  // org::w3c::dom::bootstrap
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTTP_CONTENT_DECODER_H
+#define ES_HTTP_CONTENT_DECODER_H
+
+#include <ostream>
+
+#include <zlib.h>
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+// HttpContentDecoder inflates a gzip or deflate encoded entity-body
+// incrementally as it arrives from the network.
+class HttpContentDecoder
+{
+    static const size_t BufferSize = 16384;
+
+    z_stream stream;
+    int encoding;
+    bool active;
+    bool finished;
+    bool raw;       // raw deflate data without the zlib header
+    char header[2];
+    size_t headerLength;
+    unsigned long long decodedLength;
+
+    bool init(int windowBits);
+
+public:
+    HttpContentDecoder();
+    ~HttpContentDecoder();
+
+    // Returns false if the specified content coding is not supported.
+    bool start(int encoding);
+    void end();
+
+    bool isActive() const {
+        return active;
+    }
+    unsigned long long getDecodedLength() const {
+        return decodedLength;
+    }
+
+    // Decodes length bytes of data and writes the result to content.
+    // Returns false on a corrupted stream.
+    bool write(std::ostream& content, const char* data, size_t length);
+};
+
+}}}}  // org::w3c::dom::bootstrap
+
+#endif  // ES_HTTP_CONTENT_DECODER_H
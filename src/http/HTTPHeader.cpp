@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <algorithm>
+#include <vector>
 
 #include "http/HTTPUtil.h"
 
@@ -68,9 +69,89 @@ namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
 using namespace http;
 
+namespace {
+
+// knownHeaders must be in sync with the IDs in HttpHeader
+const char* const knownHeaders[HttpHeader::KnownHeaderCount] = {
+    "Accept-Encoding",
+    "Accept-Ranges",
+    "Age",
+    "Allow",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Date",
+    "ETag",
+    "Expires",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Keep-Alive",
+    "Last-Modified",
+    "Location",
+    "Pragma",
+    "Proxy-Authenticate",
+    "Proxy-Authorization",
+    "Range",
+    "TE",
+    "Trailers",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent"
+};
+
+const size_t MaxKnownHeaderLength = 19;     // "Proxy-Authorization"
+
+// Groups the known header names by their lengths so that a lookup compares
+// only a few names.
+struct KnownHeaderTable
+{
+    std::vector<int> byLength[MaxKnownHeaderLength + 1];
+
+    KnownHeaderTable() {
+        for (int id = 0; id < HttpHeader::KnownHeaderCount; ++id)
+            byLength[strlen(knownHeaders[id])].push_back(id);
+    }
+};
+
+}
+
+int HttpHeader::lookup(const char* name, size_t length)
+{
+    static const KnownHeaderTable table;
+    if (MaxKnownHeaderLength < length)
+        return Unknown;
+    const std::vector<int>& candidates(table.byLength[length]);
+    for (auto i = candidates.begin(); i != candidates.end(); ++i) {
+        if (strncasecmp(knownHeaders[*i], name, length) == 0)
+            return *i;
+    }
+    return Unknown;
+}
+
+void HttpHeaderList::reindex()
+{
+    std::fill(index, index + HttpHeader::KnownHeaderCount, -1);
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].id != HttpHeader::Unknown)
+            index[headers[i].id] = i;
+    }
+}
+
+std::deque<HttpHeader>::const_iterator HttpHeaderList::find(const std::string& header, int id) const
+{
+    if (id != HttpHeader::Unknown)
+        return (0 <= index[id]) ? headers.begin() + index[id] : headers.end();
+    return std::find(headers.begin(), headers.end(), header);
+}
+
 bool HttpHeaderList::get(const std::string& header, std::string& value) const
 {
-    auto it = std::find(headers.begin(), headers.end(), header);
+    auto it = find(header, HttpHeader::lookup(header.c_str(), header.length()));
     if (it != headers.end()) {
         value = it->value;
         return true;
@@ -80,67 +161,67 @@ bool HttpHeaderList::get(const std::string& header, std::string& value) const
 
 void HttpHeaderList::erase(const std::string& header)
 {
-    auto it = std::find(headers.begin(), headers.end(), header);
-    if (it != headers.end())
+    auto it = find(header, HttpHeader::lookup(header.c_str(), header.length()));
+    if (it != headers.end()) {
         headers.erase(it);
+        reindex();
+    }
 }
 
 void HttpHeaderList::set(const std::string& header, const std::string& value, bool merge)
 {
     std::string v = value;
     trimLWS(v);
-    auto it = std::find(headers.begin(), headers.end(), header);
-    if (v.empty()) {
-        if (!merge && it != headers.end())
-            headers.erase(it);
+    set(header, HttpHeader::lookup(header.c_str(), header.length()), v, merge);
+}
+
+void HttpHeaderList::set(const std::string& header, int id, const std::string& value, bool merge)
+{
+    auto found = find(header, id);
+    if (value.empty()) {
+        if (!merge && found != headers.end()) {
+            headers.erase(found);
+            reindex();
+        }
         return;
     }
-    if (it == headers.end()) {
-        headers.push_back(HttpHeader{header, v});
+    if (found == headers.end()) {
+        headers.push_back(HttpHeader());
+        HttpHeader& added(headers.back());
+        added.header = header;
+        added.value = value;
+        added.id = id;
+        if (id != HttpHeader::Unknown)
+            index[id] = headers.size() - 1;
         return;
     }
+    HttpHeader& existing(headers[found - headers.begin()]);
     if (merge && canCommaSeparated(header)) {
-        it->value += ", " + v;
+        existing.value += ", " + value;
         return;
     }
-    it->value = v;  // replace the existing value
+    existing.value = value;  // replace the existing value
 }
 
 const char* HttpHeaderList::parseLine(const char* start, const char* const end, HttpHeader* p)
 {
-    const char* name = start;
-    const char* colon = 0;
-    while (start < end) {
-        if (*start == ':') {
-            colon = start++;
-            break;
-        }
-        ++start;
-    }
-    if (!colon || !isValidToken(name, colon))
+    const char* eol = static_cast<const char*>(memchr(start, '\n', end - start));
+    if (!eol)
         return 0;
-    const char* field = start;
-    const char* eol = field;
-    const char* eof = eol;
-    while (eol < end) {
-        char c = *eol;
-        if (c == '\n')  // LF?
-            break;
-        if (!isLWS(c)) {
-            eof = eol + 1;
-            if (field == start)
-                field = eol;
-        }
-        ++eol;
-    }
-    if (*eol != '\n')
+    const char* colon = static_cast<const char*>(memchr(start, ':', eol - start));
+    if (!colon || !isValidToken(start, colon))
         return 0;
-    start = eol + 1;
-    HttpHeader header(std::string(name, colon - name), std::string(field, eof - field));
-    set(header.header, header.value);
+    const char* field = colon + 1;
+    const char* fieldEnd = eol;
+    while (field < fieldEnd && isLWS(*field))
+        ++field;
+    while (field < fieldEnd && isLWS(fieldEnd[-1]))
+        --fieldEnd;
+    HttpHeader header(std::string(start, colon - start), std::string(field, fieldEnd - field));
+    set(header.header, header.id, header.value, false);
     if (p)
         *p = header;
-    return start;
+    return eol + 1;
 }
 
 bool HttpHeaderList::parse(const char* start, const char* const end)
@@ -17,6 +17,7 @@
 #ifndef ES_HTTP_HEADER_H
 #define ES_HTTP_HEADER_H
 
+#include <algorithm>
 #include <deque>
 #include <string>
 #include <cstring>
@@ -26,29 +27,89 @@ namespace org { namespace w3c { namespace dom { namespace bootstrap {
 class HttpHeader
 {
 public:
+    // IDs of the header names known to this implementation. Looking up a
+    // header by its ID does not compare the names.
+    enum {
+        Unknown = -1,
+        AcceptEncoding,
+        AcceptRanges,
+        Age,
+        Allow,
+        CacheControl,
+        Connection,
+        ContentEncoding,
+        ContentLength,
+        ContentRange,
+        ContentType,
+        Date,
+        ETag,
+        Expires,
+        Host,
+        IfModifiedSince,
+        IfNoneMatch,
+        IfRange,
+        KeepAlive,
+        LastModified,
+        Location,
+        Pragma,
+        ProxyAuthenticate,
+        ProxyAuthorization,
+        Range,
+        TE,
+        Trailers,
+        TransferEncoding,
+        Upgrade,
+        UserAgent,
+        KnownHeaderCount
+    };
+
     std::string header;
     std::string value;
-    HttpHeader() {}
+    int id;
+
+    HttpHeader() :
+        id(Unknown)
+    {
+    }
     HttpHeader(const std::string& header, const std::string& value) :
         header(header),
-        value(value)
+        value(value),
+        id(lookup(header.c_str(), header.length()))
     {
     }
     bool operator==(const std::string& header) const {
         return strcasecmp(this->header.c_str(), header.c_str()) == 0;
     }
+
+    // Returns the ID of the specified header name, or Unknown.
+    static int lookup(const char* name, size_t length);
 };
 
 class HttpHeaderList
 {
     std::deque<HttpHeader> headers;
+    short index[HttpHeader::KnownHeaderCount];  // position in headers, or -1
+
+    void reindex();
+    std::deque<HttpHeader>::const_iterator find(const std::string& header, int id) const;
+    void set(const std::string& header, int id, const std::string& value, bool merge);
+
 public:
+    HttpHeaderList() {
+        std::fill(index, index + HttpHeader::KnownHeaderCount, -1);
+    }
+
     bool get(const std::string& header, std::string& value) const;
+    // Returns the value of the known header, or zero if it is not present.
+    const std::string* get(int id) const {
+        return (0 <= id && id < HttpHeader::KnownHeaderCount && 0 <= index[id]) ? &headers[index[id]].value : 0;
+    }
     void set(const std::string& header, const std::string& value, bool merge = false);
     void erase(const std::string& header);
 
     void clear() {
         headers.clear();
+        std::fill(index, index + HttpHeader::KnownHeaderCount, -1);
     }
 
     size_t size() const {
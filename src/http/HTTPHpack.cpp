@@ -0,0 +1,470 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTTPHpack.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+using namespace http;
+
+namespace {
+
+// RFC 7541 Appendix A
+const struct {
+    const char* name;
+    const char* value;
+} staticTable[HttpHpackTable::StaticTableLength] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+// RFC 7541 Appendix B; the code of EOS (256) is 0x3fffffff in 30 bits.
+const unsigned huffmanCodes[256] = {
+    0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+    0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+    0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+    0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+    0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+    0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+    0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+    0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+    0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+    0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+    0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+    0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+    0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+    0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+    0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+    0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+    0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+    0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+    0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+    0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+    0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+    0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+    0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+    0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+    0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+    0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+    0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+    0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+    0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+    0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+    0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+    0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+};
+
+const unsigned char huffmanLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+const int EOS = 256;
+const int MaxHuffmanLength = 30;
+
+// The Huffman code of HPACK is canonical, i.e., the codes of the same
+// length are consecutive in the order of the symbols, and each length
+// starts right after the last code of the shorter length shifted left.
+// A code can therefore be decoded bit by bit by comparing it with the first
+// code of its length.
+struct HuffmanDecodingTable
+{
+    unsigned first[MaxHuffmanLength + 1];   // the first code of each length
+    unsigned count[MaxHuffmanLength + 1];   // the number of codes of each length
+    unsigned offset[MaxHuffmanLength + 1];  // the position of the first code in symbols
+    unsigned short symbols[EOS + 1];        // sorted by code
+
+    HuffmanDecodingTable() {
+        std::fill(count, count + MaxHuffmanLength + 1, 0);
+        for (int c = 0; c < EOS; ++c)
+            ++count[huffmanLengths[c]];
+        ++count[MaxHuffmanLength];   // EOS
+        unsigned code = 0;
+        unsigned position = 0;
+        for (int length = 0; length <= MaxHuffmanLength; ++length) {
+            first[length] = code;
+            offset[length] = position;
+            position += count[length];
+            code = (code + count[length]) << 1;
+        }
+        unsigned filled[MaxHuffmanLength + 1];
+        std::copy(offset, offset + MaxHuffmanLength + 1, filled);
+        for (int c = 0; c < EOS; ++c)
+            symbols[filled[huffmanLengths[c]]++] = c;
+        symbols[filled[MaxHuffmanLength]++] = EOS;
+    }
+};
+
+}
+
+namespace http {
+
+void encodeHpackInteger(std::string& s, unsigned long long value, int prefix, unsigned char flags)
+{
+    unsigned max = (1u << prefix) - 1;
+    if (value < max) {
+        s += static_cast<char>(flags | value);
+        return;
+    }
+    s += static_cast<char>(flags | max);
+    value -= max;
+    while (128 <= value) {
+        s += static_cast<char>(0x80 | (value & 0x7f));
+        value >>= 7;
+    }
+    s += static_cast<char>(value);
+}
+
+const char* decodeHpackInteger(const char* start, const char* const end, int prefix, unsigned long long& value)
+{
+    if (end <= start)
+        return 0;
+    unsigned max = (1u << prefix) - 1;
+    value = static_cast<unsigned char>(*start++) & max;
+    if (value < max)
+        return start;
+    for (int shift = 0; start < end; shift += 7) {
+        if (56 < shift)
+            return 0;   // too large
+        unsigned char c = *start++;
+        value += static_cast<unsigned long long>(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return start;
+    }
+    return 0;
+}
+
+size_t getHuffmanEncodedLength(const std::string& value)
+{
+    unsigned long long bits = 0;
+    for (auto i = value.begin(); i != value.end(); ++i)
+        bits += huffmanLengths[static_cast<unsigned char>(*i)];
+    return (bits + 7) / 8;
+}
+
+void encodeHuffman(std::string& s, const std::string& value)
+{
+    unsigned long long buffer = 0;
+    int bits = 0;
+    for (auto i = value.begin(); i != value.end(); ++i) {
+        unsigned char c = *i;
+        buffer = (buffer << huffmanLengths[c]) | huffmanCodes[c];
+        bits += huffmanLengths[c];
+        while (8 <= bits) {
+            bits -= 8;
+            s += static_cast<char>(buffer >> bits);
+        }
+    }
+    if (bits)   // pad with the most significant bits of EOS
+        s += static_cast<char>((buffer << (8 - bits)) | (0xff >> bits));
+}
+
+bool decodeHuffman(const char* start, const char* const end, std::string& value)
+{
+    static const HuffmanDecodingTable table;
+    unsigned code = 0;
+    int length = 0;
+    for (; start < end; ++start) {
+        unsigned char c = *start;
+        for (int bit = 7; 0 <= bit; --bit) {
+            code = (code << 1) | ((c >> bit) & 1);
+            ++length;
+            unsigned index = code - table.first[length];
+            if (index < table.count[length]) {
+                unsigned short symbol = table.symbols[table.offset[length] + index];
+                if (symbol == EOS)
+                    return false;
+                value += static_cast<char>(symbol);
+                code = 0;
+                length = 0;
+            } else if (MaxHuffmanLength <= length)
+                return false;
+        }
+    }
+    // The padding must be shorter than 8 bits and match the prefix of EOS.
+    return length < 8 && code == (1u << length) - 1;
+}
+
+void encodeHpackString(std::string& s, const std::string& value)
+{
+    size_t length = getHuffmanEncodedLength(value);
+    if (length < value.length()) {
+        encodeHpackInteger(s, length, 7, 0x80);
+        encodeHuffman(s, value);
+    } else {
+        encodeHpackInteger(s, value.length(), 7, 0);
+        s += value;
+    }
+}
+
+const char* decodeHpackString(const char* start, const char* const end, std::string& value)
+{
+    if (end <= start)
+        return 0;
+    bool huffman = *start & 0x80;
+    unsigned long long length;
+    start = decodeHpackInteger(start, end, 7, length);
+    if (!start || static_cast<unsigned long long>(end - start) < length)
+        return 0;
+    value.clear();
+    if (!huffman)
+        value.assign(start, length);
+    else if (!decodeHuffman(start, start + length, value))
+        return 0;
+    return start + length;
+}
+
+}  // http
+
+const size_t HttpHpackTable::StaticTableLength;
+const size_t HttpHpackTable::DefaultMaxSize;
+const size_t HttpHpackTable::EntryOverhead;
+
+void HttpHpackTable::evict(size_t limit)
+{
+    while (limit < size && !entries.empty()) {
+        const HttpHpackField& field(entries.back());
+        size -= field.first.length() + field.second.length() + EntryOverhead;
+        entries.pop_back();
+    }
+}
+
+void HttpHpackTable::setMaxSize(size_t value)
+{
+    maxSize = value;
+    evict(maxSize);
+}
+
+const HttpHpackField* HttpHpackTable::get(size_t index) const
+{
+    static const struct StaticFields : public std::vector<HttpHpackField> {
+        StaticFields() {
+            for (auto i = std::begin(staticTable); i != std::end(staticTable); ++i)
+                emplace_back(i->name, i->value);
+        }
+    } fields;
+    if (index == 0)
+        return 0;
+    if (index <= StaticTableLength)
+        return &fields[index - 1];
+    index -= StaticTableLength + 1;
+    return (index < entries.size()) ? &entries[index] : 0;
+}
+
+void HttpHpackTable::add(const std::string& name, const std::string& value)
+{
+    size_t entrySize = name.length() + value.length() + EntryOverhead;
+    if (maxSize < entrySize) {
+        // An entry larger than the table empties it without being added.
+        evict(0);
+        return;
+    }
+    evict(maxSize - entrySize);
+    entries.push_front(HttpHpackField(name, value));
+    size += entrySize;
+}
+
+size_t HttpHpackTable::find(const std::string& name, const std::string& value, bool& matched) const
+{
+    size_t found = 0;
+    matched = false;
+    for (size_t i = 0; i < StaticTableLength; ++i) {
+        if (name != staticTable[i].name)
+            continue;
+        if (value == staticTable[i].value) {
+            matched = true;
+            return i + 1;
+        }
+        if (!found)
+            found = i + 1;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (name != entries[i].first)
+            continue;
+        if (value == entries[i].second) {
+            matched = true;
+            return StaticTableLength + i + 1;
+        }
+        if (!found)
+            found = StaticTableLength + i + 1;
+    }
+    return found;
+}
+
+void HttpHpackEncoder::setMaxSize(size_t value)
+{
+    value = std::min(value, HttpHpackTable::DefaultMaxSize);
+    lowest = resized ? std::min(lowest, value) : value;
+    limit = value;
+    resized = true;
+}
+
+void HttpHpackEncoder::begin(std::string& block)
+{
+    if (!resized)
+        return;
+    // The decoder has to see the smallest size if the size has been
+    // reduced and then increased since the last header block.
+    if (lowest < limit) {
+        table.setMaxSize(lowest);
+        encodeHpackInteger(block, lowest, 5, 0x20);
+    }
+    table.setMaxSize(limit);
+    encodeHpackInteger(block, limit, 5, 0x20);
+    resized = false;
+}
+
+void HttpHpackEncoder::encode(std::string& block, const std::string& name, const std::string& value, bool indexed)
+{
+    bool matched;
+    size_t index = table.find(name, value, matched);
+    if (index && matched) {
+        encodeHpackInteger(block, index, 7, 0x80);
+        return;
+    }
+    if (indexed)
+        encodeHpackInteger(block, index, 6, 0x40);      // literal with incremental indexing
+    else
+        encodeHpackInteger(block, index, 4, 0x00);      // literal without indexing
+    if (!index)
+        encodeHpackString(block, name);
+    encodeHpackString(block, value);
+    if (indexed)
+        table.add(name, value);
+}
+
+bool HttpHpackDecoder::decode(const char* start, const char* const end, HttpHpackFieldList& fields)
+{
+    bool first = true;
+    while (start < end) {
+        unsigned char c = *start;
+        unsigned long long index;
+        if (c & 0x80) {
+            // indexed header field
+            start = decodeHpackInteger(start, end, 7, index);
+            const HttpHpackField* field = start ? table.get(index) : 0;
+            if (!field)
+                return false;
+            fields.push_back(*field);
+        } else if ((c & 0xe0) == 0x20) {
+            // dynamic table size update, which must come first in the block
+            start = decodeHpackInteger(start, end, 5, index);
+            if (!start || !first || limit < index)
+                return false;
+            table.setMaxSize(index);
+            continue;
+        } else {
+            int prefix = (c & 0x40) ? 6 : 4;
+            start = decodeHpackInteger(start, end, prefix, index);
+            if (!start)
+                return false;
+            HttpHpackField field;
+            if (index) {
+                const HttpHpackField* named = table.get(index);
+                if (!named)
+                    return false;
+                field.first = named->first;
+            } else if (!(start = decodeHpackString(start, end, field.first)))
+                return false;
+            if (!(start = decodeHpackString(start, end, field.second)))
+                return false;
+            if (prefix == 6)
+                table.add(field.first, field.second);
+            fields.push_back(field);
+        }
+        first = false;
+    }
+    return true;
+}
+
+}}}}  // org::w3c::dom::bootstrap
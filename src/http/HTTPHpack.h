@@ -0,0 +1,151 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTTP_HPACK_H
+#define ES_HTTP_HPACK_H
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+// cf. RFC 7541 HPACK: Header Compression for HTTP/2
+
+typedef std::pair<std::string, std::string> HttpHpackField;
+typedef std::vector<HttpHpackField> HttpHpackFieldList;
+
+// HttpHpackTable is the index address space of HPACK, i.e., the static table
+// followed by the dynamic table. The encoder and the decoder of a connection
+// keep their own dynamic tables, each of which mirrors the one of the peer.
+class HttpHpackTable
+{
+    std::deque<HttpHpackField> entries;     // the newest entry first
+    size_t size;
+    size_t maxSize;
+
+    void evict(size_t limit);
+
+public:
+    static const size_t StaticTableLength = 61;
+    static const size_t DefaultMaxSize = 4096;
+    static const size_t EntryOverhead = 32;
+
+    HttpHpackTable() :
+        size(0),
+        maxSize(DefaultMaxSize)
+    {
+    }
+
+    size_t getLength() const {
+        return StaticTableLength + entries.size();
+    }
+    size_t getSize() const {
+        return size;
+    }
+    size_t getMaxSize() const {
+        return maxSize;
+    }
+    void setMaxSize(size_t value);
+
+    // Returns the entry at the 1-based index, or zero if there is none.
+    const HttpHpackField* get(size_t index) const;
+    void add(const std::string& name, const std::string& value);
+
+    // Returns the index of the entry that matches both name and value, or
+    // else the index of the entry that matches name, with matched set to
+    // false. Returns zero if neither is found.
+    size_t find(const std::string& name, const std::string& value, bool& matched) const;
+};
+
+class HttpHpackEncoder
+{
+    HttpHpackTable table;
+    size_t limit;           // SETTINGS_HEADER_TABLE_SIZE of the peer
+    size_t lowest;          // the smallest limit since the last header block
+    bool resized;           // a dynamic table size update has to be sent
+
+public:
+    HttpHpackEncoder() :
+        limit(HttpHpackTable::DefaultMaxSize),
+        lowest(HttpHpackTable::DefaultMaxSize),
+        resized(false)
+    {
+    }
+
+    const HttpHpackTable& getTable() const {
+        return table;
+    }
+
+    // Called upon SETTINGS_HEADER_TABLE_SIZE from the peer.
+    void setMaxSize(size_t value);
+
+    // Appends the representation of a header field to block. A field that
+    // is not indexed is never added to the dynamic table, e.g., the one
+    // that varies with each request or carries a credential.
+    void encode(std::string& block, const std::string& name, const std::string& value, bool indexed = true);
+    // Starts a new header block.
+    void begin(std::string& block);
+};
+
+class HttpHpackDecoder
+{
+    HttpHpackTable table;
+    size_t limit;           // our SETTINGS_HEADER_TABLE_SIZE
+
+public:
+    HttpHpackDecoder() :
+        limit(HttpHpackTable::DefaultMaxSize)
+    {
+    }
+
+    const HttpHpackTable& getTable() const {
+        return table;
+    }
+
+    // Called when we advertise a new SETTINGS_HEADER_TABLE_SIZE.
+    void setMaxSize(size_t value) {
+        limit = value;
+        table.setMaxSize(value);
+    }
+
+    // Decodes a complete header block. Returns false on a compression
+    // error, after which the connection cannot be used any more.
+    bool decode(const char* start, const char* const end, HttpHpackFieldList& fields);
+};
+
+namespace http {
+
+// Appends an HPACK integer with the specified prefix length; the first
+// byte is or-ed with flags.
+void encodeHpackInteger(std::string& s, unsigned long long value, int prefix, unsigned char flags);
+// Returns the position next to the integer, or zero if it is malformed or
+// incomplete.
+const char* decodeHpackInteger(const char* start, const char* const end, int prefix, unsigned long long& value);
+
+void encodeHpackString(std::string& s, const std::string& value);
+const char* decodeHpackString(const char* start, const char* const end, std::string& value);
+
+size_t getHuffmanEncodedLength(const std::string& value);
+void encodeHuffman(std::string& s, const std::string& value);
+bool decodeHuffman(const char* start, const char* const end, std::string& value);
+
+}  // http
+
+}}}}  // org::w3c::dom::bootstrap
+
+#endif  // ES_HTTP_HPACK_H
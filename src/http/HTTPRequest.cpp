@@ -16,10 +16,15 @@
 
 #include "HTTPRequest.h"
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -44,6 +49,232 @@ const unsigned short HttpRequest::DONE;
 std::string HttpRequest::aboutPath;
 std::string HttpRequest::cachePath("/tmp");
 
+double HttpTiming::now()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool HttpContentBuffer::open(const std::string& directory)
+{
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    this->directory = directory;
+    body.reset(new(std::nothrow) std::string);
+    if (!body)
+        return false;
+    active = true;
+    return true;
+}
+
+std::streamsize HttpContentBuffer::resume(const std::string& directory, const std::string& path, const std::shared_ptr<std::string>& partial)
+{
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    this->directory = directory;
+    if (!path.empty()) {
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0)
+            return -1;
+        file.open(path.c_str(), std::ios_base::app | std::ios_base::out | std::ios::binary);
+        if (!file.is_open())
+            return -1;
+        filePath = path;
+        body.reset();
+        written = available = status.st_size;
+    } else if (partial) {
+        // Copy the partial entity-body as it might still be shared with other requests.
+        body.reset(new(std::nothrow) std::string(*partial));
+        if (!body)
+            return -1;
+        written = available = body->length();
+    } else
+        return -1;
+    active = true;
+    return written;
+}
+
+void HttpContentBuffer::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open())
+        file.close();
+    if (readDescriptor != -1) {
+        ::close(readDescriptor);
+        readDescriptor = -1;
+    }
+    active = false;
+    written = available = 0;
+    finished = false;
+    ++generation;
+    arrived.notify_all();
+}
+
+bool HttpContentBuffer::spill()
+{
+    char tempPath[PATH_MAX];
+    if (PATH_MAX <= directory.length() + 16)
+        return false;
+    strcpy(tempPath, directory.c_str());
+    strcat(tempPath, "/esrille-XXXXXX");
+    int fd = mkstemp(tempPath);
+    if (fd == -1)
+        return false;
+    file.open(tempPath, std::ios_base::trunc | std::ios_base::out | std::ios::binary);
+    ::close(fd);
+    if (!file.is_open()) {
+        remove(tempPath);
+        return false;
+    }
+    filePath = tempPath;
+    std::streamsize length = body->length();
+    if (0 < length && (file.sputn(body->data(), length) != length || file.pubsync() != 0))
+        return false;
+    body.reset();
+    return true;
+}
+
+std::streamsize HttpContentBuffer::xsputn(const char* s, std::streamsize n)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!active)
+        return 0;
+    if (!file.is_open()) {
+        if (body->length() + n <= MemoryLimit) {
+            body->append(s, n);
+            written = available = body->length();
+            arrived.notify_all();
+            return n;
+        }
+        if (!spill())
+            return 0;
+    }
+    n = file.sputn(s, n);
+    written += n;
+    return n;
+}
+
+HttpContentBuffer::int_type HttpContentBuffer::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    char ch = traits_type::to_char_type(c);
+    return (xsputn(&ch, 1) == 1) ? c : traits_type::eof();
+}
+
+int HttpContentBuffer::sync()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open())
+        return 0;
+    if (file.pubsync() != 0)
+        return -1;
+    available = written;
+    arrived.notify_all();
+    return 0;
+}
+
+void HttpContentBuffer::cutOff()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+    arrived.notify_all();
+}
+
+std::streamsize HttpContentBuffer::getAvailable()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return available;
+}
+
+unsigned HttpContentBuffer::getGeneration()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return generation;
+}
+
+std::streamsize HttpContentBuffer::read(unsigned generation, std::streamsize offset, char* s, std::streamsize n)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (generation != this->generation)
+            return -1;
+        std::streamsize length = std::min(n, available - offset);
+        if (0 < length) {
+            if (body) {
+                memcpy(s, body->data() + offset, length);
+                return length;
+            }
+            if (readDescriptor == -1)
+                readDescriptor = ::open(filePath.c_str(), O_RDONLY, 0);
+            length = pread(readDescriptor, s, length, offset);
+            return (0 < length) ? length : -1;
+        }
+        if (finished)
+            return -1;
+        arrived.wait(lock);
+    }
+}
+
+void HttpContentBuffer::finish()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    arrived.notify_all();
+}
+
+HttpMappedFile::HttpMappedFile(const std::string& path) :
+    path(path),
+    address(0),
+    length(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && 0 < status.st_size) {
+        void* mapped = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, status.st_size, MADV_SEQUENTIAL);
+            address = mapped;
+            length = status.st_size;
+        }
+    }
+    ::close(fd);
+}
+
+HttpMappedFile::~HttpMappedFile()
+{
+    if (address)
+        munmap(address, length);
+}
+
+void HttpContentSource::cutOff()
+{
+    if (request)
+        request->contentBuffer.cutOff();
+}
+
+std::streamsize HttpContentSource::read(char* s, std::streamsize n)
+{
+    if (request) {
+        n = request->contentBuffer.read(generation, position, s, n);
+        if (0 < n)
+            position += n;
+        return n;
+    }
+    if (data) {
+        n = std::min(n, length - position);
+        if (n <= 0)
+            return -1;
+        memcpy(s, data + position, n);
+        position += n;
+        return n;
+    }
+    if (file.is_open())
+        return file.read(s, n);
+    return -1;
+}
+
 int HttpRequest::getContentDescriptor()
 {
     if (filePath.empty())
@@ -51,32 +282,179 @@ int HttpRequest::getContentDescriptor()
     return ::open(filePath.c_str(), O_RDONLY, 0);
 }
 
+HttpMappedFilePtr HttpRequest::getMappedFile()
+{
+    if (body || filePath.empty() || readyState < COMPLETE)
+        return nullptr;
+    if (!mappedFile || mappedFile->getPath() != filePath) {
+        mappedFile.reset(new(std::nothrow) HttpMappedFile(filePath));
+        if (mappedFile && !mappedFile->isOpen())
+            mappedFile.reset();
+    }
+    return mappedFile;
+}
+
+HttpContentSource HttpRequest::getContentSource()
+{
+    if (body)
+        return HttpContentSource(body);
+    if (HttpMappedFilePtr mapped = getMappedFile())
+        return HttpContentSource(mapped);
+    return HttpContentSource(getContentDescriptor());
+}
+
+namespace {
+
+// SpanFile is the cookie of a FILE object that reads a span in memory. It
+// keeps the owner of the span alive until the FILE object is closed, so
+// that the entity-body can be replaced or remapped in the meantime.
+struct SpanFile
+{
+    std::shared_ptr<const void> owner;
+    const char* data;
+    size_t length;
+    size_t position;
+};
+
+ssize_t readSpanFile(void* cookie, char* buffer, size_t size)
+{
+    SpanFile* span = static_cast<SpanFile*>(cookie);
+    size = std::min(size, span->length - span->position);
+    memcpy(buffer, span->data + span->position, size);
+    span->position += size;
+    return size;
+}
+
+int seekSpanFile(void* cookie, off64_t* offset, int whence)
+{
+    SpanFile* span = static_cast<SpanFile*>(cookie);
+    off64_t position = *offset;
+    if (whence == SEEK_CUR)
+        position += span->position;
+    else if (whence == SEEK_END)
+        position += span->length;
+    if (position < 0 || static_cast<off64_t>(span->length) < position)
+        return -1;
+    span->position = *offset = position;
+    return 0;
+}
+
+int closeSpanFile(void* cookie)
+{
+    delete static_cast<SpanFile*>(cookie);
+    return 0;
+}
+
+std::FILE* openSpanFile(const std::shared_ptr<const void>& owner, const char* data, size_t length)
+{
+    SpanFile* span = new(std::nothrow) SpanFile{ owner, data, length, 0 };
+    if (!span)
+        return 0;
+    cookie_io_functions_t functions = { readSpanFile, 0, seekSpanFile, closeSpanFile };
+    std::FILE* file = fopencookie(span, "rb", functions);
+    if (!file)
+        delete span;
+    return file;
+}
+
+}
+
 std::FILE* HttpRequest::openFile()
 {
+    if (body) {
+        if (body->empty())
+            return 0;
+        return openSpanFile(body, body->data(), body->length());
+    }
+    if (HttpMappedFilePtr mapped = getMappedFile())
+        return openSpanFile(mapped, mapped->data(), mapped->size());
     if (filePath.empty())
         return 0;
     return fopen(filePath.c_str(), "rb");
 }
 
-std::fstream& HttpRequest::getContent()
+std::ostream& HttpRequest::getContent()
 {
-    if (content.is_open())
+    if (contentBuffer.isOpen())
         return content;
 
-    char tempPath[PATH_MAX];
-    if (PATH_MAX <= cachePath.length() + 9)
-        return content;
-    strcpy(tempPath, cachePath.c_str());
-    strcat(tempPath, "/esrille-XXXXXX");
-    int fd = mkstemp(tempPath);
-    if (fd == -1)
-        return content;
-    filePath = tempPath;
-    content.open(tempPath, std::ios_base::trunc | std::ios_base::in | std::ios_base::out | std::ios::binary);
-    close(fd);
+    content.clear();
+    if (!contentBuffer.open(cachePath))
+        content.setstate(std::ios_base::badbit);
     return content;
 }
 
+// Called on the network thread each time a part of the entity-body has been
+// received.
+void HttpRequest::progress()
+{
+    if (readyState != LOADING) {
+        // Note redirections and 304 responses are resolved once completed.
+        if (response.shouldRedirect() || response.getStatus() == 304)
+            return;
+        readyState = LOADING;
+    }
+    content.flush();
+}
+
+unsigned long long HttpRequest::resume(const HttpBodyFilePtr& file, const std::shared_ptr<std::string>& partial)
+{
+    std::streamsize length = contentBuffer.resume(cachePath, file ? file->getPath() : std::string(), partial);
+    if (length <= 0) {
+        contentBuffer.close();
+        filePath.clear();
+        body.reset();
+        return 0;
+    }
+    if (!filePath.empty())
+        bodyFile = file;
+    content.clear();
+    resumeOffset = length;
+    return resumeOffset;
+}
+
+bool HttpRequest::startContent()
+{
+    if (!resumeOffset)
+        return true;
+    if (response.getStatus() == 206) {
+        unsigned long long first, last, length;
+        if (response.getContentRangeValue(first, last, length) && first == resumeOffset &&
+            response.getContentEncoding() == HttpResponseMessage::Identity)
+            return true;
+    }
+    // Either the entity has been modified since the partial entity-body was
+    // received, or the range cannot be appended to it.
+    bool error = response.getStatus() == 206;
+    resumeOffset = 0;
+    request.eraseHeader("Range");
+    request.eraseHeader("If-Range");
+    contentBuffer.close();
+    removeFile();
+    return !error;
+}
+
+// Returns true if the entity-body received so far can be completed later by
+// a range request.
+bool HttpRequest::canResume()
+{
+    if (!cache || request.getMethodCode() != HttpRequestMessage::GET || contentBuffer.getAvailable() <= 0)
+        return false;
+    if (resumeOffset)
+        return true;    // HttpCache keeps the validator of the partial entity-body.
+    return response.getStatus() == 200 &&
+           response.getContentEncoding() == HttpResponseMessage::Identity &&
+           !response.getIfRangeValue().empty();
+}
+
+void HttpRequest::setPriority(unsigned short value)
+{
+    if (priority == value)
+        return;
+    priority = value;
+    HttpConnectionManager::getInstance().prioritize(self());
+}
+
 void HttpRequest::setHandler(boost::function<void (void)> f)
 {
     handler = f;
@@ -128,9 +506,11 @@ bool HttpRequest::redirect(const HttpResponseMessage& res)
         return false;
 
     // Redirect to location
-    if (content.is_open())
-        content.close();
+    contentBuffer.close();
     filePath.clear();
+    bodyFile.reset();
+    body.reset();
+    mappedFile.reset();
     cache = 0;
     readyState = OPENED;
     return true;
@@ -139,7 +519,20 @@ bool HttpRequest::redirect(const HttpResponseMessage& res)
 // Return true to put this request in the completed list.
 bool HttpRequest::complete(bool error)
 {
+    contentBuffer.finish();
+    timing.responseEnd = HttpTiming::now();
+    if (!error && resumeOffset && response.getStatus() == 206) {
+        // Make sure the range has completed the partial entity-body.
+        unsigned long long first, last, length;
+        if (response.getContentRangeValue(first, last, length) &&
+            static_cast<unsigned long long>(contentBuffer.getAvailable()) == last + 1 && (!length || length == last + 1)) {
+            response.clearContentRange(last + 1);
+            resumeOffset = 0;
+        } else
+            error = true;
+    }
     errorFlag = error;
+    truncated = error && canResume();
     if (!error)
         response.getLastModifiedValue(lastModified);
     else
@@ -148,10 +541,40 @@ bool HttpRequest::complete(bool error)
     return readyState == COMPLETE;
 }
 
+namespace {
+
+// Prints the duration of each phase in milliseconds as a single line of
+// key=value pairs; a phase that has not taken place is printed as zero.
+void printTiming(const URL& url, const HttpTiming& timing)
+{
+    auto span = [](double start, double end) {
+        return (start && end) ? end - start : 0.0;
+    };
+    std::cerr << "timing url=" << url <<
+        " cached=" << timing.cached <<
+        " redirect=" << span(timing.startTime, timing.fetchStart) <<
+        " dns=" << span(timing.domainLookupStart, timing.domainLookupEnd) <<
+        " connect=" << span(timing.connectStart, timing.connectEnd) <<
+        " tls=" << span(timing.secureConnectionStart, timing.connectEnd) <<
+        " ttfb=" << span(timing.requestStart, timing.responseStart) <<
+        " transfer=" << span(timing.responseStart, timing.responseEnd) <<
+        " total=" << span(timing.startTime, timing.responseEnd) << '\n';
+}
+
+}
+
 void HttpRequest::notify()
 {
-    if (cache)
+    if (cache) {
         cache->notify(this, errorFlag);
+        // The cache entry may be revalidated by another request from now on.
+        cache = 0;
+    }
+    // Note notify() is called again upon destruction.
+    if (2 <= getLogLevel() && timing.fetchStart && !timing.reported) {
+        printTiming(request.getURL(), timing);
+        timing.reported = true;
+    }
     if (!errorFlag && redirect(response)) {
         response.clear();
         send();
@@ -183,6 +606,7 @@ void HttpRequest::open(const std::u16string& method, const std::u16string& urlSt
 {
     URL url(base, urlString);
     request.open(utfconv(method), url);
+    timing.clear();
     readyState = OPENED;
 }
 
@@ -196,6 +620,7 @@ bool HttpRequest::constructResponseFromCache(bool sync)
     assert(cache);
     readyState = COMPLETE;
     errorFlag = false;
+    timing.responseEnd = HttpTiming::now();
 
     response.update(cache->getResponseMessage());
     response.updateStatus(cache->getResponseMessage());
@@ -203,6 +628,8 @@ bool HttpRequest::constructResponseFromCache(bool sync)
 
     // TODO: deal with partial...
     filePath = cache->getFilePath();
+    bodyFile = cache->getBodyFile();
+    body = cache->getBody();
 
     cache = 0;
     if (sync)
@@ -217,34 +644,87 @@ bool HttpRequest::constructResponseFromCache(bool sync)
 
 namespace {
 
-bool decodeBase64(std::fstream& content, const std::string& data)
+// Base64Table maps each character to its 6-bit value. White space, the
+// padding character, and any other characters are mapped to the values
+// having the high bit set so that a quadruple of valid characters can be
+// tested with a single branch.
+class Base64Table
 {
-    static const char* const table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    char buf[4];
-    char out[3];
-    const char* p = data.c_str();
+    unsigned char values[256];
+
+public:
+    static const unsigned char Invalid = 0x80;
+    static const unsigned char Space = 0x81;
+    static const unsigned char Pad = 0x82;
+
+    Base64Table() {
+        static const char* const alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        memset(values, Invalid, sizeof values);
+        for (int i = 0; i < 64; ++i)
+            values[static_cast<unsigned char>(alphabet[i])] = i;
+        for (const char* p = " \t\n\v\f\r"; *p; ++p)
+            values[static_cast<unsigned char>(*p)] = Space;
+        values['='] = Pad;
+    }
+    unsigned operator[](char c) const {
+        return values[static_cast<unsigned char>(c)];
+    }
+};
+
+// Appends the decoded [p, end) to decoded.
+bool decodeBase64(std::string& decoded, const char* p, const char* end)
+{
+    static const Base64Table table;
+
+    size_t length = decoded.length();
+    decoded.resize(length + (end - p + 3) / 4 * 3);
+    char* out = &decoded[length];
+    unsigned char buf[4];
     int i = 0;
     int count = 3;
-    while (char c = *p++) {
-        if (c == '=') {
+    while (p < end) {
+        if (i == 0) {
+            // Fast path: decode runs of quadruples without white space nor padding.
+            while (4 <= end - p) {
+                unsigned a = table[p[0]];
+                unsigned b = table[p[1]];
+                unsigned c = table[p[2]];
+                unsigned d = table[p[3]];
+                if ((a | b | c | d) & Base64Table::Invalid)
+                    break;
+                unsigned bits = (a << 18) | (b << 12) | (c << 6) | d;
+                out[0] = static_cast<char>(bits >> 16);
+                out[1] = static_cast<char>(bits >> 8);
+                out[2] = static_cast<char>(bits);
+                out += 3;
+                p += 4;
+            }
+            if (end <= p)
+                break;
+        }
+        unsigned value = table[*p++];
+        if (value == Base64Table::Pad) {
             buf[i++] = 0;
             if (--count <= 0)
                 return false;
-        } else if (const char* found = strchr(table, c))
-            buf[i++] = found - table;
-        else if (isspace(c))
+        } else if (value == Base64Table::Space)
             continue;
-        else
+        else if (value & Base64Table::Invalid)
             return false;
+        else
+            buf[i++] = value;
         if (i == 4) {
-            out[0] = ((buf[0] << 2) & 0xfc) | ((buf[1] >> 4) & 0x03);
-            out[1] = ((buf[1] << 4) & 0xf0) | ((buf[2] >> 2) & 0x0f);
-            out[2] = ((buf[2] << 6) & 0xc0) | (buf[3] & 0x3f);
-            content.write(out, count);
+            char quad[3];
+            quad[0] = ((buf[0] << 2) & 0xfc) | ((buf[1] >> 4) & 0x03);
+            quad[1] = ((buf[1] << 4) & 0xf0) | ((buf[2] >> 2) & 0x0f);
+            quad[2] = ((buf[2] << 6) & 0xc0) | (buf[3] & 0x3f);
+            memcpy(out, quad, count);
+            out += count;
             i = 0;
             count = 3;
         }
     }
+    decoded.resize(out - decoded.data());
     return i == 0;
 }
 
@@ -265,22 +745,29 @@ bool HttpRequest::constructResponseFromData()
         base64 = true;
     }
     response.parseMediaType(data.c_str() + 5, data.c_str() + end);
-    std::fstream& content = getContent();
-    if (!content.is_open()) {
+    end += base64 ? 8 : 1;
+
+    // Decode the entity-body straight into memory so that it can be read
+    // without going through a temporary file.
+    std::shared_ptr<std::string> decoded(new(std::nothrow) std::string);
+    if (!decoded) {
         notify(true);
         return errorFlag;
     }
     flags &= ~DONT_REMOVE;
-    if (!base64) {
-        end += 1;
-        std::string decoded(URI::percentDecode(URI::percentDecode(data, end, data.length() - end)));
-        content << decoded;
-    } else {
-        end += 8;
-        std::string decoded(URI::percentDecode(URI::percentDecode(data, end, data.length() - end)));
-        errorFlag = !decodeBase64(content, decoded);
+    std::string payload;
+    const char* p = data.c_str() + end;
+    const char* last = data.c_str() + data.length();
+    if (std::find(p, last, '%') != last) {
+        payload = URI::percentDecode(URI::percentDecode(data, end, data.length() - end));
+        p = payload.c_str();
+        last = p + payload.length();
     }
-    content.flush();
+    if (!base64)
+        decoded->assign(p, last);
+    else
+        errorFlag = !decodeBase64(*decoded, p, last);
+    body = decoded;
     notify(errorFlag);
     return errorFlag;
 }
@@ -293,6 +780,13 @@ bool HttpRequest::send()
     if (request.getURL().isEmpty())
         return notify(false);
 
+    // Every phase is measured again after a redirect.
+    double now = HttpTiming::now();
+    double startTime = timing.startTime ? timing.startTime : now;
+    timing.clear();
+    timing.startTime = startTime;
+    timing.fetchStart = now;
+
     flags |= DONT_REMOVE;
 
     if (request.getURL().testProtocol(u"file")) {
@@ -350,11 +844,14 @@ void HttpRequest::abort(bool dtor)
     }
     readyState = UNSENT;
     errorFlag = false;
+    truncated = false;
+    resumeOffset = 0;
     request.clear();
     response.clear();
-    if (content.is_open())
-        content.close();
+    contentBuffer.close();
     filePath.clear();   // TODO: Check if we should remove file now
+    bodyFile.reset();
+    body.reset();
     cache = 0;
 }
 
@@ -399,7 +896,12 @@ HttpRequest::HttpRequest(const std::u16string& base) :
     base(base),
     readyState(UNSENT),
     flags(DONT_REMOVE),
+    priority(ASYNC),
     errorFlag(false),
+    truncated(false),
+    resumeOffset(0),
+    contentBuffer(filePath, body),
+    content(&contentBuffer),
     cache(0),
     handler(0),
     lastModified(0),
@@ -18,11 +18,15 @@
 #define ES_HTTP_REQUEST_H
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <deque>
 #include <memory>
+#include <mutex>
 #include <fstream>
 #include <boost/function.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
 
 #include "http/HTTPRequestMessage.h"
 #include "http/HTTPResponseMessage.h"
@@ -37,10 +41,286 @@ class HttpRequest;
 
 typedef std::shared_ptr<HttpRequest> HttpRequestPtr;
 
+// HttpContentBuffer keeps a small entity-body in memory and moves it into a
+// temporary file once it grows beyond MemoryLimit. While the entity-body is
+// being received on the network thread, the part received so far can be read
+// by another thread.
+class HttpContentBuffer : public std::streambuf
+{
+    std::string& filePath;
+    std::shared_ptr<std::string>& body;
+    std::string directory;
+    std::filebuf file;
+    bool active;
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::streamsize written;
+    std::streamsize available;  // the length that can be read
+    int readDescriptor;
+    bool finished;
+    unsigned generation;        // incremented by close() and cutOff() to end the current readers
+
+    bool spill();
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char* s, std::streamsize n);
+    virtual int sync();
+
+public:
+    static const size_t MemoryLimit = 64 * 1024;
+
+    HttpContentBuffer(std::string& filePath, std::shared_ptr<std::string>& body) :
+        filePath(filePath),
+        body(body),
+        active(false),
+        written(0),
+        available(0),
+        readDescriptor(-1),
+        finished(false),
+        generation(0)
+    {
+    }
+    ~HttpContentBuffer() {
+        close();
+    }
+
+    bool isOpen() const {
+        return active;
+    }
+    bool open(const std::string& directory);
+    // Reopens the partial entity-body stored either in the file at path or in
+    // partial so that the rest of it can be appended. Returns the length of
+    // the partial entity-body, or -1 upon failure.
+    std::streamsize resume(const std::string& directory, const std::string& path, const std::shared_ptr<std::string>& partial);
+    void close();
+    // Lets the readers of the current entity-body see the end of it without
+    // waiting for the rest to arrive. close() does the same.
+    void cutOff();
+
+    std::streamsize getAvailable();
+    unsigned getGeneration();
+    // Reads the entity-body at offset, waiting for more of it to arrive
+    // until finish() is called. Returns -1 at the end of the entity-body, or
+    // once the buffer has been closed since generation.
+    std::streamsize read(unsigned generation, std::streamsize offset, char* s, std::streamsize n);
+    void finish();
+};
+
+// HttpMappedFile maps a regular file into memory read-only so that a local
+// file or a disk cache entry can be read as one contiguous span without
+// copying it through a stream buffer.
+class HttpMappedFile
+{
+    std::string path;
+    void* address;
+    size_t length;
+
+public:
+    explicit HttpMappedFile(const std::string& path);
+    ~HttpMappedFile();
+    HttpMappedFile(const HttpMappedFile&) = delete;
+    HttpMappedFile& operator=(const HttpMappedFile&) = delete;
+
+    bool isOpen() const {
+        return address;
+    }
+    const std::string& getPath() const {
+        return path;
+    }
+    const char* data() const {
+        return static_cast<const char*>(address);
+    }
+    size_t size() const {
+        return length;
+    }
+};
+
+typedef std::shared_ptr<HttpMappedFile> HttpMappedFilePtr;
+
+// HttpBodyFile removes the file storing an entity-body once neither the
+// cache entry nor any request served from it refers to the file.
+class HttpBodyFile
+{
+    std::string path;
+
+public:
+    explicit HttpBodyFile(const std::string& path) :
+        path(path)
+    {
+    }
+    ~HttpBodyFile() {
+        if (!path.empty())
+            remove(path.c_str());
+    }
+    HttpBodyFile(const HttpBodyFile&) = delete;
+    HttpBodyFile& operator=(const HttpBodyFile&) = delete;
+
+    const std::string& getPath() const {
+        return path;
+    }
+    // Leaves the file in place upon destruction.
+    void keep() {
+        path.clear();
+    }
+};
+
+typedef std::shared_ptr<HttpBodyFile> HttpBodyFilePtr;
+
+// HttpContentSource is a Boost.Iostreams source device that reads the
+// entity-body either from memory, from the mapped content file, or from the
+// content file. A source created from a request reads the entity-body while
+// it is being received.
+class HttpContentSource
+{
+    HttpRequestPtr request;
+    std::shared_ptr<const void> owner;  // keeps data alive
+    const char* data;
+    std::streamsize length;
+    std::streamsize position;
+    unsigned generation;    // of the content buffer of request
+    boost::iostreams::file_descriptor_source file;
+
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    explicit HttpContentSource(const std::shared_ptr<const std::string>& body) :
+        owner(body),
+        data(body ? body->data() : 0),
+        length(body ? body->length() : 0),
+        position(0)
+    {
+    }
+    explicit HttpContentSource(const std::shared_ptr<const HttpMappedFile>& mapped) :
+        owner(mapped),
+        data(mapped->data()),
+        length(mapped->size()),
+        position(0)
+    {
+    }
+    explicit HttpContentSource(int fd) :
+        data(0),
+        length(0),
+        position(0)
+    {
+        if (fd != -1)
+            file.open(fd, boost::iostreams::close_handle);
+    }
+    HttpContentSource(const HttpRequestPtr& request, unsigned generation) :
+        request(request),
+        data(0),
+        length(0),
+        position(0),
+        generation(generation)
+    {
+    }
+
+    std::streamsize getPosition() const {
+        return position;
+    }
+    // Returns the whole entity-body as one contiguous span of getSize()
+    // bytes if it is in memory; otherwise, returns 0 and the entity-body
+    // has to be read through read().
+    const char* getData() const {
+        return data;
+    }
+    std::streamsize getSize() const {
+        return length;
+    }
+    std::streamsize read(char* s, std::streamsize n);
+    // Lets read() of the progressive sources of request return -1 instead of
+    // waiting for the rest of the entity-body.
+    void cutOff();
+};
+
+// HttpContentStream reads an entity-body through an HttpContentSource. If
+// the whole entity-body is in memory, it is read right from there instead
+// of being copied into a stream buffer first.
+class HttpContentStream : public std::istream
+{
+    class SpanBuffer : public std::streambuf
+    {
+    public:
+        void open(const char* data, std::streamsize length) {
+            char* begin = const_cast<char*>(data);
+            setg(begin, begin, begin + length);
+        }
+        std::streamsize getPosition() const {
+            return gptr() - eback();
+        }
+    };
+
+    HttpContentSource source;   // keeps the span alive
+    SpanBuffer spanBuffer;
+    boost::iostreams::stream_buffer<HttpContentSource> sourceBuffer;
+
+public:
+    explicit HttpContentStream(const HttpContentSource& source) :
+        std::istream(0),
+        source(source)
+    {
+        if (const char* data = this->source.getData()) {
+            spanBuffer.open(data, this->source.getSize());
+            rdbuf(&spanBuffer);
+        } else {
+            sourceBuffer.open(this->source);
+            rdbuf(&sourceBuffer);
+        }
+    }
+
+    // Returns the length of the entity-body read from the source so far.
+    std::streamsize getPosition() {
+        if (source.getData())
+            return spanBuffer.getPosition();
+        return sourceBuffer->getPosition();
+    }
+    void cutOff() {
+        source.cutOff();
+    }
+};
+
+// HttpTiming records when each phase of a request took place, following the
+// attributes of Resource Timing. The times are in milliseconds of the
+// monotonic clock given by now(), and a phase that has not taken place is
+// left zero. The fields set by HttpConnection are written on the network
+// thread and read on the main thread after the request has completed.
+struct HttpTiming
+{
+    double startTime;   // fetchStart of the first request before redirects
+    double fetchStart;
+    double domainLookupStart;
+    double domainLookupEnd;
+    double connectStart;
+    double connectEnd;
+    double secureConnectionStart;
+    double requestStart;
+    double responseStart;
+    double responseEnd;
+    bool cached;        // served by HttpCache without contacting the server
+    bool reported;      // printed to the log
+
+    HttpTiming() {
+        clear();
+    }
+    void clear() {
+        startTime = fetchStart = 0.0;
+        domainLookupStart = domainLookupEnd = 0.0;
+        connectStart = connectEnd = secureConnectionStart = 0.0;
+        requestStart = responseStart = responseEnd = 0.0;
+        cached = false;
+        reported = false;
+    }
+
+    static double now();
+};
+
 class HttpRequest : public std::enable_shared_from_this<HttpRequest>
 {
     friend class HttpCacheManager;
     friend class HttpConnectionManager;
+    friend class HttpContentSource;
 
 public:
     // states
@@ -55,28 +335,45 @@ public:
     static const unsigned short DONT_REMOVE = 1;    // Do not remove filePath upon destruction
     static const unsigned short CANCELED = 2;
 
+    // priorities; requests with a smaller value are sent first.
+    static const unsigned short DOCUMENT = 0;
+    static const unsigned short BLOCKING = 1;   // render-blocking style sheets and parser-blocking scripts
+    static const unsigned short ASYNC = 2;      // async and deferred scripts
+    static const unsigned short IMAGE = 3;
+    static const unsigned short PREFETCH = 4;
+
 private:
     static std::string aboutPath;
     static std::string cachePath;
 
     std::u16string base;
-    unsigned short readyState;
+    std::atomic_ushort readyState;
     std::atomic_ushort flags;
+    std::atomic_ushort priority;
     bool errorFlag;
+    bool truncated;     // the entity-body has been cut off but can be resumed
+    unsigned long long resumeOffset;
     HttpRequestMessage request;
     HttpResponseMessage response;
 
     std::string filePath;
-    std::fstream content;
+    HttpBodyFilePtr bodyFile;           // set if filePath is shared with HttpCache
+    std::shared_ptr<std::string> body;  // entity-body kept in memory
+    HttpMappedFilePtr mappedFile;       // filePath mapped into memory
+    HttpContentBuffer contentBuffer;
+    std::ostream content;
 
     HttpCache* cache;
     boost::function<void (void)> handler;
     long long lastModified;
+    HttpTiming timing;
 
     std::deque<boost::function<void (void)>> callbackList;
 
     BoxImage* boxImage;
 
+    bool canResume();
+
 public:
     HttpRequest(const std::u16string& base = u"");
     ~HttpRequest();
@@ -106,17 +403,63 @@ public:
     const std::string& getFilePath() const {
         return filePath;
     }
+    // Shares the file at getFilePath() with HttpCache so that the file is
+    // removed only after every request reading it has released it.
+    const HttpBodyFilePtr& getBodyFile() {
+        if (!bodyFile && !filePath.empty())
+            bodyFile = std::make_shared<HttpBodyFile>(filePath);
+        return bodyFile;
+    }
     void removeFile() {
-        if (!filePath.empty()) {
+        if (bodyFile)
+            bodyFile.reset();
+        else if (!filePath.empty())
             remove(filePath.c_str());
-            filePath.clear();
-        }
+        filePath.clear();
+        body.reset();
+        mappedFile.reset();
+    }
+
+    // Returns the entity-body if it is kept in memory; otherwise, it is
+    // stored in the file at getFilePath().
+    const std::shared_ptr<std::string>& getBody() const {
+        return body;
     }
 
     int getContentDescriptor();
-    std::fstream& getContent();
+    // Maps the content file of a completed request into memory. Returns
+    // null if the entity-body is kept in memory or the file cannot be mapped.
+    HttpMappedFilePtr getMappedFile();
+    HttpContentSource getContentSource();
+    std::ostream& getContent();
     std::FILE* openFile();
 
+    // While readyState is LOADING, the entity-body received so far can be
+    // read through getProgressiveContentSource().
+    HttpContentSource getProgressiveContentSource() {
+        return HttpContentSource(self(), contentBuffer.getGeneration());
+    }
+    std::streamsize getReceivedLength() {
+        return contentBuffer.getAvailable();
+    }
+    // Ends the sources returned by getProgressiveContentSource() so far.
+    void cutOffProgressiveContent() {
+        contentBuffer.cutOff();
+    }
+    void progress();
+
+    // Continues the partial entity-body kept by HttpCache; the caller sends
+    // the request with Range for the rest of it. Returns the length of the
+    // partial entity-body, or zero if it cannot be resumed.
+    unsigned long long resume(const HttpBodyFilePtr& file, const std::shared_ptr<std::string>& partial);
+    // Called on the network thread once the response headers have been
+    // received. Returns false if the response cannot be appended to the
+    // partial entity-body.
+    bool startContent();
+    bool isTruncated() const {
+        return truncated;
+    }
+
     void setHandler(boost::function<void (void)> f);
     void clearHandler();
     unsigned addCallback(boost::function<void (void)> f, unsigned id = static_cast<unsigned>(-1));
@@ -130,6 +473,12 @@ public:
     unsigned short getReadyState() const {
         return readyState;
     }
+    unsigned short getPriority() const {
+        return priority;
+    }
+    // Raising the priority of a queued request moves it ahead of the
+    // requests with lower priorities.
+    void setPriority(unsigned short value);
     void open(const std::u16string& method, const std::u16string& url);
     void setRequestHeader(const std::u16string& header, const std::u16string& value);
     unsigned int getTimeout();
@@ -162,6 +511,13 @@ public:
         return lastModified;
     }
 
+    HttpTiming& getTiming() {
+        return timing;
+    }
+    const HttpTiming& getTiming() const {
+        return timing;
+    }
+
     BoxImage* getBoxImage(unsigned repeat);
 
     static void setAboutPath(const std::string& path) {
@@ -53,6 +53,7 @@ void HttpRequestMessage::open(const std::string& method, const std::u16string& u
     toUpperCase(this->method);
     this->url = URL(url);
     setHeader("User-Agent", "Escudo/" PACKAGE_VERSION);
+    setHeader("Accept-Encoding", "gzip, deflate");
 }
 
 bool HttpRequestMessage::redirect(const std::u16string& url)
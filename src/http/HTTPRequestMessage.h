@@ -75,6 +75,16 @@ public:
     void open(const std::string& method, const std::u16string& url);
     bool redirect(const std::u16string& url);
     void setHeader(const std::string& header, const std::string& value);
+    void eraseHeader(const std::string& header) {
+        headers.erase(header);
+    }
+    bool hasHeader(const std::string& header) const {
+        std::string value;
+        return headers.get(header, value);
+    }
+    const HttpHeaderList& getHeaders() const {
+        return headers;
+    }
 
     void clear();
 
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTTPResolver.h"
+
+#include <time.h>
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+#include "Test.util.h"
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+HttpResolver::HttpResolver(boost::asio::io_service& ioService) :
+    ioService(ioService),
+    resolver(ioService),
+    timeToLive(DefaultTimeToLive),
+    negativeTimeToLive(DefaultNegativeTimeToLive),
+    maxEntries(DefaultMaxEntries),
+    hits(0),
+    misses(0)
+{
+}
+
+void HttpResolver::resolve(const std::string& hostname, const std::string& port, const Handler& handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string key = getKey(hostname, port);
+    auto found = table.find(key);
+    if (found != table.end()) {
+        lru.splice(lru.begin(), lru, found->second);
+        Entry& entry = lru.front();
+        if (entry.resolving) {
+            if (handler)
+                entry.handlers.push_back(handler);
+            return;
+        }
+        if (time(0) < entry.expires) {
+            ++hits;
+            if (handler)
+                ioService.post(boost::bind(handler, entry.error, entry.endpoints));
+            return;
+        }
+    } else {
+        lru.push_front(Entry());
+        lru.front().key = key;
+        lru.front().resolving = true;
+        table[key] = lru.begin();
+        evict();
+    }
+    ++misses;
+
+    Entry& entry = lru.front();
+    entry.resolving = true;
+    if (handler)
+        entry.handlers.push_back(handler);
+    if (3 <= getLogLevel())
+        std::cerr << __func__ << ' ' << key << '\n';
+    boost::asio::ip::tcp::resolver::query query(hostname, port);
+    resolver.async_resolve(query, boost::bind(&HttpResolver::handleResolve, this, key,
+                                              boost::asio::placeholders::error,
+                                              boost::asio::placeholders::iterator));
+}
+
+void HttpResolver::handleResolve(const std::string& key, const boost::system::error_code& err, iterator endpoints)
+{
+    std::list<Handler> handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto found = table.find(key);
+        if (found != table.end() && found->second->resolving) {
+            Entry& entry = *found->second;
+            entry.resolving = false;
+            entry.error = err;
+            entry.endpoints = endpoints;
+            if (err == boost::asio::error::operation_aborted)
+                entry.expires = 0;
+            else
+                entry.expires = time(0) + (err ? negativeTimeToLive : timeToLive);
+            handlers.swap(entry.handlers);
+        }
+    }
+    for (auto i = handlers.begin(); i != handlers.end(); ++i)
+        (*i)(err, endpoints);
+}
+
+// Drops the least recently used entries except for those being resolved.
+void HttpResolver::evict()
+{
+    for (auto i = lru.end(); maxEntries < lru.size() && i != lru.begin();) {
+        --i;
+        if (i->resolving)
+            continue;
+        table.erase(i->key);
+        i = lru.erase(i);
+    }
+}
+
+void HttpResolver::invalidate(const std::string& hostname, const std::string& port)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = table.find(getKey(hostname, port));
+    if (found != table.end() && !found->second->resolving)
+        found->second->expires = 0;
+}
+
+void HttpResolver::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto i = lru.begin(); i != lru.end();) {
+        if (i->resolving)
+            ++i;
+        else {
+            table.erase(i->key);
+            i = lru.erase(i);
+        }
+    }
+}
+
+void HttpResolver::setMaxEntries(unsigned count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    maxEntries = std::max(1u, count);
+    evict();
+}
+
+void HttpResolver::dump()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    long long now = time(0);
+    for (auto i = lru.begin(); i != lru.end(); ++i) {
+        std::cout << "HttpResolver: " << i->key << ' ';
+        if (i->resolving)
+            std::cout << "resolving";
+        else
+            std::cout << (i->error ? "error " : "ok ") << std::max(0ll, i->expires - now);
+        std::cout << '\n';
+    }
+    std::cout << "entries: " << lru.size() << '/' << maxEntries << " hits: " << hits << " misses: " << misses << '\n';
+}
+
+}}}}  // org::w3c::dom::bootstrap
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTTP_RESOLVER_H
+#define ES_HTTP_RESOLVER_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+// HttpResolver caches the results of host name lookups keyed on the host
+// name and the port. Failed lookups are cached as well, but for a shorter
+// period. Concurrent lookups for the same key share a single query.
+class HttpResolver
+{
+public:
+    typedef boost::asio::ip::tcp::resolver::iterator iterator;
+    typedef boost::function<void (const boost::system::error_code&, iterator)> Handler;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        iterator endpoints;
+        boost::system::error_code error;
+        long long expires;
+        bool resolving;
+        std::list<Handler> handlers;    // waiting for the query in progress
+    };
+    typedef std::list<Entry> EntryList;
+
+    std::mutex mutex;
+    boost::asio::io_service& ioService;
+    boost::asio::ip::tcp::resolver resolver;
+    EntryList lru;
+    std::unordered_map<std::string, EntryList::iterator> table;
+
+    unsigned timeToLive;            // in seconds
+    unsigned negativeTimeToLive;    // in seconds
+    unsigned maxEntries;
+
+    // statistics
+    unsigned long long hits;
+    unsigned long long misses;
+
+    static std::string getKey(const std::string& hostname, const std::string& port) {
+        return hostname + ':' + port;
+    }
+    void evict();
+    void handleResolve(const std::string& key, const boost::system::error_code& err, iterator endpoints);
+
+public:
+    static const unsigned DefaultTimeToLive = 60;
+    static const unsigned DefaultNegativeTimeToLive = 10;
+    static const unsigned DefaultMaxEntries = 256;
+
+    HttpResolver(boost::asio::io_service& ioService);
+
+    // The handler is always called via the io_service, even if the result
+    // is already in the cache.
+    void resolve(const std::string& hostname, const std::string& port, const Handler& handler);
+    // Starts looking up the host name in advance so that the following
+    // connection to the host does not need to wait for the query.
+    void prefetch(const std::string& hostname, const std::string& port) {
+        resolve(hostname, port, Handler());
+    }
+    // Removes the cached result, e.g., when none of the endpoints accepted
+    // the connection.
+    void invalidate(const std::string& hostname, const std::string& port);
+    void clear();
+
+    unsigned getTimeToLive() const {
+        return timeToLive;
+    }
+    void setTimeToLive(unsigned seconds) {
+        timeToLive = seconds;
+    }
+    unsigned getNegativeTimeToLive() const {
+        return negativeTimeToLive;
+    }
+    void setNegativeTimeToLive(unsigned seconds) {
+        negativeTimeToLive = seconds;
+    }
+    unsigned getMaxEntries() const {
+        return maxEntries;
+    }
+    void setMaxEntries(unsigned count);
+
+    void dump();
+};
+
+}}}}  // org::w3c::dom::bootstrap
+
+#endif  // ES_HTTP_RESOLVER_H
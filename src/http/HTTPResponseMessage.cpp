@@ -56,25 +56,21 @@ bool hasToken(const std::string& value, const char* token, size_t length, char s
     return false;
 }
 
-bool isHopByHopHeader(const std::string& header)
-{
-    const char* names[] = {
-        "Connection",
-        "Keep-Alive",
-        "Proxy-Authenticate",
-        "Proxy-Authorization",
-        "TE",
-        "Trailers",
-        "Transfer-Encoding",
-        "Upgrade",
-        0
-    };
-    const char* h = header.c_str();
-    for (const char** i = names; *i; ++i) {
-        if (strcasecmp(*i, h) == 0)
-            return true;
+bool isHopByHopHeader(const HttpHeader& header)
+{
+    switch (header.id) {
+    case HttpHeader::Connection:
+    case HttpHeader::KeepAlive:
+    case HttpHeader::ProxyAuthenticate:
+    case HttpHeader::ProxyAuthorization:
+    case HttpHeader::TE:
+    case HttpHeader::Trailers:
+    case HttpHeader::TransferEncoding:
+    case HttpHeader::Upgrade:
+        return true;
+    default:
+        return false;
     }
-    return false;
 }
 
 }
@@ -209,6 +205,43 @@ bool HttpResponseMessage::parseContentType(const std::string& value)
     return true;
 }
 
+bool HttpResponseMessage::parseContentEncoding(const std::string& value)
+{
+    const char* start = skipSpace(value.c_str(), value.c_str() + value.length());
+    if (isToken(start, "gzip", 4) || isToken(start, "x-gzip", 6))
+        contentEncoding = Gzip;
+    else if (isToken(start, "deflate", 7))
+        contentEncoding = Deflate;
+    else if (isToken(start, "identity", 8))
+        contentEncoding = Identity;
+    else
+        contentEncoding = UnknownEncoding;
+    if (contentEncoding != Identity && skipTo(start, value.c_str() + value.length(), ',') < value.c_str() + value.length())
+        contentEncoding = UnknownEncoding;  // multiple codings are not supported
+    return true;
+}
+
+void HttpResponseMessage::setContentLength(unsigned long long length)
+{
+    contentLength = length;
+    hasContentLength = true;
+    headers.set("Content-Length", boost::lexical_cast<std::string>(length));
+}
+
+void HttpResponseMessage::clearContentEncoding()
+{
+    headers.erase("Content-Encoding");
+    contentEncoding = Identity;
+}
+
+void HttpResponseMessage::clearContentRange(unsigned long long length)
+{
+    status = 200;
+    statusText = "OK";
+    headers.erase("Content-Range");
+    setContentLength(length);
+}
+
 bool HttpResponseMessage::parseCacheControl(const std::string& value)
 {
     const char* start = value.c_str();
@@ -244,34 +277,29 @@ bool HttpResponseMessage::parsePragma(const std::string& value)
 unsigned HttpResponseMessage::getAgeValue() const
 {
     unsigned age = 0;
-    std::string value;
-    if (headers.get("Age", value))
-        parseDigits(value.c_str(), value.c_str() + value.length(), age);
+    if (const std::string* value = headers.get(HttpHeader::Age))
+        parseDigits(value->c_str(), value->c_str() + value->length(), age);
     return age;
 }
 
 long long HttpResponseMessage::getDateValue() const
 {
     long long date = 0;
-    std::string value;
-    if (headers.get("Date", value))
-        parseTime(value.c_str(), value.c_str() + value.length(), date);
+    if (const std::string* value = headers.get(HttpHeader::Date))
+        parseTime(value->c_str(), value->c_str() + value->length(), date);
     return date;
 }
 
 bool HttpResponseMessage::isChunked() const
 {
-    std::string value;
-    if (!headers.get("Transfer-Encoding", value))
-        return false;
-    return hasToken(value, "chunked", 7);
+    const std::string* value = headers.get(HttpHeader::TransferEncoding);
+    return value && hasToken(*value, "chunked", 7);
 }
 
 bool HttpResponseMessage::getExpiresValue(long long& expiresValue) const
 {
-    std::string value;
-    if (headers.get("Expires", value)) {
-        parseTime(value.c_str(), value.c_str() + value.length(), expiresValue);
+    if (const std::string* value = headers.get(HttpHeader::Expires)) {
+        parseTime(value->c_str(), value->c_str() + value->length(), expiresValue);
         return true;
     }
     return false;
@@ -279,45 +307,106 @@ bool HttpResponseMessage::getExpiresValue(long long& expiresValue) const
 
 bool HttpResponseMessage::getMaxAgeValue(unsigned& maxAge) const
 {
-    std::string value;
-    if (!headers.get("Cache-Control", value))
+    const std::string* value = headers.get(HttpHeader::CacheControl);
+    if (!value)
         return false;
-    const char* s = value.c_str();
+    const char* s = value->c_str();
     s = strcasestr(s, "max-age=");
     if (!s)
         return false;
-    parseDigits(s + 8, value.c_str() + value.length(), maxAge);
+    parseDigits(s + 8, value->c_str() + value->length(), maxAge);
+    return true;
+}
+
+bool HttpResponseMessage::getStaleWhileRevalidateValue(unsigned& seconds) const
+{
+    const std::string* value = headers.get(HttpHeader::CacheControl);
+    if (!value)
+        return false;
+    const char* s = value->c_str();
+    s = strcasestr(s, "stale-while-revalidate=");
+    if (!s)
+        return false;
+    parseDigits(s + 23, value->c_str() + value->length(), seconds);
     return true;
 }
 
 bool HttpResponseMessage::getLastModifiedValue(long long& lastModifiedValue) const
 {
-    std::string value;
-    if (headers.get("Last-Modified", value)) {
-        parseTime(value.c_str(), value.c_str() + value.length(), lastModifiedValue);
+    if (const std::string* value = headers.get(HttpHeader::LastModified)) {
+        parseTime(value->c_str(), value->c_str() + value->length(), lastModifiedValue);
         return true;
     }
     return false;
 }
 
+// Content-Range: bytes first-last/length
+bool HttpResponseMessage::getContentRangeValue(unsigned long long& first, unsigned long long& last, unsigned long long& length) const
+{
+    const std::string* value = headers.get(HttpHeader::ContentRange);
+    if (!value)
+        return false;
+    const char* start = value->c_str();
+    const char* end = start + value->length();
+    start = skipSpace(start, end);
+    if (!isToken(start, "bytes", 5))
+        return false;
+    const char* p = parseDigits(start + 5, end, first);
+    if (p == start + 5 || *p != '-')
+        return false;
+    start = p + 1;
+    p = parseDigits(start, end, last);
+    if (p == start || *p != '/' || last < first)
+        return false;
+    start = skipSpace(p + 1, end);
+    if (*start == '*') {
+        length = 0;
+        return true;
+    }
+    p = parseDigits(start, end, length);
+    return p != start && last < length;
+}
+
+std::string HttpResponseMessage::getIfRangeValue() const
+{
+    const std::string* value = headers.get(HttpHeader::AcceptRanges);
+    if (value && hasToken(*value, "none", 4))
+        return "";
+    // A weak entity tag cannot be used in If-Range.
+    value = headers.get(HttpHeader::ETag);
+    if (value && value->compare(0, 2, "W/") != 0)
+        return *value;
+    // Last-Modified is a strong validator only if it is at least one minute
+    // older than Date.
+    long long lastModified;
+    long long date = getDateValue();
+    if (date && getLastModifiedValue(lastModified) && 60 <= date - lastModified)
+        return *headers.get(HttpHeader::LastModified);
+    return "";
+}
+
 bool HttpResponseMessage::parseHeader(const HttpHeader& hdr)
 {
     if (hdr.value.empty())
         return false;
-    if (hdr == "Content-Length") {
+    switch (hdr.id) {
+    case HttpHeader::ContentLength:
         if (parseContentLength(hdr.value)) {
             hasContentLength = true;
             return true;
         }
         return false;
-    }
-    if (hdr == "Content-Type")
+    case HttpHeader::ContentType:
         return parseContentType(hdr.value);
-    if (hdr == "Cache-Control")
+    case HttpHeader::ContentEncoding:
+        return parseContentEncoding(hdr.value);
+    case HttpHeader::CacheControl:
         return parseCacheControl(hdr.value);
-    if (hdr == "Pragma")
+    case HttpHeader::Pragma:
         return parsePragma(hdr.value);
-    return true;
+    default:
+        return true;
+    }
 }
 
 const char* HttpResponseMessage::parseHeader(const char* start, const char* const end)
@@ -339,14 +428,41 @@ const char* HttpResponseMessage::parse(const char* start, const char* const end)
         return 0;
     ++header;
     while (header < end) {
+        const char* crlf = parseCRLF(header, end);
+        if (crlf < end && *crlf == '\n')
+            return crlf;
         header = parseHeader(header, end);
         if (!header)
             return 0;
-        header = parseCRLF(header, end);
-        if (*header == '\n')
-            break;
     }
-    return header;
+    return 0;
+}
+
+bool HttpResponseMessage::parse(const HttpHpackFieldList& fields)
+{
+    clear();
+    bool hasStatus = false;
+    for (auto i = fields.begin(); i != fields.end(); ++i) {
+        const std::string& name(i->first);
+        if (!name.empty() && name[0] == ':') {
+            // The only pseudo-header field of a response precedes the others.
+            if (name != ":status" || hasStatus || headers.size())
+                return false;
+            const char* start = i->second.c_str();
+            const char* end = start + i->second.length();
+            unsigned code;
+            if (i->second.length() != 3 || parseDigits(start, end, code) != end)
+                return false;
+            status = code;
+            statusText.clear();
+            hasStatus = true;
+            continue;
+        }
+        HttpHeader hdr(name, i->second);
+        headers.set(hdr.header, hdr.value, true);
+        parseHeader(hdr);
+    }
+    return hasStatus;
 }
 
 std::string HttpResponseMessage::toString() const
@@ -443,6 +559,21 @@ bool HttpResponseMessage::isFresh(long long requestTime) const
     return currentAge < freshnessLifetime;
 }
 
+// cf. RFC 5861 HTTP Cache-Control Extensions for Stale Content
+bool HttpResponseMessage::isStaleWhileRevalidate(long long requestTime, unsigned window) const
+{
+    getStaleWhileRevalidateValue(window);
+    if (!window)
+        return false;
+    const std::string* value = headers.get(HttpHeader::CacheControl);
+    if (value && (strcasestr(value->c_str(), "must-revalidate") || strcasestr(value->c_str(), "proxy-revalidate")))
+        return false;
+    long long now = time(0);
+    long long freshnessLifetime = getFreshnessLifetime(now);
+    long long currentAge = getCurrentAge(now, requestTime);
+    return currentAge < freshnessLifetime + window;
+}
+
 void HttpResponseMessage::clear()
 {
     version = 11;
@@ -455,24 +586,21 @@ void HttpResponseMessage::clear()
     contentCharset.clear();
     contentLength = 0;
     contentType.clear();
+    contentEncoding = Identity;
 }
 
 void HttpResponseMessage::update(const HttpResponseMessage& response)
 {
     for (auto i = response.headers.begin(); i !=response.headers.end(); ++i) {
-        if (isHopByHopHeader(i->header))
+        if (isHopByHopHeader(*i))
+            continue;
+        // The stored entity-body is kept decoded; a 304 response must not
+        // alter the metadata describing it.
+        if (response.status == 304 && (i->id == HttpHeader::ContentLength || i->id == HttpHeader::ContentEncoding))
             continue;
         headers.set(i->header, i->value, false);
         parseHeader(*i);
     }
-
-    // TODO:
-    // 13.5.3
-    // If the status code is 206 (Partial Content) and the ETag or
-    // Last-Modified headers match exactly, the cache MAY combine the
-    // contents stored in the cache entry with the new contents received in
-    // the response and use the result as the entity-body of this outgoing
-    // response
 }
 
 HttpResponseMessage::HttpResponseMessage()
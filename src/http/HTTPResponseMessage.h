@@ -20,11 +20,22 @@
 #include <string>
 
 #include "http/HTTPHeader.h"
+#include "http/HTTPHpack.h"
 
 namespace org { namespace w3c { namespace dom { namespace bootstrap {
 
 class HttpResponseMessage
 {
+public:
+    // content codings
+    enum {
+        Identity,
+        Gzip,
+        Deflate,
+        UnknownEncoding
+    };
+
+private:
     unsigned short version;  // 9, 10, or 11
 
     unsigned short status;
@@ -37,10 +48,12 @@ class HttpResponseMessage
     std::string contentCharset;
     unsigned long long contentLength;
     std::string contentType;
+    int contentEncoding;
 
     const char* parseVersion(const char* start, const char* const end);
     bool parseContentLength(const std::string& value);
     bool parseContentType(const std::string& value);
+    bool parseContentEncoding(const std::string& value);
     bool parseCacheControl(const std::string& value);
     bool parsePragma(const std::string& value);
 
@@ -64,6 +77,16 @@ public:
     unsigned long long getContentLength() const {
         return contentLength;
     }
+    void setContentLength(unsigned long long length);
+    int getContentEncoding() const {
+        return contentEncoding;
+    }
+    // Marks the entity-body as decoded by removing Content-Encoding.
+    void clearContentEncoding();
+    // Turns a 206 response into the 200 response that describes the whole
+    // entity-body once the requested range has been appended to the stored
+    // part of it.
+    void clearContentRange(unsigned long long length);
     const std::string& getContentType() {
         return contentType;
     }
@@ -100,6 +123,8 @@ public:
         return headers.toString();  // TODO: remove unwanted headers
     }
     const char* parse(const char* start, const char* const end);
+    // Reads the header fields of an HTTP/2 response.
+    bool parse(const HttpHpackFieldList& fields);
 
     const char* parseStatusLine(const char* start, const char* const end);
     const char* parseHeader(const char* start, const char* const end);
@@ -111,7 +136,13 @@ public:
 
     bool getExpiresValue(long long& expiresValue) const;
     bool getMaxAgeValue(unsigned& maxAge) const;
+    bool getStaleWhileRevalidateValue(unsigned& seconds) const;
     bool getLastModifiedValue(long long& lastModifiedValue) const;
+    // length is zero if the complete length is unknown.
+    bool getContentRangeValue(unsigned long long& first, unsigned long long& last, unsigned long long& length) const;
+    // Returns the strong validator to be sent in If-Range, or an empty string
+    // if the entity-body cannot be requested by range.
+    std::string getIfRangeValue() const;
 
     long long getCurrentAge(long long now, long long requestTime) const;
     long long getFreshnessLifetime(long long now) const;
@@ -124,6 +155,10 @@ public:
     }
     bool isCacheable() const;
     bool isFresh(long long requestTime) const;
+    // Returns true if the stale response can still be used while it is
+    // being revalidated, i.e., it has been stale for less than the
+    // stale-while-revalidate value, or window seconds if not specified.
+    bool isStaleWhileRevalidate(long long requestTime, unsigned window) const;
 
     bool isChunked() const;
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HTTPSecureContext.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "Test.util.h"
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+HttpSecureContext::HttpSecureContext() :
+    maxSessions(DefaultMaxSessions),
+    handshakes(0),
+    resumed(0)
+{
+}
+
+HttpSecureContext::~HttpSecureContext()
+{
+    clear();
+}
+
+// Returns the index of the SSL ex_data that points to the host:port key of
+// the connection.
+int HttpSecureContext::getKeyIndex()
+{
+    static int index = SSL_get_ex_new_index(0, 0, 0, 0, 0);
+    return index;
+}
+
+boost::asio::ssl::context& HttpSecureContext::getContext()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!context) {
+        context.reset(new boost::asio::ssl::context(boost::asio::ssl::context::sslv23));
+        context->set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2);
+        context->set_default_verify_paths();
+
+        // Sessions are kept in this object rather than in the OpenSSL
+        // internal cache, which is looked up only by servers.
+        SSL_CTX* ctx = context->native_handle();
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, newSession);
+    }
+    return *context;
+}
+
+void HttpSecureContext::prepare(SSL* ssl, const std::string& hostname, const std::string* key, bool http2)
+{
+    static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+
+    SSL_set_tlsext_host_name(ssl, hostname.c_str());
+    SSL_set_ex_data(ssl, getKeyIndex(), const_cast<std::string*>(key));
+    if (http2)
+        SSL_set_alpn_protos(ssl, protocols, sizeof protocols - 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = table.find(*key);
+    if (found != table.end())
+        SSL_set_session(ssl, found->second->second);
+}
+
+void HttpSecureContext::handshaken(SSL* ssl)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    ++handshakes;
+    if (SSL_session_reused(ssl)) {
+        ++resumed;
+        if (3 <= getLogLevel())
+            std::cerr << __func__ << " resumed " << *static_cast<std::string*>(SSL_get_ex_data(ssl, getKeyIndex())) << '\n';
+    }
+}
+
+bool HttpSecureContext::isHttp2(SSL* ssl)
+{
+    const unsigned char* protocol;
+    unsigned length;
+    SSL_get0_alpn_selected(ssl, &protocol, &length);
+    return length == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+// Called by OpenSSL when a new session has been established. Note with TLS
+// 1.3, sessions arrive after the handshake has been completed.
+int HttpSecureContext::newSession(SSL* ssl, SSL_SESSION* session)
+{
+    std::string* key = static_cast<std::string*>(SSL_get_ex_data(ssl, getKeyIndex()));
+    if (!key)
+        return 0;
+    // Keep a copy since OpenSSL marks the original session not resumable
+    // unless the connection is shut down cleanly, which is rarely the case
+    // with HTTP.
+    if (SSL_SESSION* copy = SSL_SESSION_dup(session))
+        getInstance().storeSession(*key, copy);
+    return 0;
+}
+
+void HttpSecureContext::storeSession(const std::string& key, SSL_SESSION* session)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = table.find(key);
+    if (found != table.end()) {
+        SSL_SESSION_free(found->second->second);
+        found->second->second = session;
+        lru.splice(lru.begin(), lru, found->second);
+        return;
+    }
+    lru.push_front(Session(key, session));
+    table[key] = lru.begin();
+    trim();
+}
+
+// Drops the least recently used sessions.
+void HttpSecureContext::trim()
+{
+    while (maxSessions < lru.size()) {
+        SSL_SESSION_free(lru.back().second);
+        table.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void HttpSecureContext::removeSession(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto found = table.find(key);
+    if (found == table.end())
+        return;
+    SSL_SESSION_free(found->second->second);
+    lru.erase(found->second);
+    table.erase(found);
+}
+
+void HttpSecureContext::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto i = lru.begin(); i != lru.end(); ++i)
+        SSL_SESSION_free(i->second);
+    lru.clear();
+    table.clear();
+}
+
+void HttpSecureContext::setMaxSessions(unsigned count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    maxSessions = std::max(1u, count);
+    trim();
+}
+
+void HttpSecureContext::dump()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::cout << "sessions: " << lru.size() << '/' << maxSessions << " handshakes: " << handshakes << " resumed: " << resumed << '\n';
+}
+
+}}}}  // org::w3c::dom::bootstrap
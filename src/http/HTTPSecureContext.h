@@ -0,0 +1,95 @@
+/*
+ * Copyright 2013 Esrille Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ES_HTTP_SECURE_CONTEXT_H
+#define ES_HTTP_SECURE_CONTEXT_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio/ssl.hpp>
+
+namespace org { namespace w3c { namespace dom { namespace bootstrap {
+
+// HttpSecureContext holds the TLS client context shared by all the https
+// connections. It also keeps the latest TLS session of each host:port so
+// that a reconnection can resume it with an abbreviated handshake.
+class HttpSecureContext
+{
+    typedef std::pair<std::string, SSL_SESSION*> Session;
+    typedef std::list<Session> SessionList;
+
+    std::mutex mutex;
+    std::unique_ptr<boost::asio::ssl::context> context;
+    SessionList lru;
+    std::unordered_map<std::string, SessionList::iterator> table;
+    unsigned maxSessions;
+
+    // statistics
+    unsigned long long handshakes;
+    unsigned long long resumed;
+
+    static int getKeyIndex();
+    static int newSession(SSL* ssl, SSL_SESSION* session);
+
+    void storeSession(const std::string& key, SSL_SESSION* session);
+    void trim();
+
+public:
+    static const unsigned DefaultMaxSessions = 64;
+
+    HttpSecureContext();
+    ~HttpSecureContext();
+
+    // Note the system CA certificates are loaded upon the first call.
+    boost::asio::ssl::context& getContext();
+
+    // Prepares ssl for a handshake with the host. key must remain valid
+    // while ssl is used. If http2 is true, "h2" is offered by ALPN ahead of
+    // "http/1.1".
+    void prepare(SSL* ssl, const std::string& hostname, const std::string* key, bool http2 = false);
+    void handshaken(SSL* ssl);
+    void removeSession(const std::string& key);
+    void clear();
+
+    unsigned getMaxSessions() const {
+        return maxSessions;
+    }
+    void setMaxSessions(unsigned count);
+    unsigned long long getHandshakeCount() const {
+        return handshakes;
+    }
+    unsigned long long getResumedCount() const {
+        return resumed;
+    }
+
+    void dump();
+
+    // Returns true if the server has selected "h2" by ALPN.
+    static bool isHttp2(SSL* ssl);
+
+    static HttpSecureContext& getInstance() {
+        static HttpSecureContext instance;
+        return instance;
+    }
+};
+
+}}}}  // org::w3c::dom::bootstrap
+
+#endif  // ES_HTTP_SECURE_CONTEXT_H
@@ -281,6 +281,12 @@
 #include "DOMRectReadOnlyImp.h"
 #include "DOMRectListImp.h"
 
+// resource timing
+#include "PerformanceEntryImp.h"
+#include "PerformanceEntryListImp.h"
+#include "PerformanceImp.h"
+#include "PerformanceResourceTimingImp.h"
+
 // xbl2
 // #include "xbl/DocumentXBLImp.h"
 // #include "xbl/ElementXBLImp.h"
@@ -577,6 +583,10 @@ void initializeClasses()
     DOMRectReadOnlyImp::setStaticPrivate(new NativeClass(DOMRectReadOnlyImp::getMetaData()));
     DOMRectImp::setStaticPrivate(new NativeClass(DOMRectImp::getMetaData()));
     DOMRectListImp::setStaticPrivate(new NativeClass(DOMRectListImp::getMetaData()));
+    PerformanceEntryImp::setStaticPrivate(new NativeClass(PerformanceEntryImp::getMetaData()));
+    PerformanceResourceTimingImp::setStaticPrivate(new NativeClass(PerformanceResourceTimingImp::getMetaData()));
+    PerformanceEntryListImp::setStaticPrivate(new NativeClass(PerformanceEntryListImp::getMetaData()));
+    PerformanceImp::setStaticPrivate(new NativeClass(PerformanceImp::getMetaData()));
     XBLContentElementImp::setStaticPrivate(new NativeClass(XBLContentElementImp::getMetaData()));
     XBLImplementationImp::setStaticPrivate(new NativeClass(XBLImplementationImp::getMetaData()));
     XBLImplementationListImp::setStaticPrivate(new NativeClass(XBLImplementationListImp::getMetaData()));
@@ -280,6 +280,12 @@
 #include "DOMRectReadOnlyImp.h"
 #include "DOMRectListImp.h"
 
+// resource timing
+#include "PerformanceEntryImp.h"
+#include "PerformanceEntryListImp.h"
+#include "PerformanceImp.h"
+#include "PerformanceResourceTimingImp.h"
+
 // xbl2
 // #include "xbl/DocumentXBLImp.h"
 // #include "xbl/ElementXBLImp.h"
@@ -565,6 +571,10 @@ void registerClasses(v8::Handle<v8::ObjectTemplate> global)
     DOMRectReadOnlyImp::setStaticPrivate(new NativeClass(global, DOMRectReadOnlyImp::getMetaData()));
     DOMRectImp::setStaticPrivate(new NativeClass(global, DOMRectImp::getMetaData()));
     DOMRectListImp::setStaticPrivate(new NativeClass(global, DOMRectListImp::getMetaData()));
+    PerformanceEntryImp::setStaticPrivate(new NativeClass(global, PerformanceEntryImp::getMetaData()));
+    PerformanceResourceTimingImp::setStaticPrivate(new NativeClass(global, PerformanceResourceTimingImp::getMetaData()));
+    PerformanceEntryListImp::setStaticPrivate(new NativeClass(global, PerformanceEntryListImp::getMetaData()));
+    PerformanceImp::setStaticPrivate(new NativeClass(global, PerformanceImp::getMetaData()));
     XBLContentElementImp::setStaticPrivate(new NativeClass(global, XBLContentElementImp::getMetaData()));
     XBLImplementationImp::setStaticPrivate(new NativeClass(global, XBLImplementationImp::getMetaData()));
     XBLImplementationListImp::setStaticPrivate(new NativeClass(global, XBLImplementationListImp::getMetaData()));